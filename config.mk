@@ -0,0 +1,2 @@
+PKG_CFLAGS =  -D_DEFAULT_SOURCE -D_XOPEN_SOURCE=600 
+PKG_LDFLAGS = -lcups -lncursesw -ltinfo 
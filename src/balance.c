@@ -0,0 +1,299 @@
+#include "balance.h"
+#include "util.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t balance_stop;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    balance_stop = 1;
+}
+
+static int add_pair(class_member_t **pairs, int *count, int *capacity,
+                    const char *group, const char *printer) {
+    if (*count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        class_member_t *grown = realloc(*pairs, *capacity * sizeof(class_member_t));
+        if (!grown) return -1;
+        *pairs = grown;
+    }
+    class_member_t *m = &(*pairs)[(*count)++];
+    memset(m, 0, sizeof(*m));
+    strncpy(m->class_name, group, sizeof(m->class_name) - 1);
+    strncpy(m->printer, printer, sizeof(m->printer) - 1);
+    return 0;
+}
+
+int balance_load_config(balance_config_t *cfg, char *err, size_t errlen) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->policy = POLICY_FAILOVER;
+    cfg->threshold = 3;
+    cfg->max_moves = 20;
+    cfg->use_classes = 1;
+    if (errlen > 0) err[0] = '\0';
+
+    char path[1024];
+    if (config_path(path, sizeof(path), BALANCE_CONFIG) != 0) return 0;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    int capacity = 0;
+    int lineno = 0;
+    int status = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char *key = strtok(line, " \t\r\n");
+        if (!key) continue;
+        char *value = strtok(NULL, " \t\r\n");
+
+        if (strcmp(key, "policy") == 0 && value && strcmp(value, "failover") == 0) {
+            cfg->policy = POLICY_FAILOVER;
+        } else if (strcmp(key, "policy") == 0 && value && strcmp(value, "balance") == 0) {
+            cfg->policy = POLICY_BALANCE;
+        } else if (strcmp(key, "threshold") == 0 && value && atoi(value) > 0) {
+            cfg->threshold = atoi(value);
+        } else if (strcmp(key, "max-moves") == 0 && value && atoi(value) > 0) {
+            cfg->max_moves = atoi(value);
+        } else if (strcmp(key, "classes") == 0 && value) {
+            cfg->use_classes = strcmp(value, "yes") == 0;
+        } else if (strcmp(key, "group") == 0 && value) {
+            char *member;
+            while ((member = strtok(NULL, " \t\r\n"))) {
+                add_pair(&cfg->groups, &cfg->group_count, &capacity, value, member);
+            }
+        } else {
+            snprintf(err, errlen, "%s:%d: bad setting '%s'", path, lineno, key);
+            status = -1;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return status;
+}
+
+void balance_free_config(balance_config_t *cfg) {
+    free(cfg->groups);
+    cfg->groups = NULL;
+    cfg->group_count = 0;
+}
+
+static const printer_info_t *find_printer(const printer_info_t *printers, int count,
+                                          const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(printers[i].name, name) == 0) return &printers[i];
+    }
+    return NULL;
+}
+
+static int already_moved(const balance_move_t *moves, int count, int job_id) {
+    for (int i = 0; i < count; i++) {
+        if (moves[i].job_id == job_id) return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const printer_info_t *printer;
+    int depth;                  /* Pending plus printing jobs */
+    int usable;                 /* Can take jobs */
+} member_t;
+
+/* Plan moves within one group of members */
+static void plan_group(const balance_config_t *cfg, member_t *members, int member_count,
+                       const job_info_t *jobs, int job_count,
+                       balance_move_t **moves, int *count, int *capacity) {
+    for (int src = 0; src < member_count && *count < cfg->max_moves; src++) {
+        member_t *from = &members[src];
+        const char *reason = NULL;
+        if (strcmp(from->printer->state, "stopped") == 0) reason = "stopped";
+        else if (!from->printer->accepting) reason = "not accepting";
+        else if (cfg->policy != POLICY_BALANCE) continue;
+
+        /* Newest pending jobs first: the oldest will print soonest where they are */
+        for (int j = job_count - 1; j >= 0 && *count < cfg->max_moves; j--) {
+            const job_info_t *job = &jobs[j];
+            if (strcmp(job->printer, from->printer->name) != 0) continue;
+            if (strcmp(job->state, "pending") != 0) continue;
+            if (already_moved(*moves, *count, job->id)) continue;
+
+            member_t *to = NULL;
+            for (int t = 0; t < member_count; t++) {
+                if (t == src || !members[t].usable) continue;
+                if (!to || members[t].depth < to->depth) to = &members[t];
+            }
+            if (!to) return;
+
+            /* Overloaded only while the gap to the least loaded stays wide */
+            if (!reason && from->depth - to->depth <= cfg->threshold) break;
+
+            if (*count >= *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 16;
+                balance_move_t *grown = realloc(*moves, *capacity * sizeof(balance_move_t));
+                if (!grown) return;
+                *moves = grown;
+            }
+            balance_move_t *m = &(*moves)[(*count)++];
+            memset(m, 0, sizeof(*m));
+            m->job_id = job->id;
+            strncpy(m->title, job->title, sizeof(m->title) - 1);
+            strncpy(m->user, job->user, sizeof(m->user) - 1);
+            strncpy(m->from, from->printer->name, sizeof(m->from) - 1);
+            strncpy(m->to, to->printer->name, sizeof(m->to) - 1);
+            m->reason = reason ? reason : "overloaded";
+
+            from->depth--;
+            to->depth++;
+        }
+    }
+}
+
+static int cmp_job_id(const void *a, const void *b) {
+    int x = ((const job_info_t *)a)->id, y = ((const job_info_t *)b)->id;
+    return (x > y) - (x < y);
+}
+
+int balance_plan(const balance_config_t *cfg, const printer_info_t *printers, int printer_count,
+                 const job_info_t *jobs, int job_count, balance_move_t **moves) {
+    *moves = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    /* Groups from the config, then CUPS classes */
+    class_member_t *pairs = NULL;
+    int pair_count = 0;
+    int pair_capacity = 0;
+    for (int i = 0; i < cfg->group_count; i++) {
+        add_pair(&pairs, &pair_count, &pair_capacity, cfg->groups[i].class_name,
+                 cfg->groups[i].printer);
+    }
+    if (cfg->use_classes) {
+        class_member_t *classes;
+        int class_count = get_class_members(&classes);
+        for (int i = 0; i < class_count; i++) {
+            add_pair(&pairs, &pair_count, &pair_capacity, classes[i].class_name,
+                     classes[i].printer);
+        }
+        free_class_members(classes);
+    }
+
+    job_info_t *sorted = malloc((job_count ? job_count : 1) * sizeof(job_info_t));
+    member_t *members = malloc((pair_count ? pair_count : 1) * sizeof(member_t));
+    if (!sorted || !members) goto done;
+    memcpy(sorted, jobs, job_count * sizeof(job_info_t));
+    qsort(sorted, job_count, sizeof(job_info_t), cmp_job_id);
+
+    for (int g = 0; g < pair_count; g++) {
+        /* Handle each group once, at its first pair */
+        int first = 1;
+        for (int k = 0; k < g; k++) {
+            if (strcmp(pairs[k].class_name, pairs[g].class_name) == 0) first = 0;
+        }
+        if (!first) continue;
+
+        int member_count = 0;
+        for (int k = g; k < pair_count; k++) {
+            if (strcmp(pairs[k].class_name, pairs[g].class_name) != 0) continue;
+            const printer_info_t *p = find_printer(printers, printer_count, pairs[k].printer);
+            if (!p || p->is_class) continue;
+
+            member_t *m = &members[member_count++];
+            m->printer = p;
+            m->usable = p->accepting && strcmp(p->state, "stopped") != 0;
+            m->depth = 0;
+            for (int j = 0; j < job_count; j++) {
+                if (strcmp(jobs[j].printer, p->name) == 0 &&
+                    (strcmp(jobs[j].state, "pending") == 0 ||
+                     strcmp(jobs[j].state, "printing") == 0)) {
+                    m->depth++;
+                }
+            }
+        }
+
+        plan_group(cfg, members, member_count, sorted, job_count, moves, &count, &capacity);
+    }
+
+done:
+    free(sorted);
+    free(members);
+    free(pairs);
+    return count;
+}
+
+void balance_audit(const balance_move_t *move, int result) {
+    char path[1024];
+    if (state_path(path, sizeof(path), BALANCE_LOG) != 0) return;
+    FILE *fp = fopen(path, "a");
+    if (!fp) return;
+
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    fprintf(fp, "%s %s job=%d from=%s to=%s reason=\"%s\" user=%s title=\"%s\"\n",
+            stamp, result == 0 ? "moved" : "failed", move->job_id, move->from, move->to,
+            move->reason, move->user, move->title);
+    fclose(fp);
+}
+
+int balance_run(int interval_ms, int dry_run) {
+    balance_config_t cfg;
+    char err[1024];
+    if (balance_load_config(&cfg, err, sizeof(err)) != 0) {
+        fprintf(stderr, "spoolie: %s\n", err);
+        return 1;
+    }
+
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!balance_stop) {
+        printer_info_t *printers;
+        job_info_t *jobs;
+        int printer_count = get_printers(&printers);
+        int job_count = get_jobs(&jobs);
+
+        balance_move_t *moves;
+        int count = balance_plan(&cfg, printers, printer_count, jobs, job_count, &moves);
+        for (int i = 0; i < count; i++) {
+            balance_move_t *m = &moves[i];
+            int result = 0;
+            if (!dry_run) {
+                result = move_job(m->job_id, m->to);
+                balance_audit(m, result);
+            }
+            printf("%s job %d %s -> %s (%s)\n",
+                   dry_run ? "would move" : result == 0 ? "moved" : "failed to move",
+                   m->job_id, m->from, m->to, m->reason);
+        }
+        fflush(stdout);
+
+        free(moves);
+        free_printers(printers);
+        free_jobs(jobs);
+
+        /* A dry run reports a single plan */
+        if (dry_run) break;
+
+        /* Sleep in short steps so a signal stops us promptly */
+        for (int slept = 0; slept < interval_ms && !balance_stop; slept += 100) {
+            usleep(100 * 1000);
+        }
+    }
+
+    balance_free_config(&cfg);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef BALANCE_H
+#define BALANCE_H
+
+#include "cups_api.h"
+
+#define BALANCE_CONFIG "balance.conf"
+#define BALANCE_LOG "balance.log"
+
+typedef enum {
+    POLICY_FAILOVER,    /* Only drain stopped or rejecting printers */
+    POLICY_BALANCE      /* Also even out queue depth within a group */
+} balance_policy_t;
+
+/*
+ * Rebalancing settings from $XDG_CONFIG_HOME/spoolie/balance.conf:
+ *
+ *   policy balance          # or failover (default)
+ *   threshold 3             # depth difference that triggers a move
+ *   max-moves 20            # per pass
+ *   classes yes             # treat each CUPS class as a group (default)
+ *   group floor3 hp-1 hp-2 hp-3
+ */
+typedef struct {
+    balance_policy_t policy;
+    int threshold;
+    int max_moves;
+    int use_classes;
+    class_member_t *groups;     /* (group, printer) pairs from group lines */
+    int group_count;
+} balance_config_t;
+
+typedef struct {
+    int job_id;
+    char title[256];
+    char user[64];
+    char from[256];
+    char to[256];
+    const char *reason;
+} balance_move_t;
+
+/* Load the config, or defaults if there is none. Returns -1 on a bad line
+ * and describes it in err */
+int balance_load_config(balance_config_t *cfg, char *err, size_t errlen);
+void balance_free_config(balance_config_t *cfg);
+
+/* Work out which pending jobs to move. Returns count; caller frees moves */
+int balance_plan(const balance_config_t *cfg, const printer_info_t *printers, int printer_count,
+                 const job_info_t *jobs, int job_count, balance_move_t **moves);
+
+/* Append an applied move to the audit log */
+void balance_audit(const balance_move_t *move, int result);
+
+/* --balance: apply plans every interval_ms without a UI. Returns exit status */
+int balance_run(int interval_ms, int dry_run);
+
+#endif
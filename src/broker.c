@@ -0,0 +1,425 @@
+#include "broker.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BROKER_MAGIC 0x53504f4fu    /* "SPOO" */
+#define BROKER_LAYOUT 1
+#define BROKER_INITIAL_SIZE (1024 * 1024)
+#define BROKER_RETRY_MS 5000        /* Between attach attempts without a broker */
+#define BROKER_STALE_MS 10000       /* Minimum silence before a broker counts as gone */
+#define BROKER_READ_TRIES 1000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t layout;
+    uint32_t printer_size;          /* sizeof(printer_info_t) of the writer */
+    uint32_t job_size;
+    uint64_t size;                  /* Region size, fixed for its lifetime */
+    uint32_t interval_ms;
+    int32_t pid;
+    _Atomic uint64_t heartbeat;     /* monotonic_ms of the last good poll, 0 once retired */
+    _Atomic uint32_t seq;           /* Odd while the fields below are being written */
+    uint64_t generation;            /* Bumped whenever the lists change */
+    int32_t printer_count;
+    int32_t job_count;
+    /* printer_info_t[printer_count] then job_info_t[job_count] at BROKER_DATA */
+} broker_header_t;
+
+#define BROKER_DATA ((sizeof(broker_header_t) + 63) & ~(size_t)63)
+
+/* Client attachment; one per process, shared by the UI and the history
+ * sampler under client_lock */
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    int fd;
+    broker_header_t *hdr;
+    size_t mapped;
+    uint64_t next_try;
+} client = { -1, NULL, 0, 0 };
+
+static volatile sig_atomic_t broker_stop;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    broker_stop = 1;
+}
+
+static uint64_t stale_after(const broker_header_t *hdr) {
+    uint64_t ms = (uint64_t)hdr->interval_ms * 3;
+    return ms > BROKER_STALE_MS ? ms : BROKER_STALE_MS;
+}
+
+static int is_live(broker_header_t *hdr) {
+    uint64_t beat = atomic_load_explicit(&hdr->heartbeat, memory_order_acquire);
+    return beat != 0 && monotonic_ms() - beat < stale_after(hdr);
+}
+
+/*
+ * Anyone can create the shared object name, so a region is only believed
+ * if it belongs to root, BROKER_USER or the caller, and nobody else can
+ * write to it.
+ */
+static int trusted_region(const struct stat *st) {
+    if (st->st_mode & (S_IWGRP | S_IWOTH)) return 0;
+    if (st->st_uid == 0 || st->st_uid == getuid()) return 1;
+    struct passwd *pw = getpwnam(BROKER_USER);
+    return pw && pw->pw_uid == st->st_uid;
+}
+
+/* ---- Client ---- */
+
+static void detach(void) {
+    if (client.hdr) munmap(client.hdr, client.mapped);
+    if (client.fd >= 0) close(client.fd);
+    client.hdr = NULL;
+    client.mapped = 0;
+    client.fd = -1;
+}
+
+void broker_detach(void) {
+    pthread_mutex_lock(&client_lock);
+    detach();
+    pthread_mutex_unlock(&client_lock);
+}
+
+static broker_header_t *attach(void) {
+    if (client.hdr) {
+        if (is_live(client.hdr)) return client.hdr;
+
+        /* A retired region means the broker moved to a bigger one: follow
+         * it now. Otherwise the broker is gone; back off before retrying. */
+        int retired = atomic_load(&client.hdr->heartbeat) == 0;
+        detach();
+        client.next_try = retired ? 0 : monotonic_ms() + BROKER_RETRY_MS;
+        if (!retired) return NULL;
+    }
+
+    uint64_t now = monotonic_ms();
+    if (now < client.next_try) return NULL;
+    client.next_try = now + BROKER_RETRY_MS;
+
+    int fd = shm_open(BROKER_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !trusted_region(&st) || (size_t)st.st_size < BROKER_DATA) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    client.fd = fd;
+    client.hdr = map;
+    client.mapped = st.st_size;
+
+    broker_header_t *hdr = client.hdr;
+    if (hdr->magic != BROKER_MAGIC || hdr->layout != BROKER_LAYOUT ||
+        hdr->printer_size != sizeof(printer_info_t) || hdr->job_size != sizeof(job_info_t) ||
+        hdr->size > client.mapped || !is_live(hdr)) {
+        detach();
+        return NULL;
+    }
+    return hdr;
+}
+
+/*
+ * Copy one list out under the seqlock. which is 0 for printers and 1 for
+ * jobs. Returns the count, or -1 without a usable snapshot.
+ */
+static int read_list_locked(int which, void **out) {
+    *out = NULL;
+    broker_header_t *hdr = attach();
+    if (!hdr) return -1;
+
+    const char *base = (const char *)hdr;
+    for (int tries = 0; tries < BROKER_READ_TRIES; tries++) {
+        uint32_t s1 = atomic_load_explicit(&hdr->seq, memory_order_acquire);
+        if (s1 & 1) {
+            sched_yield();
+            continue;
+        }
+
+        int printers = hdr->printer_count;
+        int jobs = hdr->job_count;
+        size_t end = BROKER_DATA + (size_t)printers * sizeof(printer_info_t) +
+                     (size_t)jobs * sizeof(job_info_t);
+        int count = which == 0 ? printers : jobs;
+        size_t item = which == 0 ? sizeof(printer_info_t) : sizeof(job_info_t);
+        size_t off = BROKER_DATA + (which == 0 ? 0 : (size_t)printers * sizeof(printer_info_t));
+
+        /* Counts read mid-update can be garbage; only trust them in bounds */
+        void *copy = NULL;
+        if (printers >= 0 && jobs >= 0 && end <= client.mapped && count > 0) {
+            copy = malloc(count * item);
+            if (!copy) return -1;
+            memcpy(copy, base + off, count * item);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&hdr->seq, memory_order_relaxed) == s1 &&
+            end <= client.mapped && printers >= 0 && jobs >= 0) {
+            *out = copy;
+            return count > 0 ? count : 0;
+        }
+        free(copy);
+    }
+    return -1;
+}
+
+static int read_list(int which, void **out) {
+    pthread_mutex_lock(&client_lock);
+    int count = read_list_locked(which, out);
+    pthread_mutex_unlock(&client_lock);
+    return count;
+}
+
+int broker_get_printers(printer_info_t **printers) {
+    void *items;
+    int count = read_list(0, &items);
+    *printers = items;
+    return count;
+}
+
+int broker_get_jobs(job_info_t **jobs) {
+    void *items;
+    int count = read_list(1, &items);
+    *jobs = items;
+    return count;
+}
+
+uint64_t broker_generation(void) {
+    pthread_mutex_lock(&client_lock);
+    broker_header_t *hdr = attach();
+    uint64_t generation = 0;
+
+    for (int tries = 0; hdr && tries < BROKER_READ_TRIES; tries++) {
+        uint32_t s1 = atomic_load_explicit(&hdr->seq, memory_order_acquire);
+        if (s1 & 1) {
+            sched_yield();
+            continue;
+        }
+        uint64_t seen = hdr->generation;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&hdr->seq, memory_order_relaxed) == s1) {
+            generation = seen;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&client_lock);
+    return generation;
+}
+
+/* ---- Broker ---- */
+
+typedef struct {
+    int fd;
+    broker_header_t *hdr;
+    size_t size;
+    uint64_t generation;
+    int interval_ms;
+} region_t;
+
+/* Pid of the live broker publishing under the name, 0 if there is none */
+static pid_t running_broker(void) {
+    int fd = shm_open(BROKER_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) return 0;
+
+    pid_t pid = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && trusted_region(&st) && (size_t)st.st_size >= BROKER_DATA) {
+        broker_header_t *hdr = mmap(NULL, BROKER_DATA, PROT_READ, MAP_SHARED, fd, 0);
+        if (hdr != MAP_FAILED) {
+            if (hdr->magic == BROKER_MAGIC && hdr->pid != getpid() && is_live(hdr)) pid = hdr->pid;
+            munmap(hdr, BROKER_DATA);
+        }
+    }
+    close(fd);
+    return pid;
+}
+
+/*
+ * Job titles and users are hidden from other users by CUPS, so the
+ * region is readable only by members of BROKER_GROUP when it exists, and
+ * by the broker's own user otherwise.
+ */
+static void restrict_access(int fd) {
+    struct group *gr = getgrnam(BROKER_GROUP);
+    if (gr && fchown(fd, (uid_t)-1, gr->gr_gid) == 0) {
+        fchmod(fd, 0640);
+    } else {
+        fchmod(fd, 0600);
+    }
+}
+
+static int region_create(region_t *r, size_t size) {
+    /* Always a fresh object of our own, never one someone else made */
+    int fd = shm_open(BROKER_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        pid_t pid = running_broker();
+        if (pid) {
+            fprintf(stderr, "spoolie: broker already running (pid %d)\n", (int)pid);
+            errno = EEXIST;
+            return -1;
+        }
+        /* Stale or foreign region: start over */
+        if (shm_unlink(BROKER_SHM_NAME) != 0) return -1;
+        fd = shm_open(BROKER_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) return -1;
+
+    restrict_access(fd);
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(BROKER_SHM_NAME);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        shm_unlink(BROKER_SHM_NAME);
+        return -1;
+    }
+
+    r->fd = fd;
+    r->hdr = map;
+    r->size = size;
+
+    broker_header_t *hdr = r->hdr;
+    hdr->layout = BROKER_LAYOUT;
+    hdr->printer_size = sizeof(printer_info_t);
+    hdr->job_size = sizeof(job_info_t);
+    hdr->size = size;
+    hdr->interval_ms = r->interval_ms;
+    hdr->pid = getpid();
+    hdr->generation = r->generation;
+    hdr->printer_count = 0;
+    hdr->job_count = 0;
+    atomic_store(&hdr->seq, 0);
+    atomic_store(&hdr->heartbeat, 0);
+    atomic_thread_fence(memory_order_release);
+    hdr->magic = BROKER_MAGIC;
+    return 0;
+}
+
+/* Mark the region dead for attached clients and remove it */
+static void region_retire(region_t *r) {
+    atomic_store_explicit(&r->hdr->heartbeat, 0, memory_order_release);
+    munmap(r->hdr, r->size);
+    close(r->fd);
+    shm_unlink(BROKER_SHM_NAME);
+    r->hdr = NULL;
+}
+
+static int publish(region_t *r, const printer_info_t *printers, int printer_count,
+                   const job_info_t *jobs, int job_count) {
+    size_t printers_len = (size_t)printer_count * sizeof(printer_info_t);
+    size_t jobs_len = (size_t)job_count * sizeof(job_info_t);
+    size_t need = BROKER_DATA + printers_len + jobs_len;
+
+    /*
+     * Shared memory objects cannot be resized everywhere (macOS allows one
+     * ftruncate), so growing means a new object. Clients see the old one
+     * retired and reattach straight away.
+     */
+    if (need > r->size) {
+        size_t size = r->size;
+        while (size < need) size *= 2;
+        region_retire(r);
+        if (region_create(r, size) != 0) return -1;
+    }
+
+    broker_header_t *hdr = r->hdr;
+    char *base = (char *)hdr;
+    int changed = hdr->printer_count != printer_count || hdr->job_count != job_count ||
+                  memcmp(base + BROKER_DATA, printers, printers_len) != 0 ||
+                  memcmp(base + BROKER_DATA + printers_len, jobs, jobs_len) != 0;
+
+    if (changed) {
+        uint32_t seq = atomic_load_explicit(&hdr->seq, memory_order_relaxed);
+        atomic_store_explicit(&hdr->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        if (printers_len) memcpy(base + BROKER_DATA, printers, printers_len);
+        if (jobs_len) memcpy(base + BROKER_DATA + printers_len, jobs, jobs_len);
+        hdr->printer_count = printer_count;
+        hdr->job_count = job_count;
+        hdr->generation = ++r->generation;
+
+        atomic_store_explicit(&hdr->seq, seq + 2, memory_order_release);
+    }
+
+    atomic_store_explicit(&hdr->heartbeat, monotonic_ms(), memory_order_release);
+    return 0;
+}
+
+int broker_run(int interval_ms) {
+    region_t region = { .fd = -1, .interval_ms = interval_ms };
+    if (region_create(&region, BROKER_INITIAL_SIZE) != 0) {
+        if (errno != EEXIST) {
+            fprintf(stderr, "spoolie: cannot create %s: %s\n", BROKER_SHM_NAME, strerror(errno));
+        }
+        return 1;
+    }
+
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int failing = 0;
+    while (!broker_stop) {
+        printer_info_t *printers;
+        int printer_count = get_printers(&printers);
+        if (printer_count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) {
+            /* Let the heartbeat lapse so clients go to cupsd themselves */
+            if (!failing) fprintf(stderr, "spoolie: %s\n", cupsLastErrorString());
+            failing = 1;
+        } else {
+            job_info_t *jobs;
+            int job_count = get_jobs(&jobs);
+            if (job_count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) {
+                /* An empty list would tell every client the queue drained */
+                if (!failing) fprintf(stderr, "spoolie: %s\n", cupsLastErrorString());
+                failing = 1;
+                free_jobs(jobs);
+                free_printers(printers);
+                goto wait;
+            }
+            failing = 0;
+            int status = publish(&region, printers, printer_count, jobs, job_count);
+            free_jobs(jobs);
+            if (status != 0) {
+                fprintf(stderr, "spoolie: cannot grow %s: %s\n", BROKER_SHM_NAME, strerror(errno));
+                free_printers(printers);
+                return 1;
+            }
+        }
+        free_printers(printers);
+
+wait:
+        /* Sleep in short steps so a signal stops us promptly */
+        for (int slept = 0; slept < interval_ms && !broker_stop; slept += 100) {
+            usleep(100 * 1000);
+        }
+    }
+
+    region_retire(&region);
+    return 0;
+}
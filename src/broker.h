@@ -0,0 +1,34 @@
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stdint.h>
+#include "cups_api.h"
+
+/*
+ * Snapshot broker. One process polls CUPS and publishes the printer and
+ * job lists into a shared memory region guarded by a seqlock; any number
+ * of TUI instances on the host read them from there instead of each
+ * asking cupsd. The region is readable by BROKER_GROUP, and clients
+ * ignore one that isn't owned by root, BROKER_USER or themselves.
+ */
+#define BROKER_SHM_NAME "/spoolie-broker"
+#define BROKER_GROUP "spoolie"
+#define BROKER_USER "lp"
+
+/* Run the broker until interrupted. Returns exit status */
+int broker_run(int interval_ms);
+
+/*
+ * Client side. The getters return -1 when no live broker is publishing,
+ * in which case the caller should go to CUPS itself. Arrays are freed
+ * with free_printers() and free_jobs().
+ */
+int broker_get_printers(printer_info_t **printers);
+int broker_get_jobs(job_info_t **jobs);
+
+/* Version of the published snapshot, 0 without a live broker */
+uint64_t broker_generation(void);
+
+void broker_detach(void);
+
+#endif
@@ -55,6 +55,9 @@ int get_printers(printer_info_t **printers) {
         val = cupsGetOption("printer-location", dest->num_options, dest->options);
         if (val) strncpy(p->location, val, sizeof(p->location) - 1);
 
+        val = cupsGetOption("device-uri", dest->num_options, dest->options);
+        if (val) strncpy(p->device_uri, val, sizeof(p->device_uri) - 1);
+
         val = cupsGetOption("printer-state", dest->num_options, dest->options);
         if (val) {
             ipp_pstate_t state = (ipp_pstate_t)atoi(val);
@@ -63,6 +66,9 @@ int get_printers(printer_info_t **printers) {
 
         val = cupsGetOption("printer-is-accepting-jobs", dest->num_options, dest->options);
         p->accepting = val ? (strcmp(val, "true") == 0) : 1;
+
+        val = cupsGetOption("printer-type", dest->num_options, dest->options);
+        p->is_class = val ? (atoi(val) & CUPS_PRINTER_CLASS) != 0 : 0;
     }
 
     cupsFreeDests(num_dests, dests);
@@ -73,39 +79,202 @@ void free_printers(printer_info_t *printers) {
     free(printers);
 }
 
+void free_jobs(job_info_t *jobs) {
+    free(jobs);
+}
+
+/* Printer name is the last path segment of job-printer-uri */
+static void printer_from_uri(char *name, size_t len, const char *uri) {
+    const char *slash = strrchr(uri, '/');
+    strncpy(name, slash ? slash + 1 : uri, len - 1);
+}
+
+/* Collect the job groups of a Get-Jobs response */
+static int jobs_from_response(ipp_t *response, job_info_t **jobs) {
+    int count = 0;
+    int capacity = 0;
+    *jobs = NULL;
+
+    ipp_attribute_t *attr = ippFirstAttribute(response);
+    while (attr) {
+        /* Skip to the next job group */
+        while (attr && ippGetGroupTag(attr) != IPP_TAG_JOB)
+            attr = ippNextAttribute(response);
+        if (!attr) break;
+
+        if (count >= capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            job_info_t *grown = realloc(*jobs, capacity * sizeof(job_info_t));
+            if (!grown) break;
+            *jobs = grown;
+        }
+        job_info_t *j = &(*jobs)[count];
+        memset(j, 0, sizeof(*j));
+
+        for (; attr && ippGetGroupTag(attr) == IPP_TAG_JOB; attr = ippNextAttribute(response)) {
+            const char *name = ippGetName(attr);
+            if (!name) continue;
+
+            if (strcmp(name, "job-id") == 0) {
+                j->id = ippGetInteger(attr, 0);
+            } else if (strcmp(name, "job-printer-uri") == 0) {
+                printer_from_uri(j->printer, sizeof(j->printer), ippGetString(attr, 0, NULL));
+            } else if (strcmp(name, "job-name") == 0) {
+                strncpy(j->title, ippGetString(attr, 0, NULL), sizeof(j->title) - 1);
+            } else if (strcmp(name, "job-originating-user-name") == 0) {
+                strncpy(j->user, ippGetString(attr, 0, NULL), sizeof(j->user) - 1);
+            } else if (strcmp(name, "job-state") == 0) {
+                strncpy(j->state, job_state_to_str((ipp_jstate_t)ippGetInteger(attr, 0)),
+                        sizeof(j->state) - 1);
+            } else if (strcmp(name, "job-k-octets") == 0) {
+                j->size = ippGetInteger(attr, 0);
+            } else if (strcmp(name, "job-priority") == 0) {
+                j->priority = ippGetInteger(attr, 0);
+            } else if (strcmp(name, "job-hold-until") == 0) {
+                strncpy(j->hold_until, ippGetString(attr, 0, NULL), sizeof(j->hold_until) - 1);
+            } else if (strcmp(name, "time-at-creation") == 0) {
+                j->created = ippGetInteger(attr, 0);
+            } else if (strcmp(name, "time-at-processing") == 0) {
+                j->processing = ippGetInteger(attr, 0);
+            } else if (strcmp(name, "time-at-completed") == 0) {
+                j->completed = ippGetInteger(attr, 0);
+            }
+        }
+
+        if (j->id > 0) count++;
+    }
+
+    return count;
+}
+
+/* Get-Jobs for which-jobs ("not-completed", "completed" or "all") from first_id on */
+static int fetch_jobs(const char *which, int first_id, job_info_t **jobs) {
+    static const char * const requested[] = {
+        "job-id",
+        "job-printer-uri",
+        "job-name",
+        "job-originating-user-name",
+        "job-state",
+        "job-k-octets",
+        "job-priority",
+        "job-hold-until",
+        "time-at-creation",
+        "time-at-processing",
+        "time-at-completed"
+    };
+
+    *jobs = NULL;
+
+    ipp_t *request = ippNewRequest(IPP_OP_GET_JOBS);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, "ipp://localhost/");
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name",
+                 NULL, cupsUser());
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "which-jobs", NULL, which);
+    /* CUPS extension: skip everything below first-job-id server side */
+    if (first_id > 0)
+        ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "first-job-id", first_id);
+    ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes",
+                  sizeof(requested) / sizeof(requested[0]), NULL, requested);
+
+    ipp_t *response = cupsDoRequest(CUPS_HTTP_DEFAULT, request, "/");
+    if (!response) return 0;
+
+    int count = 0;
+    if (ippGetStatusCode(response) <= IPP_STATUS_OK_CONFLICTING)
+        count = jobs_from_response(response, jobs);
+
+    ippDelete(response);
+    return count;
+}
+
+/* Active jobs, in the scheduler's queue order. cupsGetJobs() has no
+ * job-hold-until, so this asks for the attributes directly */
 int get_jobs(job_info_t **jobs) {
-    cups_job_t *cups_jobs;
-    int num_jobs = cupsGetJobs(&cups_jobs, NULL, 0, CUPS_WHICHJOBS_ACTIVE);
+    return fetch_jobs("not-completed", 0, jobs);
+}
 
-    if (num_jobs <= 0) {
-        *jobs = NULL;
-        return 0;
+int get_finished_jobs(int first_id, job_info_t **jobs) {
+    return fetch_jobs("completed", first_id, jobs);
+}
+
+int get_all_jobs(int first_id, job_info_t **jobs) {
+    return fetch_jobs("all", first_id, jobs);
+}
+
+int get_job_detail(int job_id, job_detail_t *detail) {
+    static const char * const requested[] = {
+        "job-id",
+        "job-state",
+        "job-state-reasons",
+        "job-printer-state-message",
+        "job-impressions-completed",
+        "job-media-sheets-completed",
+        "job-originating-host-name",
+        "time-at-creation",
+        "time-at-processing",
+        "time-at-completed"
+    };
+
+    memset(detail, 0, sizeof(*detail));
+    detail->id = job_id;
+
+    char uri[HTTP_MAX_URI];
+    snprintf(uri, sizeof(uri), "ipp://localhost/jobs/%d", job_id);
+
+    ipp_t *request = ippNewRequest(IPP_OP_GET_JOB_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, uri);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name",
+                 NULL, cupsUser());
+    ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes",
+                  sizeof(requested) / sizeof(requested[0]), NULL, requested);
+
+    ipp_t *response = cupsDoRequest(CUPS_HTTP_DEFAULT, request, "/");
+    if (!response) return -1;
+    if (ippGetStatusCode(response) > IPP_STATUS_OK_CONFLICTING) {
+        ippDelete(response);
+        return -1;
     }
 
-    *jobs = calloc(num_jobs, sizeof(job_info_t));
-    if (!*jobs) {
-        cupsFreeJobs(num_jobs, cups_jobs);
-        return 0;
+    ipp_attribute_t *attr;
+
+    if ((attr = ippFindAttribute(response, "job-state", IPP_TAG_ENUM)))
+        strncpy(detail->state, job_state_to_str((ipp_jstate_t)ippGetInteger(attr, 0)),
+                sizeof(detail->state) - 1);
+
+    if ((attr = ippFindAttribute(response, "job-state-reasons", IPP_TAG_KEYWORD))) {
+        /* Multi-valued - join as a comma separated list */
+        size_t len = 0;
+        for (int i = 0; i < ippGetCount(attr); i++) {
+            const char *reason = ippGetString(attr, i, NULL);
+            if (!reason) continue;
+            len += snprintf(detail->state_reasons + len, sizeof(detail->state_reasons) - len,
+                            "%s%s", len ? ", " : "", reason);
+            if (len >= sizeof(detail->state_reasons)) break;
+        }
     }
 
-    for (int i = 0; i < num_jobs; i++) {
-        cups_job_t *cj = &cups_jobs[i];
-        job_info_t *j = &(*jobs)[i];
+    if ((attr = ippFindAttribute(response, "job-printer-state-message", IPP_TAG_TEXT)))
+        strncpy(detail->printer_state_message, ippGetString(attr, 0, NULL),
+                sizeof(detail->printer_state_message) - 1);
 
-        j->id = cj->id;
-        j->size = cj->size;
-        strncpy(j->printer, cj->dest, sizeof(j->printer) - 1);
-        strncpy(j->title, cj->title, sizeof(j->title) - 1);
-        strncpy(j->user, cj->user, sizeof(j->user) - 1);
-        strncpy(j->state, job_state_to_str(cj->state), sizeof(j->state) - 1);
-    }
+    if ((attr = ippFindAttribute(response, "job-originating-host-name", IPP_TAG_NAME)))
+        strncpy(detail->originating_host, ippGetString(attr, 0, NULL),
+                sizeof(detail->originating_host) - 1);
 
-    cupsFreeJobs(num_jobs, cups_jobs);
-    return num_jobs;
-}
+    /* CUPS reports pages as impressions; older versions only as sheets */
+    if ((attr = ippFindAttribute(response, "job-impressions-completed", IPP_TAG_INTEGER)) ||
+        (attr = ippFindAttribute(response, "job-media-sheets-completed", IPP_TAG_INTEGER)))
+        detail->pages_completed = ippGetInteger(attr, 0);
 
-void free_jobs(job_info_t *jobs) {
-    free(jobs);
+    if ((attr = ippFindAttribute(response, "time-at-creation", IPP_TAG_INTEGER)))
+        detail->created = ippGetInteger(attr, 0);
+    if ((attr = ippFindAttribute(response, "time-at-processing", IPP_TAG_INTEGER)))
+        detail->processing = ippGetInteger(attr, 0);
+    if ((attr = ippFindAttribute(response, "time-at-completed", IPP_TAG_INTEGER)))
+        detail->completed = ippGetInteger(attr, 0);
+
+    ippDelete(response);
+    return 0;
 }
 
 int set_default_printer(const char *name) {
@@ -119,78 +288,220 @@ int cancel_job(int job_id) {
     return cupsCancelJob(NULL, job_id) ? 0 : -1;
 }
 
+int move_job(int job_id, const char *printer) {
+    char job_uri[HTTP_MAX_URI];
+    char printer_uri[HTTP_MAX_URI];
+    snprintf(job_uri, sizeof(job_uri), "ipp://localhost/jobs/%d", job_id);
+    httpAssembleURIf(HTTP_URI_CODING_ALL, printer_uri, sizeof(printer_uri), "ipp", NULL,
+                     "localhost", 0, "/printers/%s", printer);
+
+    ipp_t *request = ippNewRequest(IPP_OP_CUPS_MOVE_JOB);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, job_uri);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name",
+                 NULL, cupsUser());
+    ippAddString(request, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL, printer_uri);
+
+    ippDelete(cupsDoRequest(CUPS_HTTP_DEFAULT, request, "/jobs"));
+    return cupsLastError() <= IPP_STATUS_OK_CONFLICTING ? 0 : -1;
+}
+
+int update_jobs(job_update_t *updates, int count) {
+    /* cupsDoRequest() reconnects by itself if cupsd drops the connection */
+    http_t *http = httpConnect2(cupsServer(), ippPort(), NULL, AF_UNSPEC, cupsEncryption(),
+                                1, 30000, NULL);
+    int failed = 0;
+
+    for (int i = 0; i < count; i++) {
+        job_update_t *u = &updates[i];
+        u->result = -1;
+        if (!http) {
+            failed++;
+            continue;
+        }
+
+        char job_uri[HTTP_MAX_URI];
+        snprintf(job_uri, sizeof(job_uri), "ipp://localhost/jobs/%d", u->job_id);
+
+        ipp_op_t op = u->action == JOB_HOLD ? IPP_OP_HOLD_JOB :
+                      u->action == JOB_RELEASE ? IPP_OP_RELEASE_JOB : IPP_OP_SET_JOB_ATTRIBUTES;
+        ipp_t *request = ippNewRequest(op);
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "job-uri", NULL, job_uri);
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name",
+                     NULL, cupsUser());
+        if (u->action == JOB_SET_PRIORITY)
+            ippAddInteger(request, IPP_TAG_JOB, IPP_TAG_INTEGER, "job-priority", u->priority);
+
+        ippDelete(cupsDoRequest(http, request, "/jobs"));
+        u->result = cupsLastError() <= IPP_STATUS_OK_CONFLICTING ? 0 : -1;
+        if (u->result != 0) failed++;
+    }
+
+    if (http) httpClose(http);
+    return failed;
+}
+
+int get_class_members(class_member_t **members) {
+    static const char * const requested[] = { "printer-name", "member-names" };
+
+    *members = NULL;
+
+    ipp_t *request = ippNewRequest(IPP_OP_CUPS_GET_CLASSES);
+    ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes",
+                  sizeof(requested) / sizeof(requested[0]), NULL, requested);
+
+    ipp_t *response = cupsDoRequest(CUPS_HTTP_DEFAULT, request, "/");
+    if (!response) return 0;
+
+    int count = 0;
+    int capacity = 0;
+    const char *class_name = NULL;
+    ipp_attribute_t *member_names = NULL;
+
+    for (ipp_attribute_t *attr = ippFirstAttribute(response); ;
+         attr = ippNextAttribute(response)) {
+        /* A separator or the end closes the current class */
+        if (!attr || !ippGetName(attr) || ippGetGroupTag(attr) != IPP_TAG_PRINTER) {
+            for (int i = 0; class_name && member_names && i < ippGetCount(member_names); i++) {
+                if (count >= capacity) {
+                    capacity = capacity ? capacity * 2 : 16;
+                    class_member_t *grown = realloc(*members, capacity * sizeof(class_member_t));
+                    if (!grown) break;
+                    *members = grown;
+                }
+                class_member_t *m = &(*members)[count++];
+                memset(m, 0, sizeof(*m));
+                strncpy(m->class_name, class_name, sizeof(m->class_name) - 1);
+                strncpy(m->printer, ippGetString(member_names, i, NULL), sizeof(m->printer) - 1);
+            }
+            class_name = NULL;
+            member_names = NULL;
+            if (!attr) break;
+            continue;
+        }
+
+        if (strcmp(ippGetName(attr), "printer-name") == 0) {
+            class_name = ippGetString(attr, 0, NULL);
+        } else if (strcmp(ippGetName(attr), "member-names") == 0) {
+            member_names = attr;
+        }
+    }
+
+    ippDelete(response);
+    return count;
+}
+
+void free_class_members(class_member_t *members) {
+    free(members);
+}
+
 int delete_printer(const char *name) {
     char cmd[512];
     snprintf(cmd, sizeof(cmd), "lpadmin -x '%s' 2>/dev/null", name);
     return system(cmd);
 }
 
-int discover_printers(char ***uris, char ***names) {
-    /* Use lpinfo to discover - more portable than raw CUPS discovery */
-    FILE *fp = popen("lpinfo -v 2>/dev/null | grep -E '^network (socket|ipp|ipps)://'", "r");
+/* Host part of a URI, without port */
+static void host_from_uri(char *host, size_t len, const char *uri) {
+    const char *start = strstr(uri, "://");
+    start = start ? start + 3 : uri;
+    size_t n = strcspn(start, ":/");
+    if (n >= len) n = len - 1;
+    memcpy(host, start, n);
+    host[n] = '\0';
+}
+
+int discover_printers(discovered_t **printers) {
+    /* Use lpinfo to discover - more portable than raw CUPS discovery.
+     * Long output adds the model, description and location per device. */
+    *printers = NULL;
+    FILE *fp = popen("lpinfo -l -v 2>/dev/null", "r");
     if (!fp) return 0;
 
     int count = 0;
-    int capacity = 8;
-    *uris = malloc(capacity * sizeof(char *));
-    *names = malloc(capacity * sizeof(char *));
+    int capacity = 0;
+    discovered_t *cur = NULL;
+    int network = 0;
 
     char line[1024];
     while (fgets(line, sizeof(line), fp)) {
-        /* Line format: "network uri" */
-        char *uri = strchr(line, ' ');
-        if (!uri) continue;
-        uri++;
-
-        /* Trim newline */
-        char *nl = strchr(uri, '\n');
+        char *nl = strchr(line, '\n');
         if (nl) *nl = '\0';
 
-        if (count >= capacity) {
-            capacity *= 2;
-            *uris = realloc(*uris, capacity * sizeof(char *));
-            *names = realloc(*names, capacity * sizeof(char *));
+        /* Line format: "Device: uri = ..." then indented "key = value" lines */
+        char *eq = strstr(line, " = ");
+        if (!eq) continue;
+        *eq = '\0';
+        const char *value = eq + 3;
+        const char *key = line + strspn(line, " \t");
+
+        if (strcmp(key, "Device: uri") == 0) {
+            /* Keep the previous device only if it was a usable network one */
+            if (cur && network) count++;
+            network = 0;
+
+            if (count >= capacity) {
+                capacity = capacity ? capacity * 2 : 8;
+                discovered_t *grown = realloc(*printers, capacity * sizeof(discovered_t));
+                if (!grown) break;
+                *printers = grown;
+            }
+            cur = &(*printers)[count];
+            memset(cur, 0, sizeof(*cur));
+
+            if (strncmp(value, "socket://", 9) == 0 || strncmp(value, "ipp://", 6) == 0 ||
+                strncmp(value, "ipps://", 7) == 0) {
+                strncpy(cur->uri, value, sizeof(cur->uri) - 1);
+                host_from_uri(cur->host, sizeof(cur->host), value);
+            }
+        } else if (!cur) {
+            continue;
+        } else if (strcmp(key, "class") == 0) {
+            network = strcmp(value, "network") == 0 && cur->uri[0];
+        } else if (strcmp(key, "info") == 0) {
+            strncpy(cur->info, value, sizeof(cur->info) - 1);
+        } else if (strcmp(key, "make-and-model") == 0) {
+            /* lpinfo reports "Unknown" when the backend couldn't tell */
+            if (strcmp(value, "Unknown") != 0)
+                strncpy(cur->make_model, value, sizeof(cur->make_model) - 1);
+        } else if (strcmp(key, "location") == 0) {
+            strncpy(cur->location, value, sizeof(cur->location) - 1);
         }
-
-        (*uris)[count] = strdup(uri);
-
-        /* Generate a name from URI */
-        char *name = strdup(uri);
-        char *host = strstr(name, "://");
-        if (host) {
-            host += 3;
-            char *slash = strchr(host, '/');
-            if (slash) *slash = '\0';
-            char *port = strchr(host, ':');
-            if (port) *port = '\0';
-        }
-        (*names)[count] = name;
-
-        count++;
     }
+    if (cur && network) count++;
 
     pclose(fp);
     return count;
 }
 
-void free_discovered(char **uris, char **names, int count) {
-    for (int i = 0; i < count; i++) {
-        free(uris[i]);
-        free(names[i]);
-    }
-    free(uris);
-    free(names);
+void free_discovered(discovered_t *printers) {
+    free(printers);
 }
 
-int add_printer(const char *name, const char *uri) {
+int add_printer(const char *name, const char *uri, char *err, size_t errlen) {
     char cmd[1024];
     /* Try IPP Everywhere first, fall back to raw */
     if (strstr(uri, "ipp://") || strstr(uri, "ipps://")) {
         snprintf(cmd, sizeof(cmd),
-            "lpadmin -p '%s' -E -v '%s' -m everywhere 2>/dev/null", name, uri);
+            "lpadmin -p '%s' -E -v '%s' -m everywhere 2>&1", name, uri);
     } else {
         snprintf(cmd, sizeof(cmd),
-            "lpadmin -p '%s' -E -v '%s' 2>/dev/null", name, uri);
+            "lpadmin -p '%s' -E -v '%s' 2>&1", name, uri);
     }
-    return system(cmd);
+
+    if (errlen > 0) err[0] = '\0';
+    FILE *fp = popen(cmd, "r");
+    if (!fp) return -1;
+
+    /* Keep the first line lpadmin prints, minus its "lpadmin: " prefix */
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (errlen == 0 || err[0]) continue;
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        const char *msg = strncmp(line, "lpadmin: ", 9) == 0 ? line + 9 : line;
+        strncpy(err, msg, errlen - 1);
+        err[errlen - 1] = '\0';
+    }
+
+    return pclose(fp) == 0 ? 0 : -1;
 }
@@ -9,10 +9,18 @@ typedef struct {
     char make_model[256];
     char state[64];
     char location[256];
+    char device_uri[1024];
     int is_default;
     int accepting;
+    int is_class;
 } printer_info_t;
 
+/* One member printer of a CUPS class */
+typedef struct {
+    char class_name[256];
+    char printer[256];
+} class_member_t;
+
 /* Job info structure */
 typedef struct {
     int id;
@@ -21,8 +29,40 @@ typedef struct {
     char user[64];
     char state[32];
     int size;
+    int priority;       /* 1-100, higher prints first; CUPS defaults to 50 */
+    char hold_until[64];/* job-hold-until: "no-hold", "indefinite", a period or a time */
+    time_t created;
+    time_t processing;  /* 0 until the job starts printing */
+    time_t completed;   /* 0 while active */
 } job_info_t;
 
+/* Extended job attributes, fetched on demand with Get-Job-Attributes */
+typedef struct {
+    int id;
+    char state[32];
+    char state_reasons[256];
+    char printer_state_message[256];
+    char originating_host[256];
+    int pages_completed;
+    time_t created;
+    time_t processing;
+    time_t completed;
+} job_detail_t;
+
+/* A change to one queued job, for update_jobs() */
+typedef enum {
+    JOB_HOLD,
+    JOB_RELEASE,
+    JOB_SET_PRIORITY
+} job_action_t;
+
+typedef struct {
+    int job_id;
+    job_action_t action;
+    int priority;       /* JOB_SET_PRIORITY: 1-100 */
+    int result;         /* 0 on success, set by update_jobs() */
+} job_update_t;
+
 /* Get list of printers. Returns count, fills array. Caller must free with free_printers() */
 int get_printers(printer_info_t **printers);
 void free_printers(printer_info_t *printers);
@@ -31,20 +71,51 @@ void free_printers(printer_info_t *printers);
 int get_jobs(job_info_t **jobs);
 void free_jobs(job_info_t *jobs);
 
+/* Get finished (completed, cancelled or aborted) jobs with an id of at least
+ * first_id. Returns count, fills array. Caller must free with free_jobs() */
+int get_finished_jobs(int first_id, job_info_t **jobs);
+
+/* Get active and finished jobs alike (CUPS_WHICHJOBS_ALL) with an id of at
+ * least first_id. Returns count, fills array. Caller must free with free_jobs() */
+int get_all_jobs(int first_id, job_info_t **jobs);
+
+/* Get extended attributes for a single job. Returns 0 on success */
+int get_job_detail(int job_id, job_detail_t *detail);
+
 /* Set default printer. Returns 0 on success */
 int set_default_printer(const char *name);
 
 /* Cancel a print job. Returns 0 on success */
 int cancel_job(int job_id);
 
+/* Move a pending job to another printer (CUPS-Move-Job). Returns 0 on success */
+int move_job(int job_id, const char *printer);
+
+/* Send Hold-Job, Release-Job and Set-Job-Attributes requests, in order, over
+ * one connection to the scheduler. Returns the number that failed */
+int update_jobs(job_update_t *updates, int count);
+
+/* Get the members of every CUPS class. Returns count; free with free_class_members() */
+int get_class_members(class_member_t **members);
+void free_class_members(class_member_t *members);
+
 /* Delete a printer. Returns 0 on success */
 int delete_printer(const char *name);
 
-/* Discover network printers. Returns count, fills array of URIs */
-int discover_printers(char ***uris, char ***names);
-void free_discovered(char **uris, char **names, int count);
+/* A network device reported by the CUPS backends */
+typedef struct {
+    char uri[1024];
+    char host[256];
+    char info[256];
+    char make_model[256];
+    char location[256];
+} discovered_t;
+
+/* Discover network printers. Returns count, fills array. Caller must free with free_discovered() */
+int discover_printers(discovered_t **printers);
+void free_discovered(discovered_t *printers);
 
-/* Add a printer. Returns 0 on success */
-int add_printer(const char *name, const char *uri);
+/* Add a printer. Returns 0 on success, otherwise fills err with lpadmin's message */
+int add_printer(const char *name, const char *uri, char *err, size_t errlen);
 
 #endif
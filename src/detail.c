@@ -0,0 +1,120 @@
+#include "detail.h"
+#include "util.h"
+#include <string.h>
+
+/* Find a cached entry that is still valid for the job's current state.
+ * An entry fetched under a different state is dropped. Caller holds lock. */
+static detail_entry_t *find_entry(detail_cache_t *cache, int job_id, const char *job_state) {
+    for (int i = 0; i < DETAIL_CACHE_SIZE; i++) {
+        detail_entry_t *e = &cache->entries[i];
+        if (e->job_id != job_id) continue;
+        if (strcmp(e->job_state, job_state) != 0) {
+            e->job_id = 0;
+            return NULL;
+        }
+        e->last_used = ++cache->tick;
+        return e;
+    }
+    return NULL;
+}
+
+/* Pick an empty slot, or evict the least recently used. Caller holds lock. */
+static detail_entry_t *alloc_entry(detail_cache_t *cache) {
+    detail_entry_t *victim = &cache->entries[0];
+    for (int i = 0; i < DETAIL_CACHE_SIZE; i++) {
+        detail_entry_t *e = &cache->entries[i];
+        if (e->job_id == 0) return e;
+        if (e->last_used < victim->last_used) victim = e;
+    }
+    return victim;
+}
+
+static void *detail_thread_func(void *arg) {
+    detail_cache_t *cache = (detail_cache_t *)arg;
+
+    pthread_mutex_lock(&cache->lock);
+    while (cache->running) {
+        if (cache->wanted == 0) {
+            pthread_cond_wait(&cache->cond, &cache->lock);
+            continue;
+        }
+
+        int job_id = cache->wanted;
+        char job_state[32];
+        memcpy(job_state, cache->wanted_state, sizeof(job_state));
+        cache->wanted = 0;
+        cache->in_flight = job_id;
+        pthread_mutex_unlock(&cache->lock);
+
+        job_detail_t detail;
+        int ok = get_job_detail(job_id, &detail) == 0;
+
+        pthread_mutex_lock(&cache->lock);
+        cache->in_flight = 0;
+        detail_entry_t *e = alloc_entry(cache);
+        e->job_id = job_id;
+        memcpy(e->job_state, job_state, sizeof(e->job_state));
+        e->ok = ok;
+        e->detail = detail;
+        e->last_used = ++cache->tick;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return NULL;
+}
+
+void detail_init(detail_cache_t *cache) {
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->cond, NULL);
+    cache->running = 1;
+    pthread_create(&cache->thread, NULL, detail_thread_func, cache);
+}
+
+void detail_shutdown(detail_cache_t *cache) {
+    pthread_mutex_lock(&cache->lock);
+    cache->running = 0;
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+
+    pthread_join(cache->thread, NULL);
+    pthread_cond_destroy(&cache->cond);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+void detail_select(detail_cache_t *cache, const job_info_t *job) {
+    int job_id = job ? job->id : 0;
+    uint64_t now = monotonic_ms();
+
+    if (job_id != cache->settle_id) {
+        cache->settle_id = job_id;
+        cache->settle_since = now;
+        return;
+    }
+    if (job_id == 0 || now - cache->settle_since < DETAIL_DEBOUNCE_MS) return;
+
+    pthread_mutex_lock(&cache->lock);
+    if (!find_entry(cache, job_id, job->state) &&
+        cache->in_flight != job_id && cache->wanted != job_id) {
+        /* Replaces any request the worker hasn't picked up yet */
+        cache->wanted = job_id;
+        strncpy(cache->wanted_state, job->state, sizeof(cache->wanted_state) - 1);
+        cache->wanted_state[sizeof(cache->wanted_state) - 1] = '\0';
+        pthread_cond_signal(&cache->cond);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int detail_lookup(detail_cache_t *cache, const job_info_t *job, job_detail_t *detail) {
+    int found = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    detail_entry_t *e = find_entry(cache, job->id, job->state);
+    if (e) {
+        found = e->ok ? 1 : -1;
+        if (e->ok) *detail = e->detail;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return found;
+}
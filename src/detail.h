@@ -0,0 +1,53 @@
+#ifndef DETAIL_H
+#define DETAIL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "cups_api.h"
+
+#define DETAIL_CACHE_SIZE 32
+#define DETAIL_DEBOUNCE_MS 250
+
+typedef struct {
+    int job_id;             /* 0 marks an empty slot */
+    char job_state[32];     /* State from the job list when fetched */
+    int ok;                 /* Fetch succeeded */
+    uint64_t last_used;
+    job_detail_t detail;
+} detail_entry_t;
+
+/*
+ * Lazily fetched job details. The selection has to stay on a job for
+ * DETAIL_DEBOUNCE_MS before a single background request is made, so
+ * scrolling through the list never queues a request per keystroke.
+ */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+
+    int wanted;             /* Job id for the worker to fetch next, 0 for none */
+    char wanted_state[32];
+    int in_flight;          /* Job id currently being fetched */
+
+    int settle_id;          /* Selected job and when it was selected */
+    uint64_t settle_since;
+
+    uint64_t tick;
+    detail_entry_t entries[DETAIL_CACHE_SIZE];
+} detail_cache_t;
+
+void detail_init(detail_cache_t *cache);
+void detail_shutdown(detail_cache_t *cache);
+
+/* Report the selected job (NULL for none); issues a fetch once it settles */
+void detail_select(detail_cache_t *cache, const job_info_t *job);
+
+/*
+ * Look up details for a job. Returns 1 and fills detail if cached,
+ * -1 if the fetch failed, 0 if not (yet) available.
+ */
+int detail_lookup(detail_cache_t *cache, const job_info_t *job, job_detail_t *detail);
+
+#endif
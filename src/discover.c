@@ -0,0 +1,280 @@
+#include "discover.h"
+#include "scan.h"
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Args passed to discovery thread */
+typedef struct {
+    discover_list_t *list;
+    int generation;
+} discover_args_t;
+
+/* Thread function for async printer discovery */
+static void *discover_thread_func(void *arg) {
+    discover_args_t *args = (discover_args_t *)arg;
+    discover_list_t *list = args->list;
+    int generation = args->generation;
+    free(args);
+
+    discovered_t *devices = NULL;
+    int count = discover_printers(&devices);
+
+    discover_list_append(list, generation, devices, count);
+
+    free_discovered(devices);
+    return NULL;
+}
+
+typedef struct {
+    discover_list_t *list;
+    int generation;
+    uint32_t first;
+    uint32_t count;
+} scan_args_t;
+
+static void scan_found(void *ctx, const discovered_t *device) {
+    scan_args_t *args = ctx;
+    discover_list_append(args->list, args->generation, device, 1);
+}
+
+/* Publish progress; a newer discovery stops the scan */
+static int scan_progress(void *ctx, int done, int total) {
+    scan_args_t *args = ctx;
+    discover_list_t *list = args->list;
+
+    pthread_mutex_lock(&list->lock);
+    int stale = list->generation != args->generation;
+    if (!stale) {
+        list->scan_done = done;
+        list->scan_total = total;
+    }
+    pthread_mutex_unlock(&list->lock);
+    return stale;
+}
+
+static void *scan_thread_func(void *arg) {
+    scan_args_t *args = (scan_args_t *)arg;
+    discover_list_t *list = args->list;
+
+    scan_sink_t sink = { scan_found, scan_progress, args };
+    scan_range(args->first, args->count, &sink);
+
+    pthread_mutex_lock(&list->lock);
+    if (list->generation == args->generation) {
+        if (list->count < 0) list->count = 0;
+    }
+    list->scanning = 0;
+    pthread_mutex_unlock(&list->lock);
+
+    free(args);
+    return NULL;
+}
+
+void discover_list_init(discover_list_t *list) {
+    pthread_mutex_init(&list->lock, NULL);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->selected = 0;
+    list->generation = 0;
+    strcpy(list->name_template, DISCOVER_DEFAULT_TEMPLATE);
+    list->scanning = 0;
+    list->scan_done = 0;
+    list->scan_total = 0;
+    list->scan_range[0] = '\0';
+}
+
+void discover_list_free(discover_list_t *list) {
+    pthread_mutex_lock(&list->lock);
+    /* Invalidate any running discovery threads */
+    list->generation = -1;
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    pthread_mutex_unlock(&list->lock);
+}
+
+void discover_list_start(discover_list_t *list) {
+    pthread_mutex_lock(&list->lock);
+    list->generation++;
+    list->count = -1;  /* Show loading state */
+    list->selected = 0;
+    int generation = list->generation;
+    pthread_mutex_unlock(&list->lock);
+
+    /* Start discovery in detached thread */
+    discover_args_t *args = malloc(sizeof(discover_args_t));
+    if (!args) return;
+    args->list = list;
+    args->generation = generation;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, discover_thread_func, args);
+    pthread_detach(thread);
+}
+
+int discover_list_scan(discover_list_t *list, const char *cidr) {
+    uint32_t first, count;
+    if (scan_parse_cidr(cidr, &first, &count) != 0) return -1;
+
+    scan_args_t *args = malloc(sizeof(scan_args_t));
+    if (!args) return -1;
+
+    pthread_mutex_lock(&list->lock);
+    if (list->scanning) {
+        pthread_mutex_unlock(&list->lock);
+        free(args);
+        return -1;
+    }
+    list->scanning = 1;
+    list->scan_done = 0;
+    list->scan_total = 0;
+    snprintf(list->scan_range, sizeof(list->scan_range), "%s", cidr);
+    args->list = list;
+    args->generation = list->generation;
+    args->first = first;
+    args->count = count;
+    pthread_mutex_unlock(&list->lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, scan_thread_func, args) != 0) {
+        pthread_mutex_lock(&list->lock);
+        list->scanning = 0;
+        pthread_mutex_unlock(&list->lock);
+        free(args);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void discover_list_cancel(discover_list_t *list) {
+    pthread_mutex_lock(&list->lock);
+    list->generation++;
+    pthread_mutex_unlock(&list->lock);
+}
+
+void discover_list_move(discover_list_t *list, int delta) {
+    pthread_mutex_lock(&list->lock);
+    list->selected += delta;
+    if (list->selected >= list->count) list->selected = list->count - 1;
+    if (list->selected < 0) list->selected = 0;
+    pthread_mutex_unlock(&list->lock);
+}
+
+void discover_list_toggle(discover_list_t *list) {
+    pthread_mutex_lock(&list->lock);
+    if (list->selected < list->count) {
+        discover_item_t *item = &list->items[list->selected];
+        item->marked = !item->marked;
+    }
+    pthread_mutex_unlock(&list->lock);
+}
+
+int discover_list_marked(discover_list_t *list) {
+    int marked = 0;
+    pthread_mutex_lock(&list->lock);
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i].marked) marked++;
+    }
+    pthread_mutex_unlock(&list->lock);
+    return marked;
+}
+
+void discover_list_append(discover_list_t *list, int generation,
+                          const discovered_t *devices, int count) {
+    pthread_mutex_lock(&list->lock);
+
+    /* Only update the list if this discovery is still current */
+    if (list->generation != generation) {
+        pthread_mutex_unlock(&list->lock);
+        return;
+    }
+    if (list->count < 0) list->count = 0;
+
+    for (int i = 0; i < count; i++) {
+        /* Several sources can report the same device */
+        if (discover_list_find(list, devices[i].uri)) continue;
+
+        if (list->count >= list->capacity) {
+            int capacity = list->capacity ? list->capacity * 2 : 16;
+            discover_item_t *grown = realloc(list->items, capacity * sizeof(discover_item_t));
+            if (!grown) break;
+            list->items = grown;
+            list->capacity = capacity;
+        }
+        discover_item_t *item = &list->items[list->count++];
+        memset(item, 0, sizeof(*item));
+        item->device = devices[i];
+    }
+
+    pthread_mutex_unlock(&list->lock);
+}
+
+discover_item_t *discover_list_find(discover_list_t *list, const char *uri) {
+    for (int i = 0; i < list->count; i++) {
+        if (strcmp(list->items[i].device.uri, uri) == 0) return &list->items[i];
+    }
+    return NULL;
+}
+
+void discover_expand_name(const char *tmpl, const discovered_t *device,
+                          char *name, size_t len) {
+    static const struct {
+        const char *key;
+        size_t offset;
+    } fields[] = {
+        { "{host}", offsetof(discovered_t, host) },
+        { "{location}", offsetof(discovered_t, location) },
+        { "{model}", offsetof(discovered_t, make_model) },
+        { "{info}", offsetof(discovered_t, info) },
+    };
+
+    char expanded[512];
+    size_t n = 0;
+    const char *p = tmpl;
+    while (*p && n < sizeof(expanded) - 1) {
+        const char *value = NULL;
+        size_t key_len = 0;
+        for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+            key_len = strlen(fields[f].key);
+            if (strncmp(p, fields[f].key, key_len) == 0) {
+                value = (const char *)device + fields[f].offset;
+                break;
+            }
+        }
+        if (value) {
+            while (*value && n < sizeof(expanded) - 1) expanded[n++] = *value++;
+            p += key_len;
+        } else {
+            expanded[n++] = *p++;
+        }
+    }
+    expanded[n] = '\0';
+
+    /* CUPS names are at most 127 printable characters, without space,
+     * '/', '\\', '#' or quotes. Collapse runs of anything else into '-'. */
+    size_t out = 0;
+    int dash = 0;
+    for (const char *c = expanded; *c && out < len - 1 && out < 127; c++) {
+        if (isalnum((unsigned char)*c) || *c == '_' || *c == '.' || *c == '-') {
+            if (*c == '-' && (dash || out == 0)) continue;
+            name[out++] = *c;
+            dash = *c == '-';
+        } else if (!dash && out > 0) {
+            name[out++] = '-';
+            dash = 1;
+        }
+    }
+    while (out > 0 && name[out - 1] == '-') out--;
+    name[out] = '\0';
+
+    if (out == 0) {
+        strncpy(name, device->host, len - 1);
+        name[len - 1] = '\0';
+    }
+}
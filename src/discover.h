@@ -0,0 +1,76 @@
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#include <pthread.h>
+#include "cups_api.h"
+
+#define DISCOVER_DEFAULT_TEMPLATE "{host}"
+
+typedef enum {
+    ADD_NONE,
+    ADD_PENDING,
+    ADD_DONE,
+    ADD_FAILED
+} add_status_t;
+
+typedef struct {
+    discovered_t device;
+    int marked;                 /* Selected for a batch add */
+    add_status_t status;
+    char error[256];
+} discover_item_t;
+
+/*
+ * Devices found by discovery. Background threads add results under lock,
+ * so the UI takes it too while reading items.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    discover_item_t *items;
+    int count;                  /* -1 while the first results are loading */
+    int capacity;
+    int selected;
+    int generation;             /* Incremented each discovery, used to ignore stale results */
+    char name_template[256];    /* e.g. "{location}-{host}" */
+
+    /* Subnet scan progress, counted in probes */
+    int scanning;
+    int scan_done;
+    int scan_total;
+    char scan_range[64];
+} discover_list_t;
+
+void discover_list_init(discover_list_t *list);
+void discover_list_free(discover_list_t *list);
+
+/* Clear the list and start lpinfo discovery in the background */
+void discover_list_start(discover_list_t *list);
+
+/* Scan an IPv4 range in the background, adding printers to the current
+ * discovery as they answer. Returns -1 for a bad range or a scan already
+ * in progress */
+int discover_list_scan(discover_list_t *list, const char *cidr);
+
+/* Drop results of any running discovery */
+void discover_list_cancel(discover_list_t *list);
+
+void discover_list_move(discover_list_t *list, int delta);
+void discover_list_toggle(discover_list_t *list);
+int discover_list_marked(discover_list_t *list);
+
+/* Append devices found by discovery run generation. Caller holds no lock */
+void discover_list_append(discover_list_t *list, int generation,
+                          const discovered_t *devices, int count);
+
+/* Find an item by device URI. Caller holds lock */
+discover_item_t *discover_list_find(discover_list_t *list, const char *uri);
+
+/*
+ * Expand a queue name template. {host}, {location}, {model} and {info}
+ * are replaced by device fields, then anything CUPS won't accept in a
+ * printer name becomes '-'. Falls back to the host if nothing is left.
+ */
+void discover_expand_name(const char *tmpl, const discovered_t *device,
+                          char *name, size_t len);
+
+#endif
@@ -0,0 +1,198 @@
+#include "executor.h"
+#include "cups_api.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void run_op(op_t *op) {
+    switch (op->kind) {
+        case OP_SET_DEFAULT:
+            op->result = set_default_printer(op->name);
+            break;
+        case OP_CANCEL_JOB:
+            op->result = cancel_job(op->job_id);
+            break;
+        case OP_DELETE_PRINTER:
+            op->result = delete_printer(op->name);
+            break;
+        case OP_ADD_PRINTER:
+            op->result = add_printer(op->name, op->uri, op->error, sizeof(op->error));
+            break;
+        case OP_MOVE_JOB:
+            op->result = move_job(op->job_id, op->name);
+            break;
+        case OP_UPDATE_JOBS:
+            /* Number of updates that failed */
+            op->result = update_jobs(op->updates, op->update_count);
+            break;
+    }
+}
+
+static int touches_job(const op_t *op, int job_id) {
+    if (op->kind == OP_UPDATE_JOBS) {
+        for (int i = 0; i < op->update_count; i++) {
+            if (op->updates[i].job_id == job_id) return 1;
+        }
+        return 0;
+    }
+    return (op->kind == OP_CANCEL_JOB || op->kind == OP_MOVE_JOB) && op->job_id == job_id;
+}
+
+/* Whether two ops act on the same thing, so their order matters */
+static int same_target(const op_t *a, const op_t *b) {
+    if (a->kind == OP_SET_DEFAULT && b->kind == OP_SET_DEFAULT) return 1;
+
+    int a_printer = a->kind == OP_SET_DEFAULT || a->kind == OP_DELETE_PRINTER || a->kind == OP_ADD_PRINTER;
+    int b_printer = b->kind == OP_SET_DEFAULT || b->kind == OP_DELETE_PRINTER || b->kind == OP_ADD_PRINTER;
+    if (a_printer || b_printer) {
+        return a_printer && b_printer && strcmp(a->name, b->name) == 0;
+    }
+
+    if (a->kind == OP_UPDATE_JOBS) {
+        for (int i = 0; i < a->update_count; i++) {
+            if (touches_job(b, a->updates[i].job_id)) return 1;
+        }
+        return 0;
+    }
+    return touches_job(b, a->job_id);
+}
+
+/* Batch onboarding can queue dozens of adds; they never take the last
+ * worker, and anything interactive queued behind them goes first */
+static int is_bulk(const op_t *op) {
+    return op->kind == OP_ADD_PRINTER;
+}
+
+/* Unlink and return the first queued op that nothing running or queued
+ * ahead of it shares a target with, interactive ops before bulk ones, or
+ * NULL */
+static op_t *take_runnable(executor_t *ex) {
+    int bulk_running = 0;
+    for (int i = 0; i < EXECUTOR_THREADS; i++) {
+        if (ex->active[i] && is_bulk(ex->active[i])) bulk_running++;
+    }
+
+    for (int bulk = 0; bulk <= 1; bulk++) {
+        if (bulk && bulk_running >= EXECUTOR_BULK_THREADS) break;
+
+        op_t *prev = NULL;
+        for (op_t *op = ex->queue_head; op; prev = op, op = op->next) {
+            if (is_bulk(op) != bulk) continue;
+
+            int blocked = 0;
+            for (int i = 0; i < EXECUTOR_THREADS && !blocked; i++) {
+                if (ex->active[i] && same_target(ex->active[i], op)) blocked = 1;
+            }
+            for (op_t *ahead = ex->queue_head; ahead != op && !blocked; ahead = ahead->next) {
+                if (same_target(ahead, op)) blocked = 1;
+            }
+            if (blocked) continue;
+
+            if (prev) prev->next = op->next;
+            else ex->queue_head = op->next;
+            if (ex->queue_tail == op) ex->queue_tail = prev;
+            op->next = NULL;
+            return op;
+        }
+    }
+    return NULL;
+}
+
+static void *executor_thread_func(void *arg) {
+    executor_t *ex = (executor_t *)arg;
+
+    pthread_mutex_lock(&ex->lock);
+    for (;;) {
+        op_t *op = take_runnable(ex);
+        if (!op) {
+            /* Keep draining the queue after shutdown starts */
+            if (!ex->queue_head && !ex->running) break;
+            pthread_cond_wait(&ex->cond, &ex->lock);
+            continue;
+        }
+        /* At most one op per worker, so there's always a free slot */
+        int slot = 0;
+        while (ex->active[slot]) slot++;
+        ex->active[slot] = op;
+        pthread_mutex_unlock(&ex->lock);
+
+        run_op(op);
+
+        pthread_mutex_lock(&ex->lock);
+        ex->active[slot] = NULL;
+        if (ex->done_tail) ex->done_tail->next = op;
+        else ex->done_head = op;
+        ex->done_tail = op;
+        /* Ops waiting on this one's target may run now, and on shutdown
+         * idle workers must see the queue emptied */
+        pthread_cond_broadcast(&ex->cond);
+    }
+    pthread_mutex_unlock(&ex->lock);
+
+    return NULL;
+}
+
+void executor_init(executor_t *ex) {
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->cond, NULL);
+    ex->running = 1;
+    ex->next_id = 1;
+    ex->queue_head = ex->queue_tail = NULL;
+    ex->done_head = ex->done_tail = NULL;
+
+    for (int i = 0; i < EXECUTOR_THREADS; i++) {
+        ex->active[i] = NULL;
+    }
+    for (int i = 0; i < EXECUTOR_THREADS; i++) {
+        pthread_create(&ex->threads[i], NULL, executor_thread_func, ex);
+    }
+}
+
+void executor_shutdown(executor_t *ex) {
+    pthread_mutex_lock(&ex->lock);
+    ex->running = 0;
+    pthread_cond_broadcast(&ex->cond);
+    pthread_mutex_unlock(&ex->lock);
+
+    for (int i = 0; i < EXECUTOR_THREADS; i++) {
+        pthread_join(ex->threads[i], NULL);
+    }
+
+    while (ex->done_head) {
+        op_t *op = ex->done_head;
+        ex->done_head = op->next;
+        free(op->updates);
+        free(op);
+    }
+    ex->done_tail = NULL;
+
+    pthread_cond_destroy(&ex->cond);
+    pthread_mutex_destroy(&ex->lock);
+}
+
+int executor_submit(executor_t *ex, op_t *op) {
+    pthread_mutex_lock(&ex->lock);
+    int id = ex->next_id++;
+    op->id = id;
+    op->result = -1;
+    op->next = NULL;
+    if (ex->queue_tail) ex->queue_tail->next = op;
+    else ex->queue_head = op;
+    ex->queue_tail = op;
+    pthread_cond_signal(&ex->cond);
+    pthread_mutex_unlock(&ex->lock);
+
+    return id;
+}
+
+op_t *executor_poll(executor_t *ex) {
+    pthread_mutex_lock(&ex->lock);
+    op_t *op = ex->done_head;
+    if (op) {
+        ex->done_head = op->next;
+        if (!ex->done_head) ex->done_tail = NULL;
+        op->next = NULL;
+    }
+    pthread_mutex_unlock(&ex->lock);
+
+    return op;
+}
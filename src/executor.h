@@ -0,0 +1,68 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <pthread.h>
+#include "cups_api.h"
+
+#define EXECUTOR_THREADS 4
+#define EXECUTOR_BULK_THREADS (EXECUTOR_THREADS - 1)   /* Most workers printer adds may hold */
+
+typedef enum {
+    OP_SET_DEFAULT,
+    OP_CANCEL_JOB,
+    OP_DELETE_PRINTER,
+    OP_ADD_PRINTER,
+    OP_MOVE_JOB,
+    OP_UPDATE_JOBS
+} op_kind_t;
+
+/* A mutating CUPS operation, run on a worker thread */
+typedef struct op {
+    int id;                 /* Assigned on submit */
+    op_kind_t kind;
+    char name[256];         /* Printer name (destination for OP_MOVE_JOB) */
+    char uri[1024];         /* Device URI for OP_ADD_PRINTER */
+    int job_id;
+    job_update_t *updates;  /* OP_UPDATE_JOBS, sent as one batch; freed with the op */
+    int update_count;
+    int result;             /* 0 on success, set by the worker */
+    char error[256];        /* Failure detail, when the operation gives one */
+    struct op *next;
+} op_t;
+
+/*
+ * Small worker pool. Submitted ops are run in order by the first free
+ * worker, except that ops on the same target (the default printer, a
+ * printer name, a job id) never overlap: a later one waits until the
+ * earlier has finished, so the last one submitted is the one that lands.
+ * Printer adds, which come in batches, are run after anything else that
+ * is waiting and on at most EXECUTOR_BULK_THREADS workers.
+ * Finished ops are collected from the main loop with executor_poll().
+ */
+typedef struct {
+    pthread_t threads[EXECUTOR_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int next_id;
+
+    op_t *queue_head;       /* Waiting for a worker */
+    op_t *queue_tail;
+    op_t *active[EXECUTOR_THREADS];  /* Being run, by worker */
+    op_t *done_head;        /* Finished, waiting for executor_poll() */
+    op_t *done_tail;
+} executor_t;
+
+void executor_init(executor_t *ex);
+
+/* Finishes all submitted ops, then stops the workers */
+void executor_shutdown(executor_t *ex);
+
+/* Queue an op allocated with malloc; the executor takes ownership until it
+ * is returned by executor_poll(). Returns the op id */
+int executor_submit(executor_t *ex, op_t *op);
+
+/* Next finished op, or NULL. Caller frees it */
+op_t *executor_poll(executor_t *ex);
+
+#endif
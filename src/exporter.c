@@ -0,0 +1,565 @@
+#include "exporter.h"
+#include "cups_api.h"
+#include "util.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EXPORTER_MAX_CLIENTS 64
+#define EXPORTER_REQUEST_MAX 2048
+#define EXPORTER_CLIENT_TIMEOUT_MS 5000    /* Whole request and response */
+
+/* Active job states broken out per printer, in output order */
+static const char *job_states[] = { "pending", "held", "printing", "stopped" };
+#define JOB_STATES (int)(sizeof(job_states) / sizeof(job_states[0]))
+
+/* What the metrics are rendered from; compared to skip needless re-renders */
+typedef struct {
+    char name[256];
+    char state[64];
+    int accepting;
+    int jobs[JOB_STATES];
+} printer_snap_t;
+
+/* A rendered response body, shared by every scrape in flight */
+typedef struct {
+    int refs;
+    size_t len;
+    char data[];
+} page_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int interval_ms;
+    page_t *page;               /* Current metrics, NULL until the first refresh */
+} exporter_t;
+
+typedef struct {
+    int fd;
+    uint64_t deadline;          /* Dropped if not done by then */
+    char request[EXPORTER_REQUEST_MAX];
+    size_t request_len;
+    char head[256];
+    size_t head_len;
+    page_t *page;               /* Held while the response is written */
+    const char *body;
+    size_t body_len;
+    size_t off;                 /* Bytes of head + body written */
+} client_t;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} textbuf_t;
+
+static volatile sig_atomic_t exporter_stop;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    exporter_stop = 1;
+}
+
+static void text_printf(textbuf_t *t, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void text_printf(textbuf_t *t, const char *fmt, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(t->data ? t->data + t->len : NULL, t->cap - t->len, fmt, args);
+        va_end(args);
+        if (n < 0) return;
+        if (t->len + n < t->cap) {
+            t->len += n;
+            return;
+        }
+
+        size_t cap = t->cap ? t->cap : 4096;
+        while (cap <= t->len + n) cap *= 2;
+        char *data = realloc(t->data, cap);
+        if (!data) return;
+        t->data = data;
+        t->cap = cap;
+    }
+}
+
+/* Label values need backslash, quote and newline escaped */
+static const char *label(const char *s, char *buf, size_t len) {
+    size_t o = 0;
+    for (; *s && o + 2 < len; s++) {
+        if (*s == '\\' || *s == '"') buf[o++] = '\\';
+        if (*s == '\n') {
+            buf[o++] = '\\';
+            buf[o++] = 'n';
+            continue;
+        }
+        buf[o++] = *s;
+    }
+    buf[o] = '\0';
+    return buf;
+}
+
+static int cmp_snap(const void *a, const void *b) {
+    return strcmp(((const printer_snap_t *)a)->name, ((const printer_snap_t *)b)->name);
+}
+
+static int take_snapshot(printer_snap_t **out) {
+    printer_info_t *printers;
+    job_info_t *jobs;
+    int count = get_printers(&printers);
+    if (count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) {
+        *out = NULL;
+        return -1;
+    }
+    int job_count = get_jobs(&jobs);
+
+    printer_snap_t *snap = calloc(count ? count : 1, sizeof(printer_snap_t));
+    if (!snap) {
+        free_printers(printers);
+        free_jobs(jobs);
+        *out = NULL;
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        snprintf(snap[i].name, sizeof(snap[i].name), "%s", printers[i].name);
+        snprintf(snap[i].state, sizeof(snap[i].state), "%s", printers[i].state);
+        snap[i].accepting = printers[i].accepting;
+    }
+    qsort(snap, count, sizeof(printer_snap_t), cmp_snap);
+
+    for (int j = 0; j < job_count; j++) {
+        printer_snap_t key;
+        snprintf(key.name, sizeof(key.name), "%s", jobs[j].printer);
+        printer_snap_t *p = bsearch(&key, snap, count, sizeof(printer_snap_t), cmp_snap);
+        if (!p) continue;
+        for (int s = 0; s < JOB_STATES; s++) {
+            if (strcmp(jobs[j].state, job_states[s]) == 0) p->jobs[s]++;
+        }
+    }
+
+    free_printers(printers);
+    free_jobs(jobs);
+    *out = snap;
+    return count;
+}
+
+/* Per-printer metrics; only re-rendered when the snapshot differs */
+static void render_printers(textbuf_t *t, const printer_snap_t *snap, int count) {
+    static const char *printer_states[] = { "idle", "printing", "stopped" };
+    char name[512];
+
+    t->len = 0;
+    text_printf(t, "# HELP spoolie_printer_state Printer state, 1 for the current one.\n"
+                   "# TYPE spoolie_printer_state gauge\n");
+    for (int i = 0; i < count; i++) {
+        label(snap[i].name, name, sizeof(name));
+        for (int s = 0; s < 3; s++) {
+            text_printf(t, "spoolie_printer_state{printer=\"%s\",state=\"%s\"} %d\n",
+                        name, printer_states[s], strcmp(snap[i].state, printer_states[s]) == 0);
+        }
+    }
+
+    text_printf(t, "# HELP spoolie_printer_accepting Whether the queue accepts new jobs.\n"
+                   "# TYPE spoolie_printer_accepting gauge\n");
+    for (int i = 0; i < count; i++) {
+        text_printf(t, "spoolie_printer_accepting{printer=\"%s\"} %d\n",
+                    label(snap[i].name, name, sizeof(name)), snap[i].accepting);
+    }
+
+    text_printf(t, "# HELP spoolie_printer_queue_depth Jobs pending or printing.\n"
+                   "# TYPE spoolie_printer_queue_depth gauge\n");
+    for (int i = 0; i < count; i++) {
+        text_printf(t, "spoolie_printer_queue_depth{printer=\"%s\"} %d\n",
+                    label(snap[i].name, name, sizeof(name)), snap[i].jobs[0] + snap[i].jobs[2]);
+    }
+
+    text_printf(t, "# HELP spoolie_printer_jobs Active jobs by state.\n"
+                   "# TYPE spoolie_printer_jobs gauge\n");
+    for (int i = 0; i < count; i++) {
+        label(snap[i].name, name, sizeof(name));
+        for (int s = 0; s < JOB_STATES; s++) {
+            text_printf(t, "spoolie_printer_jobs{printer=\"%s\",state=\"%s\"} %d\n",
+                        name, job_states[s], snap[i].jobs[s]);
+        }
+    }
+}
+
+static void page_put(exporter_t *ex, page_t *page) {
+    if (!page) return;
+    pthread_mutex_lock(&ex->lock);
+    int refs = --page->refs;
+    pthread_mutex_unlock(&ex->lock);
+    if (refs == 0) free(page);
+}
+
+static page_t *page_get(exporter_t *ex) {
+    pthread_mutex_lock(&ex->lock);
+    page_t *page = ex->page;
+    if (page) page->refs++;
+    pthread_mutex_unlock(&ex->lock);
+    return page;
+}
+
+/* Publish printer metrics plus the refresh trailer as the new page */
+static void publish(exporter_t *ex, const textbuf_t *body, int up, double latency,
+                    unsigned long refreshes, time_t last_ok) {
+    textbuf_t tail = {0};
+    text_printf(&tail, "# HELP spoolie_up Whether the last refresh reached cupsd.\n"
+                       "# TYPE spoolie_up gauge\n"
+                       "spoolie_up %d\n"
+                       "# HELP spoolie_refresh_duration_seconds Time taken by the last refresh.\n"
+                       "# TYPE spoolie_refresh_duration_seconds gauge\n"
+                       "spoolie_refresh_duration_seconds %.3f\n"
+                       "# HELP spoolie_refreshes_total Refreshes attempted.\n"
+                       "# TYPE spoolie_refreshes_total counter\n"
+                       "spoolie_refreshes_total %lu\n"
+                       "# HELP spoolie_last_refresh_timestamp_seconds Time of the last good refresh.\n"
+                       "# TYPE spoolie_last_refresh_timestamp_seconds gauge\n"
+                       "spoolie_last_refresh_timestamp_seconds %lld\n",
+                up, latency, refreshes, (long long)last_ok);
+
+    page_t *page = malloc(sizeof(page_t) + body->len + tail.len);
+    if (page) {
+        page->refs = 1;
+        page->len = body->len + tail.len;
+        if (body->len) memcpy(page->data, body->data, body->len);
+        memcpy(page->data + body->len, tail.data, tail.len);
+
+        pthread_mutex_lock(&ex->lock);
+        page_t *old = ex->page;
+        ex->page = page;
+        pthread_mutex_unlock(&ex->lock);
+        page_put(ex, old);
+    }
+    free(tail.data);
+}
+
+/*
+ * All CUPS traffic happens on this thread, so libcups keeps reusing its
+ * one per-thread connection to cupsd however many scrapers there are.
+ */
+static void *refresh_thread_func(void *arg) {
+    exporter_t *ex = arg;
+    printer_snap_t *prev = NULL;
+    int prev_count = -1;
+    textbuf_t body = {0};
+    unsigned long refreshes = 0;
+    time_t last_ok = 0;
+
+    pthread_mutex_lock(&ex->lock);
+    while (ex->running) {
+        pthread_mutex_unlock(&ex->lock);
+
+        uint64_t start = monotonic_ms();
+        printer_snap_t *snap;
+        int count = take_snapshot(&snap);
+        double latency = (monotonic_ms() - start) / 1000.0;
+        refreshes++;
+
+        if (count >= 0) {
+            last_ok = time(NULL);
+            if (count != prev_count ||
+                (count > 0 && memcmp(snap, prev, count * sizeof(printer_snap_t)) != 0)) {
+                render_printers(&body, snap, count);
+            }
+            free(prev);
+            prev = snap;
+            prev_count = count;
+        }
+        /* On failure keep serving the last good snapshot with spoolie_up 0 */
+        publish(ex, &body, count >= 0, latency, refreshes, last_ok);
+
+        pthread_mutex_lock(&ex->lock);
+        if (!ex->running) break;
+        struct timespec until = abs_deadline(ex->interval_ms);
+        pthread_cond_timedwait(&ex->cond, &ex->lock, &until);
+    }
+    pthread_mutex_unlock(&ex->lock);
+
+    free(prev);
+    free(body.data);
+    return NULL;
+}
+
+/* All digits means a localhost TCP port, anything else a socket path */
+static int is_port(const char *listen_on) {
+    if (*listen_on == '\0') return 0;
+    for (const char *c = listen_on; *c; c++) {
+        if (!isdigit((unsigned char)*c)) return 0;
+    }
+    return 1;
+}
+
+/* Remove a socket left by an earlier run. Fails on anything that isn't a
+ * socket, or on one something still listens on */
+static int remove_stale_socket(const struct sockaddr_un *addr) {
+    struct stat st;
+    if (lstat(addr->sun_path, &st) != 0) return errno == ENOENT ? 0 : -1;
+    if (!S_ISSOCK(st.st_mode)) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int live = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(fd);
+    if (live) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    return unlink(addr->sun_path);
+}
+
+/* Listen on listen_on; for a socket path, bound is set to the socket
+ * created so only that one is removed on exit */
+static int listen_socket(const char *listen_on, struct stat *bound) {
+    int fd;
+    if (is_port(listen_on)) {
+        long port = strlen(listen_on) <= 5 ? atol(listen_on) : 0;
+        if (port < 1 || port > 65535) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(listen_on) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, listen_on);
+
+        if (remove_stale_socket(&addr) != 0) return -1;
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            lstat(listen_on, bound) != 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+    }
+
+    if (listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void client_close(exporter_t *ex, client_t *c) {
+    page_put(ex, c->page);
+    close(c->fd);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+/* Once the request head is in, pick the response */
+static void client_respond(exporter_t *ex, client_t *c) {
+    const char *status = "200 OK";
+    c->page = NULL;
+    c->body = "";
+    c->body_len = 0;
+
+    if (strncmp(c->request, "GET /metrics ", 13) == 0 || strncmp(c->request, "GET / ", 6) == 0) {
+        c->page = page_get(ex);
+        if (c->page) {
+            c->body = c->page->data;
+            c->body_len = c->page->len;
+        } else {
+            status = "503 Service Unavailable";
+        }
+    } else if (strncmp(c->request, "GET ", 4) == 0) {
+        status = "404 Not Found";
+    } else {
+        status = "405 Method Not Allowed";
+    }
+
+    c->head_len = snprintf(c->head, sizeof(c->head),
+                           "HTTP/1.0 %s\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: %zu\r\n"
+                           "Connection: close\r\n\r\n",
+                           status, c->body_len);
+}
+
+/* Returns -1 when the client is finished with */
+static int client_io(exporter_t *ex, client_t *c, short revents) {
+    if (revents & (POLLERR | POLLNVAL)) return -1;
+
+    if (c->head_len == 0) {
+        ssize_t n = read(c->fd, c->request + c->request_len,
+                         sizeof(c->request) - 1 - c->request_len);
+        if (n < 0) return errno == EINTR || errno == EAGAIN ? 0 : -1;
+        if (n == 0) return -1;
+        c->request_len += n;
+        c->request[c->request_len] = '\0';
+
+        if (!strstr(c->request, "\r\n\r\n") && !strstr(c->request, "\n\n")) {
+            /* Oversized request heads are not worth waiting for */
+            return c->request_len < sizeof(c->request) - 1 ? 0 : -1;
+        }
+        client_respond(ex, c);
+    }
+
+    while (c->off < c->head_len + c->body_len) {
+        const char *src;
+        size_t len;
+        if (c->off < c->head_len) {
+            src = c->head + c->off;
+            len = c->head_len - c->off;
+        } else {
+            src = c->body + (c->off - c->head_len);
+            len = c->body_len - (c->off - c->head_len);
+        }
+        ssize_t n = write(c->fd, src, len);
+        if (n < 0) return errno == EINTR || errno == EAGAIN ? 0 : -1;
+        c->off += n;
+    }
+    return -1;
+}
+
+int exporter_run(const char *listen_on, int interval_ms) {
+    struct stat bound = {0};
+    int lfd = listen_socket(listen_on, &bound);
+    if (lfd < 0) {
+        fprintf(stderr, "spoolie: cannot listen on %s: %s\n", listen_on, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    exporter_t ex;
+    pthread_mutex_init(&ex.lock, NULL);
+    pthread_cond_init(&ex.cond, NULL);
+    ex.running = 1;
+    ex.interval_ms = interval_ms;
+    ex.page = NULL;
+
+    pthread_t refresher;
+    if (pthread_create(&refresher, NULL, refresh_thread_func, &ex) != 0) {
+        fprintf(stderr, "spoolie: cannot start refresh thread\n");
+        close(lfd);
+        return 1;
+    }
+
+    client_t clients[EXPORTER_MAX_CLIENTS];
+    for (int i = 0; i < EXPORTER_MAX_CLIENTS; i++) {
+        memset(&clients[i], 0, sizeof(clients[i]));
+        clients[i].fd = -1;
+    }
+
+    while (!exporter_stop) {
+        struct pollfd pfds[EXPORTER_MAX_CLIENTS + 1];
+        int slot[EXPORTER_MAX_CLIENTS + 1];
+        int n = 0;
+        pfds[n].fd = lfd;
+        pfds[n].events = POLLIN;
+        n++;
+        for (int i = 0; i < EXPORTER_MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0) continue;
+            pfds[n].fd = clients[i].fd;
+            pfds[n].events = clients[i].head_len ? POLLOUT : POLLIN;
+            slot[n] = i;
+            n++;
+        }
+
+        /* Wake up now and then to notice a stop request and slow clients */
+        int ready = poll(pfds, n, 250);
+
+        /* So idle connections can't hold every slot */
+        uint64_t now = monotonic_ms();
+        for (int k = 1; k < n; k++) {
+            client_t *c = &clients[slot[k]];
+            if (now >= c->deadline) {
+                client_close(&ex, c);
+                pfds[k].revents = 0;
+            }
+        }
+        if (ready <= 0) continue;
+
+        for (int k = 1; k < n; k++) {
+            if (!pfds[k].revents) continue;
+            client_t *c = &clients[slot[k]];
+            if (client_io(&ex, c, pfds[k].revents) < 0) client_close(&ex, c);
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+                client_t *c = NULL;
+                for (int i = 0; i < EXPORTER_MAX_CLIENTS && !c; i++) {
+                    if (clients[i].fd < 0) c = &clients[i];
+                }
+                if (!c) {
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                c->fd = fd;
+                c->deadline = monotonic_ms() + EXPORTER_CLIENT_TIMEOUT_MS;
+            }
+        }
+    }
+
+    for (int i = 0; i < EXPORTER_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) client_close(&ex, &clients[i]);
+    }
+    close(lfd);
+    if (!is_port(listen_on)) {
+        /* Unless another instance has replaced it since */
+        struct stat st;
+        if (lstat(listen_on, &st) == 0 && st.st_dev == bound.st_dev && st.st_ino == bound.st_ino) {
+            unlink(listen_on);
+        }
+    }
+
+    pthread_mutex_lock(&ex.lock);
+    ex.running = 0;
+    pthread_cond_signal(&ex.cond);
+    pthread_mutex_unlock(&ex.lock);
+    pthread_join(refresher, NULL);
+
+    page_put(&ex, ex.page);
+    pthread_mutex_destroy(&ex.lock);
+    pthread_cond_destroy(&ex.cond);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+/*
+ * Daemon mode: refresh one CUPS snapshot every interval_ms and serve it as
+ * Prometheus text metrics over HTTP. listen is a TCP port on localhost if
+ * it is all digits, otherwise the path of a Unix socket. Runs until
+ * interrupted and returns the exit status.
+ */
+int exporter_run(const char *listen, int interval_ms);
+
+#endif
@@ -0,0 +1,353 @@
+#include "health.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A probe in flight; copied out of the target so the lock can be dropped */
+typedef struct {
+    char name[256];
+    char host[256];
+    int port;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;              /* 0 until resolved */
+    int fd;
+    uint64_t started;
+    int rtt_ms;                     /* -1 until it succeeds */
+} probe_t;
+
+/* Schemes whose host is the device itself, with their usual ports */
+static const struct {
+    const char *scheme;
+    int port;
+} probe_schemes[] = {
+    { "ipp", 631 }, { "ipps", 631 }, { "http", 80 }, { "https", 443 },
+    { "socket", 9100 }, { "lpd", 515 },
+};
+
+static uint32_t next_random(uint32_t *state) {
+    /* xorshift32; only used to spread probes out */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Interval +/- 20% */
+static uint64_t jittered(uint32_t *seed) {
+    return HEALTH_INTERVAL_MS * 4 / 5 + next_random(seed) % (HEALTH_INTERVAL_MS * 2 / 5);
+}
+
+static void target_from_uri(const char *uri, char *host, size_t hostlen, int *port) {
+    char scheme[32], user[256], resource[1024];
+    int p = 0;
+    host[0] = '\0';
+    *port = 0;
+
+    if (!uri[0] || httpSeparateURI(HTTP_URI_CODING_ALL, uri, scheme, sizeof(scheme), user,
+                                   sizeof(user), host, (int)hostlen, &p, resource,
+                                   sizeof(resource)) < HTTP_URI_STATUS_OK) {
+        host[0] = '\0';
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(probe_schemes) / sizeof(probe_schemes[0]); i++) {
+        if (strcmp(scheme, probe_schemes[i].scheme) == 0) {
+            *port = p > 0 ? p : probe_schemes[i].port;
+            return;
+        }
+    }
+    host[0] = '\0';
+}
+
+static health_target_t *find_target(health_t *health, const char *name) {
+    for (int i = 0; i < health->count; i++) {
+        if (strcmp(health->targets[i].name, name) == 0) return &health->targets[i];
+    }
+    return NULL;
+}
+
+/* Fill in the address of a probe, reusing one already looked up for the
+ * same host earlier in the batch */
+static void probe_resolve(probe_t *probes, int i) {
+    probe_t *p = &probes[i];
+    if (p->addrlen) return;
+    for (int k = 0; k < i; k++) {
+        if (probes[k].addrlen && probes[k].port == p->port && strcmp(probes[k].host, p->host) == 0) {
+            p->addr = probes[k].addr;
+            p->addrlen = probes[k].addrlen;
+            return;
+        }
+    }
+
+    char port[16];
+    snprintf(port, sizeof(port), "%d", p->port);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(p->host, port, &hints, &res) != 0) return;
+    if (res->ai_addrlen <= sizeof(p->addr)) {
+        memcpy(&p->addr, res->ai_addr, res->ai_addrlen);
+        p->addrlen = res->ai_addrlen;
+    }
+    freeaddrinfo(res);
+}
+
+/* Start a non-blocking connect; a refused connection still proves the host is up */
+static void probe_start(probe_t *p) {
+    p->fd = -1;
+    p->rtt_ms = -1;
+    if (!p->addrlen) return;
+
+    p->started = monotonic_ms();
+    p->fd = socket(p->addr.ss_family, SOCK_STREAM, 0);
+    if (p->fd >= 0) {
+        fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) | O_NONBLOCK);
+        if (connect(p->fd, (struct sockaddr *)&p->addr, p->addrlen) == 0 || errno == ECONNREFUSED) {
+            p->rtt_ms = (int)(monotonic_ms() - p->started);
+            close(p->fd);
+            p->fd = -1;
+        } else if (errno != EINPROGRESS) {
+            close(p->fd);
+            p->fd = -1;
+        }
+    }
+}
+
+static void run_probes(probe_t *probes, int count) {
+    /* All lookups first: a slow one must not add to other probes' times */
+    for (int i = 0; i < count; i++) {
+        probe_resolve(probes, i);
+    }
+    for (int i = 0; i < count; i++) {
+        probe_start(&probes[i]);
+    }
+
+    uint64_t deadline = monotonic_ms() + HEALTH_TIMEOUT_MS;
+    struct pollfd pfds[HEALTH_CONCURRENCY];
+    int slots[HEALTH_CONCURRENCY];
+    for (;;) {
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (probes[i].fd < 0) continue;
+            pfds[n].fd = probes[i].fd;
+            pfds[n].events = POLLOUT;
+            pfds[n].revents = 0;
+            slots[n++] = i;
+        }
+        uint64_t now = monotonic_ms();
+        if (n == 0 || now >= deadline) break;
+        if (poll(pfds, n, (int)(deadline - now)) <= 0) continue;
+
+        now = monotonic_ms();
+        for (int k = 0; k < n; k++) {
+            if (!pfds[k].revents) continue;
+            probe_t *p = &probes[slots[k]];
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0 || err == ECONNREFUSED) p->rtt_ms = (int)(now - p->started);
+            close(p->fd);
+            p->fd = -1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (probes[i].fd >= 0) close(probes[i].fd);
+    }
+}
+
+static void *health_thread_func(void *arg) {
+    health_t *health = arg;
+    probe_t probes[HEALTH_CONCURRENCY];
+    uint32_t seed = (uint32_t)time(NULL) | 1;
+
+    pthread_mutex_lock(&health->lock);
+    while (health->running) {
+        uint64_t now = monotonic_ms();
+        uint64_t wake = now + 1000;
+        int n = 0;
+        for (int i = 0; i < health->count; i++) {
+            health_target_t *t = &health->targets[i];
+            if (!t->host[0] || t->probing) continue;
+            if (t->next_probe > now) {
+                if (t->next_probe < wake) wake = t->next_probe;
+                continue;
+            }
+            if (n == HEALTH_CONCURRENCY) {
+                wake = now;
+                continue;
+            }
+            probe_t *p = &probes[n++];
+            memcpy(p->name, t->name, sizeof(p->name));
+            memcpy(p->host, t->host, sizeof(p->host));
+            p->port = t->port;
+            p->addrlen = t->resolved_until > now ? t->addrlen : 0;
+            if (p->addrlen) p->addr = t->addr;
+            t->probing = 1;
+        }
+
+        if (n == 0) {
+            struct timespec until = abs_deadline(wake - now);
+            pthread_cond_timedwait(&health->cond, &health->lock, &until);
+            continue;
+        }
+
+        pthread_mutex_unlock(&health->lock);
+        run_probes(probes, n);
+        pthread_mutex_lock(&health->lock);
+
+        /* Targets may have been removed or replaced meanwhile */
+        now = monotonic_ms();
+        for (int i = 0; i < n; i++) {
+            health_target_t *t = find_target(health, probes[i].name);
+            if (!t || !t->probing) continue;
+            t->probing = 0;
+            if (strcmp(t->host, probes[i].host) != 0 || t->port != probes[i].port) continue;
+
+            t->rtt_ms[t->head] = probes[i].rtt_ms;
+            t->head = (t->head + 1) % HEALTH_SAMPLES;
+            if (t->samples < HEALTH_SAMPLES) t->samples++;
+            t->failures = probes[i].rtt_ms < 0 ? t->failures + 1 : 0;
+
+            /* Look the host up again after a failure, it may have moved */
+            if (probes[i].rtt_ms < 0) {
+                t->resolved_until = 0;
+            } else if (t->resolved_until <= now) {
+                t->addr = probes[i].addr;
+                t->addrlen = probes[i].addrlen;
+                t->resolved_until = now + HEALTH_RESOLVE_MS;
+            }
+            t->next_probe = now + jittered(&seed);
+        }
+    }
+    pthread_mutex_unlock(&health->lock);
+    return NULL;
+}
+
+void health_init(health_t *health) {
+    pthread_mutex_init(&health->lock, NULL);
+    pthread_cond_init(&health->cond, NULL);
+    health->targets = NULL;
+    health->count = 0;
+    health->capacity = 0;
+    health->running = 1;
+    pthread_create(&health->thread, NULL, health_thread_func, health);
+}
+
+void health_shutdown(health_t *health) {
+    pthread_mutex_lock(&health->lock);
+    health->running = 0;
+    pthread_cond_signal(&health->cond);
+    pthread_mutex_unlock(&health->lock);
+    pthread_join(health->thread, NULL);
+
+    free(health->targets);
+    health->targets = NULL;
+    health->count = 0;
+    pthread_mutex_destroy(&health->lock);
+    pthread_cond_destroy(&health->cond);
+}
+
+void health_update(health_t *health, const printer_info_t *printers, int count) {
+    uint64_t now = monotonic_ms();
+    uint32_t seed = (uint32_t)now | 1;
+
+    pthread_mutex_lock(&health->lock);
+    for (int i = 0; i < health->count; i++) {
+        health->targets[i].seen = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const printer_info_t *p = &printers[i];
+        if (p->is_class) continue;
+
+        char host[256];
+        int port;
+        target_from_uri(p->device_uri, host, sizeof(host), &port);
+
+        health_target_t *t = find_target(health, p->name);
+        if (t && (strcmp(t->host, host) != 0 || t->port != port)) {
+            /* Printer was pointed somewhere else: old history means nothing */
+            int probing = t->probing;
+            memset(t, 0, sizeof(*t));
+            t->probing = probing;
+            snprintf(t->name, sizeof(t->name), "%s", p->name);
+            t->next_probe = now;
+        }
+        if (!t) {
+            if (health->count >= health->capacity) {
+                int capacity = health->capacity ? health->capacity * 2 : 16;
+                health_target_t *grown = realloc(health->targets, capacity * sizeof(health_target_t));
+                if (!grown) break;
+                health->targets = grown;
+                health->capacity = capacity;
+            }
+            t = &health->targets[health->count++];
+            memset(t, 0, sizeof(*t));
+            snprintf(t->name, sizeof(t->name), "%s", p->name);
+            /* Spread the first round over a few seconds */
+            t->next_probe = now + next_random(&seed) % 3000;
+        }
+        snprintf(t->host, sizeof(t->host), "%s", host);
+        t->port = port;
+        t->seen = 1;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < health->count; i++) {
+        if (health->targets[i].seen) health->targets[kept++] = health->targets[i];
+    }
+    health->count = kept;
+
+    pthread_cond_signal(&health->cond);
+    pthread_mutex_unlock(&health->lock);
+}
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+int health_get(health_t *health, const char *name, health_status_t *status) {
+    memset(status, 0, sizeof(*status));
+
+    pthread_mutex_lock(&health->lock);
+    health_target_t *t = find_target(health, name);
+    if (!t) {
+        pthread_mutex_unlock(&health->lock);
+        return -1;
+    }
+
+    if (!t->host[0]) {
+        status->state = HEALTH_UNPROBED;
+    } else if (t->samples == 0) {
+        status->state = HEALTH_UNKNOWN;
+    } else {
+        status->state = t->failures >= HEALTH_DOWN_AFTER ? HEALTH_DOWN : HEALTH_UP;
+
+        int ok[HEALTH_SAMPLES];
+        int good = 0;
+        status->rtt_ms = -1;
+        /* Walk newest to oldest */
+        for (int i = 0; i < t->samples; i++) {
+            int rtt = t->rtt_ms[(t->head - 1 - i + HEALTH_SAMPLES) % HEALTH_SAMPLES];
+            if (rtt < 0) continue;
+            if (status->rtt_ms < 0) status->rtt_ms = rtt;
+            ok[good++] = rtt;
+        }
+        qsort(ok, good, sizeof(int), cmp_int);
+        status->median_ms = good ? ok[good / 2] : -1;
+        status->loss = (t->samples - good) * 100 / t->samples;
+    }
+    pthread_mutex_unlock(&health->lock);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "cups_api.h"
+
+/*
+ * Direct reachability checks. A background thread connects to the host
+ * in each printer's device-uri, bypassing cupsd, and keeps the last
+ * HEALTH_SAMPLES round trips per printer. Probes are spread over the
+ * interval with jitter so a large fleet is never probed in one burst.
+ * Hosts are resolved before any connect of a batch starts and the
+ * address is reused for a while, so name lookups never count towards a
+ * round trip.
+ */
+#define HEALTH_SAMPLES 32
+#define HEALTH_INTERVAL_MS 30000
+#define HEALTH_TIMEOUT_MS 2000
+#define HEALTH_CONCURRENCY 32
+#define HEALTH_DOWN_AFTER 2         /* Consecutive failures before a printer is down */
+#define HEALTH_RESOLVE_MS 300000    /* How long a resolved device address is reused */
+
+typedef enum {
+    HEALTH_UNKNOWN,                 /* Not probed yet */
+    HEALTH_UNPROBED,                /* device-uri has no network host (usb, dnssd, ...) */
+    HEALTH_UP,
+    HEALTH_DOWN
+} health_state_t;
+
+typedef struct {
+    char name[256];
+    char host[256];
+    int port;
+    int rtt_ms[HEALTH_SAMPLES];     /* Ring buffer, -1 for a failed probe */
+    int head;                       /* Next slot to write */
+    int samples;
+    int failures;                   /* Consecutive */
+    uint64_t next_probe;            /* monotonic_ms */
+    struct sockaddr_storage addr;   /* host:port resolved, valid until resolved_until */
+    socklen_t addrlen;
+    uint64_t resolved_until;
+    int probing;
+    int seen;                       /* Still configured, used while syncing */
+} health_target_t;
+
+typedef struct {
+    health_state_t state;
+    int rtt_ms;                     /* Last successful round trip */
+    int median_ms;                  /* Over the successful samples kept */
+    int loss;                       /* Percent of kept samples that failed */
+} health_status_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    health_target_t *targets;
+    int count;
+    int capacity;
+} health_t;
+
+void health_init(health_t *health);
+void health_shutdown(health_t *health);
+
+/* Match the probed set to the configured printers, keeping history by name */
+void health_update(health_t *health, const printer_info_t *printers, int count);
+
+/* Returns 0 and fills status if the printer is known */
+int health_get(health_t *health, const char *name, health_status_t *status);
+
+#endif
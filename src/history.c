@@ -0,0 +1,596 @@
+#include "history.h"
+#include "broker.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Record tags inside a frame */
+#define TAG_PRINTER 'P'
+#define TAG_PRINTER_GONE 'p'
+#define TAG_JOB 'J'
+#define TAG_JOB_FIELDS 'u'      /* Job id, mask of JOB_* fields, those fields */
+#define TAG_JOB_GONE 'j'
+
+#define JOB_PRINTER (1 << 0)
+#define JOB_TITLE (1 << 1)
+#define JOB_USER (1 << 2)
+#define JOB_STATE (1 << 3)
+#define JOB_SIZE (1 << 4)
+#define JOB_PRIORITY (1 << 5)
+#define JOB_HOLD_UNTIL (1 << 6)
+#define JOB_CREATED (1 << 7)
+#define JOB_PROCESSING (1 << 8)
+#define JOB_COMPLETED (1 << 9)
+#define JOB_ALL ((1 << 10) - 1)
+
+static void put_str(buffer_t *buf, const char *s) {
+    size_t len = strlen(s);
+    put_varint(buf, len);
+    put_bytes(buf, s, len);
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    int bad;
+} reader_t;
+
+static uint64_t read_varint(reader_t *r) {
+    uint64_t value;
+    if (get_varint(&r->p, r->end, &value) != 0) {
+        r->bad = 1;
+        return 0;
+    }
+    return value;
+}
+
+static int64_t read_int(reader_t *r) {
+    int64_t value;
+    if (get_int(&r->p, r->end, &value) != 0) {
+        r->bad = 1;
+        return 0;
+    }
+    return value;
+}
+
+static void read_str(reader_t *r, char *out, size_t size) {
+    uint64_t len = read_varint(r);
+    if (len > (uint64_t)(r->end - r->p)) {
+        r->bad = 1;
+        out[0] = '\0';
+        return;
+    }
+    /* Fields are overwritten in place, so clear what the old value left */
+    size_t n = len < size ? len : size - 1;
+    memcpy(out, r->p, n);
+    memset(out + n, 0, size - n);
+    r->p += len;
+}
+
+static void put_printer(buffer_t *buf, const printer_info_t *p) {
+    put_bytes(buf, &(uint8_t){TAG_PRINTER}, 1);
+    put_str(buf, p->name);
+    put_str(buf, p->make_model);
+    put_str(buf, p->state);
+    put_str(buf, p->location);
+    put_str(buf, p->device_uri);
+    put_varint(buf, (p->is_default ? 1 : 0) | (p->accepting ? 2 : 0) | (p->is_class ? 4 : 0));
+}
+
+static void get_printer(reader_t *r, printer_info_t *p) {
+    memset(p, 0, sizeof(*p));
+    read_str(r, p->name, sizeof(p->name));
+    read_str(r, p->make_model, sizeof(p->make_model));
+    read_str(r, p->state, sizeof(p->state));
+    read_str(r, p->location, sizeof(p->location));
+    read_str(r, p->device_uri, sizeof(p->device_uri));
+    uint64_t flags = read_varint(r);
+    p->is_default = (flags & 1) != 0;
+    p->accepting = (flags & 2) != 0;
+    p->is_class = (flags & 4) != 0;
+}
+
+static void put_job_fields(buffer_t *buf, const job_info_t *j, unsigned mask) {
+    if (mask & JOB_PRINTER) put_str(buf, j->printer);
+    if (mask & JOB_TITLE) put_str(buf, j->title);
+    if (mask & JOB_USER) put_str(buf, j->user);
+    if (mask & JOB_STATE) put_str(buf, j->state);
+    if (mask & JOB_SIZE) put_int(buf, j->size);
+    if (mask & JOB_PRIORITY) put_int(buf, j->priority);
+    if (mask & JOB_HOLD_UNTIL) put_str(buf, j->hold_until);
+    /* Later times as offsets from creation; 0 stays 0 */
+    if (mask & JOB_CREATED) put_int(buf, j->created);
+    if (mask & JOB_PROCESSING) put_int(buf, j->processing ? j->processing - j->created + 1 : 0);
+    if (mask & JOB_COMPLETED) put_int(buf, j->completed ? j->completed - j->created + 1 : 0);
+}
+
+static void get_job_fields(reader_t *r, job_info_t *j, unsigned mask) {
+    if (mask & JOB_PRINTER) read_str(r, j->printer, sizeof(j->printer));
+    if (mask & JOB_TITLE) read_str(r, j->title, sizeof(j->title));
+    if (mask & JOB_USER) read_str(r, j->user, sizeof(j->user));
+    if (mask & JOB_STATE) read_str(r, j->state, sizeof(j->state));
+    if (mask & JOB_SIZE) j->size = (int)read_int(r);
+    if (mask & JOB_PRIORITY) j->priority = (int)read_int(r);
+    if (mask & JOB_HOLD_UNTIL) read_str(r, j->hold_until, sizeof(j->hold_until));
+    if (mask & JOB_CREATED) j->created = (time_t)read_int(r);
+    if (mask & JOB_PROCESSING) {
+        int64_t processing = read_int(r);
+        j->processing = processing ? j->created + processing - 1 : 0;
+    }
+    if (mask & JOB_COMPLETED) {
+        int64_t completed = read_int(r);
+        j->completed = completed ? j->created + completed - 1 : 0;
+    }
+}
+
+static void put_job(buffer_t *buf, const job_info_t *j) {
+    put_bytes(buf, &(uint8_t){TAG_JOB}, 1);
+    put_int(buf, j->id);
+    put_job_fields(buf, j, JOB_ALL);
+}
+
+static int same_printer(const printer_info_t *a, const printer_info_t *b) {
+    return strcmp(a->make_model, b->make_model) == 0 &&
+           strcmp(a->state, b->state) == 0 &&
+           strcmp(a->location, b->location) == 0 &&
+           strcmp(a->device_uri, b->device_uri) == 0 &&
+           !a->is_default == !b->is_default &&
+           !a->accepting == !b->accepting &&
+           !a->is_class == !b->is_class;
+}
+
+/* Fields of a job that differ, as a JOB_* mask */
+static unsigned job_changes(const job_info_t *a, const job_info_t *b) {
+    unsigned mask = 0;
+    if (strcmp(a->printer, b->printer) != 0) mask |= JOB_PRINTER;
+    if (strcmp(a->title, b->title) != 0) mask |= JOB_TITLE;
+    if (strcmp(a->user, b->user) != 0) mask |= JOB_USER;
+    if (strcmp(a->state, b->state) != 0) mask |= JOB_STATE;
+    if (a->size != b->size) mask |= JOB_SIZE;
+    if (a->priority != b->priority) mask |= JOB_PRIORITY;
+    if (strcmp(a->hold_until, b->hold_until) != 0) mask |= JOB_HOLD_UNTIL;
+    /* The other times are relative to it */
+    if (a->created != b->created) mask |= JOB_CREATED | JOB_PROCESSING | JOB_COMPLETED;
+    if (a->processing != b->processing) mask |= JOB_PROCESSING;
+    if (a->completed != b->completed) mask |= JOB_COMPLETED;
+    return mask;
+}
+
+static int compare_printers(const void *a, const void *b) {
+    return strcmp(((const printer_info_t *)a)->name, ((const printer_info_t *)b)->name);
+}
+
+static int compare_jobs(const void *a, const void *b) {
+    int x = ((const job_info_t *)a)->id;
+    int y = ((const job_info_t *)b)->id;
+    return (x > y) - (x < y);
+}
+
+/* Everything that differs between two sorted snapshots */
+static void put_delta(buffer_t *buf,
+                      const printer_info_t *old_p, int old_pc,
+                      const printer_info_t *new_p, int new_pc,
+                      const job_info_t *old_j, int old_jc,
+                      const job_info_t *new_j, int new_jc) {
+    int i = 0, k = 0;
+    while (i < old_pc || k < new_pc) {
+        int cmp = i >= old_pc ? 1 : k >= new_pc ? -1 : strcmp(old_p[i].name, new_p[k].name);
+        if (cmp < 0) {
+            put_bytes(buf, &(uint8_t){TAG_PRINTER_GONE}, 1);
+            put_str(buf, old_p[i++].name);
+        } else if (cmp > 0) {
+            put_printer(buf, &new_p[k++]);
+        } else {
+            if (!same_printer(&old_p[i], &new_p[k])) put_printer(buf, &new_p[k]);
+            i++;
+            k++;
+        }
+    }
+
+    i = 0;
+    k = 0;
+    while (i < old_jc || k < new_jc) {
+        int cmp = i >= old_jc ? 1 : k >= new_jc ? -1 : compare_jobs(&old_j[i], &new_j[k]);
+        if (cmp < 0) {
+            put_bytes(buf, &(uint8_t){TAG_JOB_GONE}, 1);
+            put_int(buf, old_j[i++].id);
+        } else if (cmp > 0) {
+            put_job(buf, &new_j[k++]);
+        } else {
+            /* Jobs mostly change state, so only changed fields are sent */
+            unsigned mask = job_changes(&old_j[i], &new_j[k]);
+            if (mask) {
+                put_bytes(buf, &(uint8_t){TAG_JOB_FIELDS}, 1);
+                put_int(buf, new_j[k].id);
+                put_varint(buf, mask);
+                put_job_fields(buf, &new_j[k], mask);
+            }
+            i++;
+            k++;
+        }
+    }
+}
+
+static void drop_oldest(history_t *history) {
+    history_segment_t *seg = &history->segments[0];
+    history->bytes -= seg->cap;
+    free(seg->data);
+    history->count--;
+    memmove(&history->segments[0], &history->segments[1],
+            history->count * sizeof(history_segment_t));
+}
+
+static history_segment_t *new_segment(history_t *history, time_t when) {
+    if (history->count > 0) {
+        /* The previous segment is complete; give back its slack */
+        history_segment_t *last = &history->segments[history->count - 1];
+        uint8_t *shrunk = realloc(last->data, last->len ? last->len : 1);
+        if (shrunk) {
+            history->bytes -= last->cap;
+            last->data = shrunk;
+            last->cap = last->len ? last->len : 1;
+            history->bytes += last->cap;
+        }
+    }
+    if (history->count >= history->capacity) {
+        int capacity = history->capacity ? history->capacity * 2 : 16;
+        history_segment_t *grown = realloc(history->segments, capacity * sizeof(*grown));
+        if (!grown) return NULL;
+        history->segments = grown;
+        history->capacity = capacity;
+    }
+    history_segment_t *seg = &history->segments[history->count++];
+    memset(seg, 0, sizeof(*seg));
+    seg->start = when;
+    seg->end = when;
+    return seg;
+}
+
+void history_record(history_t *history, time_t when,
+                    const printer_info_t *printers, int printer_count,
+                    const job_info_t *jobs, int job_count) {
+    printer_info_t *sorted_p = malloc((printer_count ? printer_count : 1) * sizeof(*sorted_p));
+    job_info_t *sorted_j = malloc((job_count ? job_count : 1) * sizeof(*sorted_j));
+    if (!sorted_p || !sorted_j) {
+        free(sorted_p);
+        free(sorted_j);
+        return;
+    }
+    memcpy(sorted_p, printers, printer_count * sizeof(*sorted_p));
+    memcpy(sorted_j, jobs, job_count * sizeof(*sorted_j));
+    qsort(sorted_p, printer_count, sizeof(*sorted_p), compare_printers);
+    qsort(sorted_j, job_count, sizeof(*sorted_j), compare_jobs);
+
+    pthread_mutex_lock(&history->lock);
+
+    history_segment_t *seg = history->count ? &history->segments[history->count - 1] : NULL;
+    if (seg && when < seg->end) when = seg->end;  /* Clock stepped back */
+    int keyframe = !seg || seg->frames >= HISTORY_SEGMENT_FRAMES ||
+                   seg->len - seg->key_bytes >= seg->key_bytes;
+
+    buffer_t payload = {0};
+    if (keyframe) {
+        for (int i = 0; i < printer_count; i++) put_printer(&payload, &sorted_p[i]);
+        for (int i = 0; i < job_count; i++) put_job(&payload, &sorted_j[i]);
+    } else {
+        put_delta(&payload, history->printers, history->printer_count,
+                  sorted_p, printer_count, history->jobs, history->job_count,
+                  sorted_j, job_count);
+    }
+
+    /* Only move on to the new snapshot once its frame is stored */
+    int stored = 0;
+    if (!payload.failed && !keyframe && payload.len == 0) {
+        stored = 1;
+    } else if (!payload.failed) {
+        if (keyframe) seg = new_segment(history, when);
+        if (seg) {
+            buffer_t frame = {seg->data, seg->len, seg->cap, 0};
+            put_varint(&frame, (uint64_t)(when - seg->start));
+            put_varint(&frame, payload.len);
+            put_bytes(&frame, payload.data, payload.len);
+            if (!frame.failed) {
+                history->bytes += frame.cap - seg->cap;
+                seg->data = frame.data;
+                seg->len = frame.len;
+                seg->cap = frame.cap;
+                seg->frames++;
+                if (keyframe) seg->key_bytes = seg->len;
+                stored = 1;
+            } else if (keyframe) {
+                /* A segment without its keyframe can't be decoded */
+                free(frame.data);
+                history->count--;
+            }
+        }
+    }
+    free(payload.data);
+
+    if (stored) {
+        /* An unchanged queue costs nothing but moves the end forward */
+        seg->end = when;
+        free(history->printers);
+        free(history->jobs);
+        history->printers = sorted_p;
+        history->printer_count = printer_count;
+        history->jobs = sorted_j;
+        history->job_count = job_count;
+    } else {
+        free(sorted_p);
+        free(sorted_j);
+    }
+
+    /* Whole segments go from the old end, the newest one always stays */
+    while (history->count > 1 &&
+           (history->bytes > HISTORY_BUDGET ||
+            history->segments[1].start <= when - HISTORY_SPAN)) {
+        drop_oldest(history);
+    }
+
+    pthread_mutex_unlock(&history->lock);
+}
+
+int history_range(history_t *history, time_t *first, time_t *last) {
+    pthread_mutex_lock(&history->lock);
+    int status = -1;
+    if (history->count > 0) {
+        *first = history->segments[0].start;
+        *last = history->segments[history->count - 1].end;
+        status = 0;
+    }
+    pthread_mutex_unlock(&history->lock);
+    return status;
+}
+
+/* Sorted arrays being rebuilt, with room to grow */
+typedef struct {
+    printer_info_t *printers;
+    int printer_count;
+    int printer_capacity;
+    job_info_t *jobs;
+    int job_count;
+    int job_capacity;
+} rebuild_t;
+
+static int find_printer(const rebuild_t *rb, const char *name, int *found) {
+    int lo = 0, hi = rb->printer_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(rb->printers[mid].name, name);
+        if (cmp == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+static int find_job(const rebuild_t *rb, int id, int *found) {
+    int lo = 0, hi = rb->job_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rb->jobs[mid].id == id) {
+            *found = 1;
+            return mid;
+        }
+        if (rb->jobs[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+static int upsert_printer(rebuild_t *rb, const printer_info_t *p) {
+    int found;
+    int at = find_printer(rb, p->name, &found);
+    if (!found) {
+        if (rb->printer_count >= rb->printer_capacity) {
+            int capacity = rb->printer_capacity ? rb->printer_capacity * 2 : 16;
+            printer_info_t *grown = realloc(rb->printers, capacity * sizeof(*grown));
+            if (!grown) return -1;
+            rb->printers = grown;
+            rb->printer_capacity = capacity;
+        }
+        memmove(&rb->printers[at + 1], &rb->printers[at],
+                (rb->printer_count - at) * sizeof(*rb->printers));
+        rb->printer_count++;
+    }
+    rb->printers[at] = *p;
+    return 0;
+}
+
+static int upsert_job(rebuild_t *rb, const job_info_t *j) {
+    int found;
+    int at = find_job(rb, j->id, &found);
+    if (!found) {
+        if (rb->job_count >= rb->job_capacity) {
+            int capacity = rb->job_capacity ? rb->job_capacity * 2 : 16;
+            job_info_t *grown = realloc(rb->jobs, capacity * sizeof(*grown));
+            if (!grown) return -1;
+            rb->jobs = grown;
+            rb->job_capacity = capacity;
+        }
+        memmove(&rb->jobs[at + 1], &rb->jobs[at], (rb->job_count - at) * sizeof(*rb->jobs));
+        rb->job_count++;
+    }
+    rb->jobs[at] = *j;
+    return 0;
+}
+
+static int apply_frame(rebuild_t *rb, reader_t *r) {
+    while (r->p < r->end && !r->bad) {
+        uint8_t tag = *r->p++;
+        int found, at;
+        unsigned mask;
+        printer_info_t p;
+        job_info_t j;
+        switch (tag) {
+            case TAG_PRINTER:
+                get_printer(r, &p);
+                if (!r->bad && upsert_printer(rb, &p) != 0) return -1;
+                break;
+            case TAG_PRINTER_GONE:
+                read_str(r, p.name, sizeof(p.name));
+                at = find_printer(rb, p.name, &found);
+                if (found) {
+                    rb->printer_count--;
+                    memmove(&rb->printers[at], &rb->printers[at + 1],
+                            (rb->printer_count - at) * sizeof(*rb->printers));
+                }
+                break;
+            case TAG_JOB:
+                memset(&j, 0, sizeof(j));
+                j.id = (int)read_int(r);
+                get_job_fields(r, &j, JOB_ALL);
+                if (!r->bad && upsert_job(rb, &j) != 0) return -1;
+                break;
+            case TAG_JOB_FIELDS:
+                at = find_job(rb, (int)read_int(r), &found);
+                mask = (unsigned)read_varint(r);
+                if (!found) {
+                    r->bad = 1;
+                    break;
+                }
+                get_job_fields(r, &rb->jobs[at], mask);
+                break;
+            case TAG_JOB_GONE:
+                at = find_job(rb, (int)read_int(r), &found);
+                if (found) {
+                    rb->job_count--;
+                    memmove(&rb->jobs[at], &rb->jobs[at + 1],
+                            (rb->job_count - at) * sizeof(*rb->jobs));
+                }
+                break;
+            default:
+                r->bad = 1;
+                break;
+        }
+    }
+    return r->bad ? -1 : 0;
+}
+
+time_t history_at(history_t *history, time_t when,
+                  printer_info_t **printers, int *printer_count,
+                  job_info_t **jobs, int *job_count) {
+    *printers = NULL;
+    *printer_count = 0;
+    *jobs = NULL;
+    *job_count = 0;
+
+    pthread_mutex_lock(&history->lock);
+
+    /* Nearest keyframe at or before when */
+    history_segment_t *seg = NULL;
+    for (int i = history->count - 1; i >= 0; i--) {
+        if (history->segments[i].start <= when) {
+            seg = &history->segments[i];
+            break;
+        }
+    }
+    if (!seg) {
+        pthread_mutex_unlock(&history->lock);
+        return 0;
+    }
+
+    rebuild_t rb = {0};
+    reader_t r = {seg->data, seg->data + seg->len, 0};
+    int status = 0;
+    while (r.p < r.end && status == 0) {
+        time_t at = seg->start + (time_t)read_varint(&r);
+        uint64_t len = read_varint(&r);
+        if (r.bad || len > (uint64_t)(r.end - r.p)) {
+            status = -1;
+            break;
+        }
+        if (at > when) break;
+        reader_t frame = {r.p, r.p + len, 0};
+        status = apply_frame(&rb, &frame);
+        r.p += len;
+    }
+    time_t shown = when < seg->end ? when : seg->end;
+
+    pthread_mutex_unlock(&history->lock);
+
+    if (status != 0) {
+        free(rb.printers);
+        free(rb.jobs);
+        return 0;
+    }
+    *printers = rb.printers ? rb.printers : calloc(1, sizeof(printer_info_t));
+    *printer_count = rb.printer_count;
+    *jobs = rb.jobs ? rb.jobs : calloc(1, sizeof(job_info_t));
+    *job_count = rb.job_count;
+    return shown;
+}
+
+static void *history_thread_func(void *arg) {
+    history_t *history = arg;
+
+    pthread_mutex_lock(&history->lock);
+    while (history->running) {
+        pthread_mutex_unlock(&history->lock);
+
+        /* Same sources as the panels: the broker when one runs, else cupsd */
+        printer_info_t *printers;
+        job_info_t *jobs;
+        int failed = 0;
+        int printer_count = broker_get_printers(&printers);
+        if (printer_count < 0) {
+            printer_count = get_printers(&printers);
+            failed |= printer_count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING;
+        }
+        int job_count = broker_get_jobs(&jobs);
+        if (job_count < 0) {
+            job_count = get_jobs(&jobs);
+            failed |= job_count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING;
+        }
+        /* A failed fetch would read as every job vanishing and coming
+         * back; leave a gap instead, the previous snapshot stands */
+        if (!failed) history_record(history, time(NULL), printers, printer_count, jobs, job_count);
+        free_printers(printers);
+        free_jobs(jobs);
+
+        pthread_mutex_lock(&history->lock);
+        if (!history->running) break;
+        struct timespec until = abs_deadline(HISTORY_INTERVAL_MS);
+        pthread_cond_timedwait(&history->cond, &history->lock, &until);
+    }
+    pthread_mutex_unlock(&history->lock);
+    return NULL;
+}
+
+void history_init(history_t *history) {
+    pthread_mutex_init(&history->lock, NULL);
+    pthread_cond_init(&history->cond, NULL);
+    history->segments = NULL;
+    history->count = 0;
+    history->capacity = 0;
+    history->bytes = 0;
+    history->printers = NULL;
+    history->printer_count = 0;
+    history->jobs = NULL;
+    history->job_count = 0;
+    history->running = 1;
+    pthread_create(&history->thread, NULL, history_thread_func, history);
+}
+
+void history_shutdown(history_t *history) {
+    pthread_mutex_lock(&history->lock);
+    history->running = 0;
+    pthread_cond_signal(&history->cond);
+    pthread_mutex_unlock(&history->lock);
+    pthread_join(history->thread, NULL);
+
+    while (history->count > 0) drop_oldest(history);
+    free(history->segments);
+    history->segments = NULL;
+    free(history->printers);
+    free(history->jobs);
+    history->printers = NULL;
+    history->jobs = NULL;
+    pthread_mutex_destroy(&history->lock);
+    pthread_cond_destroy(&history->cond);
+}
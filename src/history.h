@@ -0,0 +1,76 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "cups_api.h"
+
+/*
+ * Queue history for rewinding the main panels. A background thread takes
+ * a printer and job snapshot every HISTORY_INTERVAL_MS and stores only
+ * what changed since the previous one: records added or changed (keyed
+ * by job id and printer name) and keys removed. Each segment starts with
+ * a keyframe holding every record, and a new one is cut once the deltas
+ * since the last have grown as large as it, so rebuilding any moment
+ * decodes at most about two keyframes' worth. Records are varint encoded
+ * with only the used part of each string. Whole segments are dropped
+ * from the old end past HISTORY_SPAN or HISTORY_BUDGET bytes.
+ */
+#define HISTORY_INTERVAL_MS 10000
+#define HISTORY_SPAN (24 * 60 * 60)         /* Seconds kept */
+#define HISTORY_BUDGET (8 << 20)            /* Bytes kept */
+#define HISTORY_SEGMENT_FRAMES 720          /* Longest run of deltas per keyframe */
+
+/* One keyframe and the deltas after it, as encoded frames */
+typedef struct {
+    time_t start;                   /* Time of the keyframe */
+    time_t end;                     /* Time of the last frame */
+    int frames;
+    size_t key_bytes;               /* Size of the keyframe */
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} history_segment_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+
+    history_segment_t *segments;    /* Oldest first; the last is being appended to */
+    int count;
+    int capacity;
+    size_t bytes;                   /* Allocated for all segments */
+
+    /* Previous snapshot, sorted by name and id, to diff against */
+    printer_info_t *printers;
+    int printer_count;
+    job_info_t *jobs;
+    int job_count;
+} history_t;
+
+void history_init(history_t *history);
+void history_shutdown(history_t *history);
+
+/* Add a snapshot taken at when. The arrays are not kept */
+void history_record(history_t *history, time_t when,
+                    const printer_info_t *printers, int printer_count,
+                    const job_info_t *jobs, int job_count);
+
+/* Times of the oldest and newest snapshot. Returns -1 if there are none */
+int history_range(history_t *history, time_t *first, time_t *last);
+
+/*
+ * Rebuild the lists as of the last snapshot taken at or before when,
+ * printers sorted by name and jobs by id. Returns the time of that
+ * snapshot, or 0 if history doesn't reach back that far. The arrays are
+ * freed with free_printers() and free_jobs().
+ */
+time_t history_at(history_t *history, time_t when,
+                  printer_info_t **printers, int *printer_count,
+                  job_info_t **jobs, int *job_count);
+
+#endif
@@ -0,0 +1,694 @@
+#include "jobindex.h"
+#include "broker.h"
+#include "util.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define JOBINDEX_MAGIC "spoolie-jobindex 1\n"
+#define JOBINDEX_MAX_TERMS 16
+
+/* Job states as stored; from STATE_FINAL on a job can't change any more */
+static const char *const state_names[] = {
+    "pending", "held", "printing", "stopped", "canceled", "aborted", "completed", "unknown"
+};
+#define STATE_COUNT (int)(sizeof(state_names) / sizeof(state_names[0]))
+#define STATE_FINAL 4
+#define STATE_UNKNOWN 7
+
+static uint8_t state_index(const char *name) {
+    for (int i = 0; i < STATE_COUNT; i++) {
+        if (strcmp(state_names[i], name) == 0) return (uint8_t)i;
+    }
+    return STATE_UNKNOWN;
+}
+
+static void data_free(jobindex_data_t *data) {
+    for (int i = 0; i < data->slot_count; i++) {
+        free(data->slots[i].bytes);
+    }
+    free(data->slots);
+    free(data->docs);
+    free(data->strings);
+    memset(data, 0, sizeof(*data));
+}
+
+static uint32_t slot_of(uint32_t key, int slot_count) {
+    return (key * 2654435761u) & (uint32_t)(slot_count - 1);
+}
+
+static int grow_slots(jobindex_data_t *data) {
+    int slot_count = data->slot_count ? data->slot_count * 2 : 4096;
+    jobindex_posting_t *slots = calloc(slot_count, sizeof(*slots));
+    if (!slots) return -1;
+    for (int i = 0; i < data->slot_count; i++) {
+        jobindex_posting_t *p = &data->slots[i];
+        if (!p->key) continue;
+        uint32_t s = slot_of(p->key, slot_count);
+        while (slots[s].key) s = (s + 1) & (uint32_t)(slot_count - 1);
+        slots[s] = *p;
+    }
+    free(data->slots);
+    data->slots = slots;
+    data->slot_count = slot_count;
+    return 0;
+}
+
+/* Posting list for key, added empty if create is set. NULL if absent */
+static jobindex_posting_t *find_posting(jobindex_data_t *data, uint32_t key, int create) {
+    if (create && (data->posting_count + 1) * 2 > data->slot_count) {
+        if (grow_slots(data) != 0) return NULL;
+    }
+    if (data->slot_count == 0) return NULL;
+
+    uint32_t s = slot_of(key, data->slot_count);
+    while (data->slots[s].key) {
+        if (data->slots[s].key == key) return &data->slots[s];
+        s = (s + 1) & (uint32_t)(data->slot_count - 1);
+    }
+    if (!create) return NULL;
+
+    jobindex_posting_t *p = &data->slots[s];
+    memset(p, 0, sizeof(*p));
+    p->key = key;
+    p->last = -1;
+    data->posting_count++;
+    return p;
+}
+
+static int posting_add(jobindex_posting_t *p, int doc) {
+    buffer_t buf = {p->bytes, p->len, p->cap, 0};
+    put_varint(&buf, (uint64_t)(doc - p->last));
+    if (buf.failed) return -1;
+    p->bytes = buf.data;
+    p->len = (uint32_t)buf.len;
+    p->cap = (uint32_t)buf.cap;
+    p->last = doc;
+    p->count++;
+    return 0;
+}
+
+static uint32_t trigram_key(const char *s) {
+    return ((uint32_t)(unsigned char)tolower((unsigned char)s[0]) << 16) |
+           ((uint32_t)(unsigned char)tolower((unsigned char)s[1]) << 8) |
+           (uint32_t)(unsigned char)tolower((unsigned char)s[2]);
+}
+
+static void index_text(jobindex_data_t *data, int doc, const char *text) {
+    for (size_t i = 0; text[i] && text[i + 1] && text[i + 2]; i++) {
+        jobindex_posting_t *p = find_posting(data, trigram_key(text + i), 1);
+        /* A trigram repeated within a job is listed once */
+        if (p && p->last != doc) posting_add(p, doc);
+    }
+}
+
+static int add_strings(jobindex_data_t *data, const job_info_t *job, uint32_t *offset) {
+    size_t title = strlen(job->title) + 1;
+    size_t user = strlen(job->user) + 1;
+    size_t printer = strlen(job->printer) + 1;
+    size_t need = data->strings_len + title + user + printer;
+    if (need > UINT32_MAX) return -1;
+    if (need > data->strings_cap) {
+        size_t cap = data->strings_cap ? data->strings_cap : 4096;
+        while (cap < need) cap *= 2;
+        char *grown = realloc(data->strings, cap);
+        if (!grown) return -1;
+        data->strings = grown;
+        data->strings_cap = cap;
+    }
+    *offset = (uint32_t)data->strings_len;
+    char *s = data->strings + data->strings_len;
+    memcpy(s, job->title, title);
+    memcpy(s + title, job->user, user);
+    memcpy(s + title + user, job->printer, printer);
+    data->strings_len = need;
+    return 0;
+}
+
+static int append_job(jobindex_data_t *data, const job_info_t *job) {
+    if (data->doc_count >= data->doc_capacity) {
+        int capacity = data->doc_capacity ? data->doc_capacity * 2 : 1024;
+        jobindex_doc_t *grown = realloc(data->docs, capacity * sizeof(*grown));
+        if (!grown) return -1;
+        data->docs = grown;
+        data->doc_capacity = capacity;
+    }
+    jobindex_doc_t *doc = &data->docs[data->doc_count];
+    if (add_strings(data, job, &doc->text) != 0) return -1;
+    doc->id = job->id;
+    doc->created = job->created;
+    doc->completed = job->completed;
+    doc->state = state_index(job->state);
+
+    int n = data->doc_count++;
+    index_text(data, n, job->title);
+    index_text(data, n, job->user);
+    return 0;
+}
+
+/* Position of the first document with an id of at least id */
+static int lower_bound(const jobindex_data_t *data, int id) {
+    int lo = 0, hi = data->doc_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (data->docs[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+    int x = ((const job_info_t *)a)->id;
+    int y = ((const job_info_t *)b)->id;
+    return (x > y) - (x < y);
+}
+
+static int reported(const job_info_t *jobs, int count, int id) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (jobs[mid].id == id) return 1;
+        if (jobs[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+/*
+ * Merge a Get-Jobs answer. With from set, jobs is every job CUPS still
+ * has from that id on: new ones are appended and active ones it no
+ * longer reports, which were purged, are marked unknown. With from 0,
+ * jobs is just the active set and only jobs already indexed are updated;
+ * appending from it could skip a job that came and went in between.
+ */
+static void apply_jobs(jobindex_t *index, job_info_t *jobs, int count, int from) {
+    if (count > 0) qsort(jobs, count, sizeof(job_info_t), compare_jobs);
+
+    pthread_mutex_lock(&index->lock);
+    jobindex_data_t *data = &index->data;
+    int last_id = data->doc_count ? data->docs[data->doc_count - 1].id : 0;
+    int changed = 0;
+
+    for (int i = 0; i < count; i++) {
+        const job_info_t *j = &jobs[i];
+        if (j->id > last_id) {
+            if (from && append_job(data, j) == 0) {
+                last_id = j->id;
+                changed = 1;
+            }
+            continue;
+        }
+        int at = lower_bound(data, j->id);
+        if (at == data->doc_count || data->docs[at].id != j->id) continue;
+        jobindex_doc_t *doc = &data->docs[at];
+        uint8_t state = state_index(j->state);
+        if (doc->state != state || doc->completed != j->completed) {
+            doc->state = state;
+            doc->completed = j->completed;
+            changed = 1;
+        }
+    }
+
+    for (int i = from ? lower_bound(data, from) : data->doc_count; i < data->doc_count; i++) {
+        jobindex_doc_t *doc = &data->docs[i];
+        if (doc->state < STATE_FINAL && !reported(jobs, count, doc->id)) {
+            doc->state = STATE_UNKNOWN;
+            changed = 1;
+        }
+    }
+
+    /* Jobs before first_active have all ended, and stay that way */
+    int first = lower_bound(data, index->first_active);
+    index->first_active = last_id + 1;
+    for (int i = first; i < data->doc_count; i++) {
+        if (data->docs[i].state < STATE_FINAL) {
+            index->first_active = data->docs[i].id;
+            break;
+        }
+    }
+
+    if (changed) {
+        index->dirty = 1;
+        index->generation++;
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+/*
+ * Where the next Get-Jobs for all jobs should start, given the sorted
+ * active set: at the oldest indexed job that has left it, to learn how
+ * it ended, or past the last indexed job if the set holds newer ones or
+ * catch_up is set. 0 when nothing needs asking.
+ */
+static int fetch_from(jobindex_t *index, const job_info_t *active, int count, int catch_up) {
+    pthread_mutex_lock(&index->lock);
+    jobindex_data_t *data = &index->data;
+    int last_id = data->doc_count ? data->docs[data->doc_count - 1].id : 0;
+    int from = (count > 0 && active[count - 1].id > last_id) || catch_up ? last_id + 1 : 0;
+    for (int i = lower_bound(data, index->first_active); i < data->doc_count; i++) {
+        const jobindex_doc_t *doc = &data->docs[i];
+        if (doc->state < STATE_FINAL && !reported(active, count, doc->id)) {
+            from = doc->id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+    return from;
+}
+
+/* What gets saved, copied out so it can be encoded without the lock */
+typedef struct {
+    jobindex_doc_t *docs;
+    int doc_count;
+    char *strings;
+    size_t strings_len;
+    jobindex_posting_t *postings;   /* bytes point into arena */
+    int posting_count;
+    uint8_t *arena;
+} snapshot_t;
+
+static void snapshot_free(snapshot_t *snap) {
+    free(snap->docs);
+    free(snap->strings);
+    free(snap->postings);
+    free(snap->arena);
+}
+
+static int snapshot_take(const jobindex_data_t *data, snapshot_t *snap) {
+    memset(snap, 0, sizeof(*snap));
+    size_t arena_len = 0;
+    for (int i = 0; i < data->slot_count; i++) arena_len += data->slots[i].len;
+
+    snap->docs = malloc((data->doc_count ? data->doc_count : 1) * sizeof(jobindex_doc_t));
+    snap->strings = malloc(data->strings_len ? data->strings_len : 1);
+    snap->postings = malloc((data->posting_count ? data->posting_count : 1) * sizeof(jobindex_posting_t));
+    snap->arena = malloc(arena_len ? arena_len : 1);
+    if (!snap->docs || !snap->strings || !snap->postings || !snap->arena) {
+        snapshot_free(snap);
+        return -1;
+    }
+
+    if (data->doc_count) memcpy(snap->docs, data->docs, data->doc_count * sizeof(jobindex_doc_t));
+    snap->doc_count = data->doc_count;
+    if (data->strings_len) memcpy(snap->strings, data->strings, data->strings_len);
+    snap->strings_len = data->strings_len;
+
+    size_t off = 0;
+    for (int i = 0; i < data->slot_count; i++) {
+        const jobindex_posting_t *p = &data->slots[i];
+        if (!p->key) continue;
+        jobindex_posting_t *copy = &snap->postings[snap->posting_count++];
+        *copy = *p;
+        copy->bytes = snap->arena + off;
+        if (p->len) memcpy(copy->bytes, p->bytes, p->len);
+        off += p->len;
+    }
+    return 0;
+}
+
+static void serialize(const snapshot_t *snap, buffer_t *buf) {
+    put_bytes(buf, JOBINDEX_MAGIC, strlen(JOBINDEX_MAGIC));
+    put_varint(buf, snap->strings_len);
+    put_bytes(buf, snap->strings, snap->strings_len);
+
+    put_varint(buf, (uint64_t)snap->doc_count);
+    int prev = 0;
+    for (int i = 0; i < snap->doc_count; i++) {
+        const jobindex_doc_t *doc = &snap->docs[i];
+        put_varint(buf, (uint64_t)(doc->id - prev));
+        put_varint(buf, doc->text);
+        put_int(buf, doc->created);
+        put_int(buf, doc->completed ? doc->completed - doc->created + 1 : 0);
+        put_bytes(buf, &doc->state, 1);
+        prev = doc->id;
+    }
+
+    put_varint(buf, (uint64_t)snap->posting_count);
+    for (int i = 0; i < snap->posting_count; i++) {
+        const jobindex_posting_t *p = &snap->postings[i];
+        put_varint(buf, p->key);
+        put_varint(buf, (uint64_t)p->count);
+        put_varint(buf, (uint64_t)p->last);
+        put_varint(buf, p->len);
+        put_bytes(buf, p->bytes, p->len);
+    }
+}
+
+static void save_index(jobindex_t *index) {
+    /* Searches wait on the lock, so only copy under it */
+    pthread_mutex_lock(&index->lock);
+    if (!index->dirty) {
+        pthread_mutex_unlock(&index->lock);
+        return;
+    }
+    snapshot_t snap;
+    int ok = snapshot_take(&index->data, &snap) == 0;
+    if (ok) index->dirty = 0;
+    pthread_mutex_unlock(&index->lock);
+    if (!ok) return;
+
+    buffer_t buf = {0};
+    serialize(&snap, &buf);
+    snapshot_free(&snap);
+    ok = !buf.failed;
+
+    /* Written under a unique name and renamed, so a crash leaves the
+     * previous save and instances saving at once don't mix their writes */
+    char path[1024], tmp[1100];
+    ok = ok && state_path(path, sizeof(path), JOBINDEX_FILE) == 0;
+    if (ok) {
+        snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+        int fd = mkstemp(tmp);
+        FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+        if (fd >= 0 && !fp) close(fd);
+        ok = fp && fwrite(buf.data, 1, buf.len, fp) == buf.len;
+        if (fp && fclose(fp) != 0) ok = 0;
+        if (ok) ok = rename(tmp, path) == 0;
+        if (!ok && fd >= 0) unlink(tmp);
+    }
+    free(buf.data);
+
+    if (!ok) {
+        pthread_mutex_lock(&index->lock);
+        index->dirty = 1;
+        pthread_mutex_unlock(&index->lock);
+    }
+}
+
+static int parse_index(jobindex_data_t *data, const uint8_t *p, const uint8_t *end) {
+    uint64_t v;
+    size_t magic = strlen(JOBINDEX_MAGIC);
+    if ((size_t)(end - p) < magic || memcmp(p, JOBINDEX_MAGIC, magic) != 0) return -1;
+    p += magic;
+
+    /* Strings come as one block of NUL terminated runs */
+    if (get_varint(&p, end, &v) != 0 || v > (uint64_t)(end - p) || v > UINT32_MAX) return -1;
+    if (v > 0 && p[v - 1] != '\0') return -1;
+    data->strings = malloc(v ? v : 1);
+    if (!data->strings) return -1;
+    memcpy(data->strings, p, v);
+    data->strings_len = v;
+    data->strings_cap = v ? v : 1;
+    p += v;
+
+    if (get_varint(&p, end, &v) != 0 || v > (uint64_t)(end - p)) return -1;
+    int count = (int)v;
+    data->docs = malloc((count ? count : 1) * sizeof(jobindex_doc_t));
+    if (!data->docs) return -1;
+    data->doc_capacity = count ? count : 1;
+    int prev = 0;
+    for (int i = 0; i < count; i++) {
+        jobindex_doc_t *doc = &data->docs[i];
+        uint64_t gap, text;
+        int64_t created, completed;
+        if (get_varint(&p, end, &gap) != 0 || get_varint(&p, end, &text) != 0 ||
+            get_int(&p, end, &created) != 0 || get_int(&p, end, &completed) != 0 || p >= end) {
+            return -1;
+        }
+        /* Ids ascend, and the three strings lie inside the block */
+        if (gap == 0 || gap > INT32_MAX - (uint64_t)prev || text >= data->strings_len) return -1;
+        const char *s = data->strings + text;
+        size_t left = data->strings_len - text;
+        for (int k = 0; k < 3; k++) {
+            const char *nul = memchr(s, '\0', left);
+            if (!nul || (k < 2 && (size_t)(nul - s) + 1 >= left)) return -1;
+            left -= (size_t)(nul - s) + 1;
+            s = nul + 1;
+        }
+        doc->id = prev + (int)gap;
+        doc->text = (uint32_t)text;
+        doc->created = (time_t)created;
+        doc->completed = completed ? (time_t)(created + completed - 1) : 0;
+        doc->state = *p++;
+        if (doc->state >= STATE_COUNT) return -1;
+        prev = doc->id;
+        data->doc_count++;
+    }
+
+    if (get_varint(&p, end, &v) != 0 || v > (uint64_t)(end - p)) return -1;
+    uint64_t postings = v;
+    for (uint64_t i = 0; i < postings; i++) {
+        uint64_t key, n, last, len;
+        if (get_varint(&p, end, &key) != 0 || get_varint(&p, end, &n) != 0 ||
+            get_varint(&p, end, &last) != 0 || get_varint(&p, end, &len) != 0) {
+            return -1;
+        }
+        if (key == 0 || key > 0xffffff || n > (uint64_t)data->doc_count ||
+            last >= (uint64_t)data->doc_count || len > (uint64_t)(end - p)) {
+            return -1;
+        }
+        jobindex_posting_t *post = find_posting(data, (uint32_t)key, 1);
+        if (!post || post->count) return -1;
+        post->bytes = malloc(len ? len : 1);
+        if (!post->bytes) return -1;
+        memcpy(post->bytes, p, len);
+        post->len = post->cap = (uint32_t)len;
+        post->count = (int)n;
+        post->last = (int)last;
+        p += len;
+    }
+    return 0;
+}
+
+/* The saved index, or an empty one if there is none or it's unreadable */
+static void load_index(jobindex_data_t *data) {
+    memset(data, 0, sizeof(*data));
+    char path[1024];
+    if (state_path(path, sizeof(path), JOBINDEX_FILE) != 0) return;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return;
+
+    uint8_t *contents = NULL;
+    size_t len = 0, cap = 0;
+    for (;;) {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 1 << 20;
+            uint8_t *grown = realloc(contents, cap);
+            if (!grown) break;
+            contents = grown;
+        }
+        size_t n = fread(contents + len, 1, cap - len, fp);
+        if (n == 0) break;
+        len += n;
+    }
+    fclose(fp);
+
+    if (!contents || parse_index(data, contents, contents + len) != 0) {
+        data_free(data);
+    }
+    free(contents);
+}
+
+/* Decode a posting list into docs, which must hold p->count entries */
+static int decode_posting(const jobindex_posting_t *p, int *docs) {
+    const uint8_t *b = p->bytes;
+    const uint8_t *end = b + p->len;
+    int doc = -1, n = 0;
+    uint64_t gap;
+    while (n < p->count && get_varint(&b, end, &gap) == 0) {
+        doc += (int)gap;
+        docs[n++] = doc;
+    }
+    return n;
+}
+
+/* Keep the candidates that are in the posting list; cand is rewritten in place */
+static int intersect_posting(const jobindex_posting_t *p, int *cand, int count) {
+    const uint8_t *b = p->bytes;
+    const uint8_t *end = b + p->len;
+    int doc = -1, kept = 0, c = 0;
+    uint64_t gap;
+    while (c < count && get_varint(&b, end, &gap) == 0) {
+        doc += (int)gap;
+        while (c < count && cand[c] < doc) c++;
+        if (c < count && cand[c] == doc) cand[kept++] = cand[c++];
+    }
+    return kept;
+}
+
+/* needle is lowercase */
+static int contains_nocase(const char *hay, const char *needle) {
+    size_t n = strlen(needle);
+    if (n == 0) return 1;
+    for (; *hay; hay++) {
+        size_t i = 0;
+        while (i < n && tolower((unsigned char)hay[i]) == (unsigned char)needle[i]) i++;
+        if (i == n) return 1;
+    }
+    return 0;
+}
+
+static int compare_count(const void *a, const void *b) {
+    int x = (*(jobindex_posting_t *const *)a)->count;
+    int y = (*(jobindex_posting_t *const *)b)->count;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Narrow cand to the documents with every trigram of term. Returns the
+ * new count; *cand starts as NULL for all documents and is allocated on
+ * first use. Lists much longer than the candidates are skipped, the
+ * substring check afterwards covers them.
+ */
+static int narrow(jobindex_data_t *data, const char *term, int **cand, int count) {
+    jobindex_posting_t *lists[256];
+    int n = 0;
+    for (size_t i = 0; term[i] && term[i + 1] && term[i + 2] && n < 256; i++) {
+        jobindex_posting_t *p = find_posting(data, trigram_key(term + i), 0);
+        if (!p) return 0;
+        lists[n++] = p;
+    }
+    if (n == 0) return count;
+    qsort(lists, n, sizeof(lists[0]), compare_count);
+
+    int k = 0;
+    if (!*cand) {
+        *cand = malloc((lists[0]->count ? lists[0]->count : 1) * sizeof(int));
+        if (!*cand) return 0;
+        count = decode_posting(lists[0], *cand);
+        k = 1;
+    }
+    for (; k < n && count > 0; k++) {
+        if (lists[k]->count > count * 16) break;
+        count = intersect_posting(lists[k], *cand, count);
+    }
+    return count;
+}
+
+static void copy_result(const jobindex_data_t *data, const jobindex_doc_t *doc, job_info_t *out) {
+    const char *title = data->strings + doc->text;
+    const char *user = title + strlen(title) + 1;
+    const char *printer = user + strlen(user) + 1;
+    memset(out, 0, sizeof(*out));
+    out->id = doc->id;
+    snprintf(out->title, sizeof(out->title), "%s", title);
+    snprintf(out->user, sizeof(out->user), "%s", user);
+    snprintf(out->printer, sizeof(out->printer), "%s", printer);
+    snprintf(out->state, sizeof(out->state), "%s", state_names[doc->state]);
+    out->created = doc->created;
+    out->completed = doc->completed;
+}
+
+int jobindex_search(jobindex_t *index, const char *query, job_info_t *results, int max) {
+    char q[256];
+    snprintf(q, sizeof(q), "%s", query ? query : "");
+    for (char *c = q; *c; c++) *c = (char)tolower((unsigned char)*c);
+
+    const char *terms[JOBINDEX_MAX_TERMS];
+    int term_count = 0;
+    char *save;
+    for (char *t = strtok_r(q, " \t", &save); t && term_count < JOBINDEX_MAX_TERMS;
+         t = strtok_r(NULL, " \t", &save)) {
+        terms[term_count++] = t;
+    }
+
+    pthread_mutex_lock(&index->lock);
+    jobindex_data_t *data = &index->data;
+
+    int *cand = NULL;
+    int count = data->doc_count;
+    for (int t = 0; t < term_count && count > 0; t++) {
+        count = narrow(data, terms[t], &cand, count);
+    }
+
+    /* Check the substrings themselves, newest first, until max are found */
+    int found = 0;
+    for (int i = count - 1; i >= 0 && found < max; i--) {
+        int n = cand ? cand[i] : i;
+        if (n < 0 || n >= data->doc_count) continue;  /* Damaged saved postings */
+        const jobindex_doc_t *doc = &data->docs[n];
+        const char *title = data->strings + doc->text;
+        const char *user = title + strlen(title) + 1;
+        int match = 1;
+        for (int t = 0; t < term_count && match; t++) {
+            match = contains_nocase(title, terms[t]) || contains_nocase(user, terms[t]);
+        }
+        if (match) copy_result(data, doc, &results[found++]);
+    }
+
+    pthread_mutex_unlock(&index->lock);
+    free(cand);
+    return found;
+}
+
+static void *jobindex_thread_func(void *arg) {
+    jobindex_t *index = arg;
+
+    /* Parsed aside so searches aren't held up meanwhile */
+    jobindex_data_t loaded;
+    load_index(&loaded);
+
+    pthread_mutex_lock(&index->lock);
+    index->data = loaded;
+    index->loaded = 1;
+    index->generation++;
+    uint64_t saved_at = monotonic_ms();
+    uint64_t caught_up = 0;
+    while (index->running) {
+        pthread_mutex_unlock(&index->lock);
+
+        /* The active set comes from the broker when one runs, like the
+         * jobs panel; cupsd is only asked for all jobs when it changed */
+        job_info_t *active;
+        int count = broker_get_jobs(&active);
+        if (count < 0) {
+            count = get_jobs(&active);
+            if (count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) count = -1;
+        }
+        if (count >= 0) {
+            if (count > 0) qsort(active, count, sizeof(job_info_t), compare_jobs);
+            apply_jobs(index, active, count, 0);
+
+            uint64_t now = monotonic_ms();
+            int from = fetch_from(index, active, count, now - caught_up >= JOBINDEX_CATCHUP_MS);
+            if (from > 0) {
+                job_info_t *jobs;
+                int n = get_all_jobs(from, &jobs);
+                if (n > 0 || cupsLastError() <= IPP_STATUS_OK_CONFLICTING) {
+                    apply_jobs(index, jobs, n, from);
+                    caught_up = now;
+                }
+                free_jobs(jobs);
+            }
+        }
+        free_jobs(active);
+
+        if (monotonic_ms() - saved_at >= JOBINDEX_SAVE_MS) {
+            save_index(index);
+            saved_at = monotonic_ms();
+        }
+
+        pthread_mutex_lock(&index->lock);
+        if (!index->running) break;
+        struct timespec until = abs_deadline(JOBINDEX_POLL_MS);
+        pthread_cond_timedwait(&index->cond, &index->lock, &until);
+    }
+    pthread_mutex_unlock(&index->lock);
+    return NULL;
+}
+
+void jobindex_init(jobindex_t *index) {
+    pthread_mutex_init(&index->lock, NULL);
+    pthread_cond_init(&index->cond, NULL);
+    memset(&index->data, 0, sizeof(index->data));
+    index->loaded = 0;
+    index->dirty = 0;
+    index->generation = 0;
+    index->running = 1;
+    pthread_create(&index->thread, NULL, jobindex_thread_func, index);
+}
+
+void jobindex_shutdown(jobindex_t *index) {
+    pthread_mutex_lock(&index->lock);
+    index->running = 0;
+    pthread_cond_signal(&index->cond);
+    pthread_mutex_unlock(&index->lock);
+    pthread_join(index->thread, NULL);
+
+    save_index(index);
+    data_free(&index->data);
+    pthread_mutex_destroy(&index->lock);
+    pthread_cond_destroy(&index->cond);
+}
@@ -0,0 +1,84 @@
+#ifndef JOBINDEX_H
+#define JOBINDEX_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "cups_api.h"
+
+/*
+ * Search over every job spoolie has seen, active or finished. A
+ * background thread follows the active jobs, from the broker when one
+ * runs, and only asks cupsd for all jobs (which-jobs=all) from a given
+ * id on when that set shows a new job or loses one, or every
+ * JOBINDEX_CATCHUP_MS for jobs that came and went in between. New jobs
+ * are appended and known ones get their state updated. Titles and users
+ * are indexed by trigram as jobs are appended; each trigram's posting
+ * list is a run of varint gaps between ascending document numbers.
+ * Documents and postings are saved to JOBINDEX_FILE in the state
+ * directory and read back on start, so jobs CUPS has since dropped from
+ * its history can still be found.
+ */
+#define JOBINDEX_FILE "jobs.idx"
+#define JOBINDEX_POLL_MS 5000
+#define JOBINDEX_CATCHUP_MS 60000   /* Longest gap between asks for new jobs */
+#define JOBINDEX_SAVE_MS 60000      /* Save at most this often, and on shutdown */
+
+typedef struct {
+    int id;
+    uint32_t text;                  /* Offset of "title\0user\0printer\0" in strings */
+    time_t created;
+    time_t completed;
+    uint8_t state;                  /* Index into the job state names */
+} jobindex_doc_t;
+
+typedef struct {
+    uint32_t key;                   /* Lowercased trigram, 0 for an empty slot */
+    int count;                      /* Documents in the list */
+    int last;                       /* Last document added, the next gap is from it */
+    uint32_t len;
+    uint32_t cap;
+    uint8_t *bytes;                 /* Varint gaps, the first from -1 */
+} jobindex_posting_t;
+
+typedef struct {
+    jobindex_doc_t *docs;           /* Ascending job id; document number is the position */
+    int doc_count;
+    int doc_capacity;
+    char *strings;
+    size_t strings_len;
+    size_t strings_cap;
+    jobindex_posting_t *slots;      /* Open addressing on the trigram */
+    int slot_count;
+    int posting_count;
+} jobindex_data_t;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+
+    /* Shared, under lock */
+    jobindex_data_t data;
+    int first_active;               /* Lowest indexed job id that may still change */
+    int loaded;                     /* The saved index has been read */
+    int dirty;                      /* Changed since the last save */
+    int generation;                 /* Bumped whenever the documents change */
+} jobindex_t;
+
+/* Read the saved index and start following CUPS in the background */
+void jobindex_init(jobindex_t *index);
+
+/* Stop, save and free everything */
+void jobindex_shutdown(jobindex_t *index);
+
+/*
+ * Jobs with every whitespace separated term of query in their title or
+ * user, case-insensitively; an empty query matches all. Up to max are
+ * copied to results, newest first. Returns the number copied.
+ */
+int jobindex_search(jobindex_t *index, const char *query, job_info_t *results, int max);
+
+#endif
@@ -1,4 +1,5 @@
 #include "jobs.h"
+#include "broker.h"
 
 void job_list_init(job_list_t *list) {
     list->items = NULL;
@@ -7,10 +8,18 @@ void job_list_init(job_list_t *list) {
 }
 
 void job_list_refresh(job_list_t *list) {
+    job_info_t *items;
+    int count = broker_get_jobs(&items);
+    if (count < 0) count = get_jobs(&items);
+    job_list_set(list, items, count);
+}
+
+void job_list_set(job_list_t *list, job_info_t *items, int count) {
     if (list->items) {
         free_jobs(list->items);
     }
-    list->count = get_jobs(&list->items);
+    list->items = items;
+    list->count = count;
     if (list->selected >= list->count) {
         list->selected = list->count > 0 ? list->count - 1 : 0;
     }
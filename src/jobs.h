@@ -11,6 +11,8 @@ typedef struct {
 
 void job_list_init(job_list_t *list);
 void job_list_refresh(job_list_t *list);
+/* Show items instead, e.g. from history; the list takes ownership */
+void job_list_set(job_list_t *list, job_info_t *items, int count);
 void job_list_free(job_list_t *list);
 void job_list_move(job_list_t *list, int delta);
 
@@ -0,0 +1,251 @@
+#include "lanes.h"
+#include "util.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t lanes_stop;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    lanes_stop = 1;
+}
+
+static int add_held(lanes_t *lanes, int job_id) {
+    if (lanes->held_count >= lanes->held_capacity) {
+        int capacity = lanes->held_capacity ? lanes->held_capacity * 2 : 16;
+        int *grown = realloc(lanes->held, capacity * sizeof(int));
+        if (!grown) return -1;
+        lanes->held = grown;
+        lanes->held_capacity = capacity;
+    }
+    lanes->held[lanes->held_count++] = job_id;
+    return 0;
+}
+
+static int is_held(const lanes_t *lanes, int job_id) {
+    for (int i = 0; i < lanes->held_count; i++) {
+        if (lanes->held[i] == job_id) return 1;
+    }
+    return 0;
+}
+
+static int is_batch(const lanes_t *lanes, const char *user) {
+    for (int i = 0; i < lanes->batch_count; i++) {
+        if (strcmp(lanes->batch_users[i], user) == 0) return 1;
+    }
+    return 0;
+}
+
+static void load_held(lanes_t *lanes) {
+    char path[1024];
+    if (state_path(path, sizeof(path), LANES_STATE) != 0) return;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+
+    int id;
+    while (fscanf(fp, "%d", &id) == 1) {
+        if (id > 0 && !is_held(lanes, id)) add_held(lanes, id);
+    }
+    fclose(fp);
+}
+
+static void save_held(const lanes_t *lanes) {
+    char path[1024];
+    if (state_path(path, sizeof(path), LANES_STATE) != 0) return;
+    FILE *fp = fopen(path, "w");
+    if (!fp) return;
+    for (int i = 0; i < lanes->held_count; i++) {
+        fprintf(fp, "%d\n", lanes->held[i]);
+    }
+    fclose(fp);
+}
+
+int lanes_load(lanes_t *lanes, char *err, size_t errlen) {
+    memset(lanes, 0, sizeof(*lanes));
+    if (errlen > 0) err[0] = '\0';
+    load_held(lanes);
+
+    char path[1024];
+    if (config_path(path, sizeof(path), LANES_CONFIG) != 0) return 0;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    int capacity = 0;
+    int lineno = 0;
+    int status = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char *key = strtok(line, " \t\r\n");
+        if (!key) continue;
+
+        if (strcmp(key, "batch") == 0) {
+            char *user;
+            while ((user = strtok(NULL, " \t\r\n"))) {
+                if (lanes->batch_count >= capacity) {
+                    capacity = capacity ? capacity * 2 : 8;
+                    char (*grown)[64] = realloc(lanes->batch_users, capacity * sizeof(*grown));
+                    if (!grown) break;
+                    lanes->batch_users = grown;
+                }
+                snprintf(lanes->batch_users[lanes->batch_count++], 64, "%s", user);
+            }
+        } else {
+            snprintf(err, errlen, "%s:%d: bad setting '%s'", path, lineno, key);
+            status = -1;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return status;
+}
+
+void lanes_free(lanes_t *lanes) {
+    free(lanes->batch_users);
+    free(lanes->held);
+    memset(lanes, 0, sizeof(*lanes));
+}
+
+int lanes_plan(const lanes_t *lanes, const job_info_t *jobs, int job_count,
+               job_update_t **updates) {
+    *updates = NULL;
+    if (job_count == 0) return 0;
+
+    /* Printers with someone other than a batch user waiting */
+    const char **busy = malloc(job_count * sizeof(char *));
+    *updates = calloc(job_count, sizeof(job_update_t));
+    if (!busy || !*updates) {
+        free(busy);
+        free(*updates);
+        *updates = NULL;
+        return 0;
+    }
+    int busy_count = 0;
+    for (int i = 0; i < job_count; i++) {
+        if (strcmp(jobs[i].state, "pending") == 0 && !is_batch(lanes, jobs[i].user)) {
+            busy[busy_count++] = jobs[i].printer;
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < job_count; i++) {
+        const job_info_t *j = &jobs[i];
+        int contended = 0;
+        for (int b = 0; b < busy_count && !contended; b++) {
+            contended = strcmp(busy[b], j->printer) == 0;
+        }
+
+        job_update_t *u = &(*updates)[count];
+        u->job_id = j->id;
+        if (contended && strcmp(j->state, "pending") == 0 && is_batch(lanes, j->user)) {
+            u->action = JOB_HOLD;
+            count++;
+        } else if (!contended && strcmp(j->state, "held") == 0 && is_held(lanes, j->id)) {
+            u->action = JOB_RELEASE;
+            count++;
+        }
+    }
+
+    free(busy);
+    return count;
+}
+
+void lanes_commit(lanes_t *lanes, const job_info_t *jobs, int job_count,
+                  const job_update_t *updates, int count) {
+    for (int i = 0; i < count; i++) {
+        const job_update_t *u = &updates[i];
+        if (u->result != 0) continue;
+        if (u->action == JOB_HOLD && !is_held(lanes, u->job_id)) {
+            add_held(lanes, u->job_id);
+        } else if (u->action == JOB_RELEASE) {
+            for (int h = 0; h < lanes->held_count; h++) {
+                if (lanes->held[h] != u->job_id) continue;
+                lanes->held[h] = lanes->held[--lanes->held_count];
+                break;
+            }
+        }
+    }
+
+    /* Forget jobs that finished or were cancelled while held */
+    int kept = 0;
+    for (int h = 0; h < lanes->held_count; h++) {
+        int queued = 0;
+        for (int i = 0; i < job_count && !queued; i++) {
+            queued = jobs[i].id == lanes->held[h];
+        }
+        if (queued) lanes->held[kept++] = lanes->held[h];
+    }
+    lanes->held_count = kept;
+
+    save_held(lanes);
+}
+
+static const job_info_t *find_job(const job_info_t *jobs, int count, int job_id) {
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].id == job_id) return &jobs[i];
+    }
+    return NULL;
+}
+
+int lanes_run(int interval_ms, int dry_run) {
+    lanes_t lanes;
+    char err[1024];
+    if (lanes_load(&lanes, err, sizeof(err)) != 0) {
+        fprintf(stderr, "spoolie: %s\n", err);
+        lanes_free(&lanes);
+        return 1;
+    }
+    if (lanes.batch_count == 0) {
+        fprintf(stderr, "spoolie: no batch users in %s\n", LANES_CONFIG);
+        lanes_free(&lanes);
+        return 1;
+    }
+
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!lanes_stop) {
+        job_info_t *jobs;
+        int job_count = get_jobs(&jobs);
+
+        job_update_t *updates;
+        int count = lanes_plan(&lanes, jobs, job_count, &updates);
+        if (count > 0 && !dry_run) {
+            update_jobs(updates, count);
+            lanes_commit(&lanes, jobs, job_count, updates, count);
+        }
+        for (int i = 0; i < count; i++) {
+            const job_update_t *u = &updates[i];
+            const job_info_t *j = find_job(jobs, job_count, u->job_id);
+            const char *verb = u->action == JOB_HOLD ? "hold" : "release";
+            printf("%s%s job %d on %s (%s)\n",
+                   dry_run ? "would " : u->result == 0 ? "" : "failed to ",
+                   dry_run || u->result != 0 ? verb : u->action == JOB_HOLD ? "held" : "released",
+                   u->job_id, j ? j->printer : "?", j ? j->user : "?");
+        }
+        fflush(stdout);
+
+        free(updates);
+        free_jobs(jobs);
+
+        /* A dry run reports a single plan */
+        if (dry_run) break;
+
+        /* Sleep in short steps so a signal stops us promptly */
+        for (int slept = 0; slept < interval_ms && !lanes_stop; slept += 100) {
+            usleep(100 * 1000);
+        }
+    }
+
+    lanes_free(&lanes);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "cups_api.h"
+
+#define LANES_CONFIG "lanes.conf"
+#define LANES_STATE "lanes.held"
+
+/*
+ * Priority lanes from $XDG_CONFIG_HOME/spoolie/lanes.conf:
+ *
+ *   batch payroll-export reports    # users whose jobs give way
+ *
+ * A batch user's pending job is held while anyone else's job is pending
+ * on the same printer, and released once none are. Only jobs the rule
+ * held itself are released; their ids are kept in LANES_STATE so a
+ * restart doesn't strand them.
+ */
+typedef struct {
+    char (*batch_users)[64];
+    int batch_count;
+    int *held;
+    int held_count;
+    int held_capacity;
+} lanes_t;
+
+/* Load the config and the held set. Returns -1 on a bad line and describes
+ * it in err */
+int lanes_load(lanes_t *lanes, char *err, size_t errlen);
+void lanes_free(lanes_t *lanes);
+
+/* Holds and releases the rule wants now. Returns count; caller frees updates */
+int lanes_plan(const lanes_t *lanes, const job_info_t *jobs, int job_count,
+               job_update_t **updates);
+
+/* Record applied updates in the held set and save it. Jobs that have left
+ * the queue are forgotten */
+void lanes_commit(lanes_t *lanes, const job_info_t *jobs, int job_count,
+                  const job_update_t *updates, int count);
+
+/* --lanes: apply the rule every interval_ms without a UI. Returns exit status */
+int lanes_run(int interval_ms, int dry_run);
+
+#endif
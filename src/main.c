@@ -1,12 +1,176 @@
+#include <getopt.h>
 #include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "balance.h"
+#include "broker.h"
+#include "exporter.h"
+#include "lanes.h"
+#include "pagelog.h"
 #include "ui.h"
+#include "submit.h"
+#include "watch.h"
+
+static void usage(FILE *fp) {
+    fprintf(fp,
+        "usage: spoolie [options]\n"
+        "\n"
+        "  --watch           Run without a UI, reporting printer and job changes\n"
+        "  --ndjson          Write --watch events as newline-delimited JSON\n"
+        "  --interval SECS   Poll interval for headless modes (default 2)\n"
+        "  --submit FILE...  Print files without a UI\n"
+        "  -d, --dest NAME   Printer for --submit (default: the default printer)\n"
+        "  --balance         Move pending jobs off stopped or overloaded printers\n"
+        "  --lanes           Hold batch users' jobs while others are waiting\n"
+        "  --dry-run         Only report what --balance or --lanes would do\n"
+        "  --exporter ADDR   Serve Prometheus metrics on a localhost port or socket path\n"
+        "  --broker          Share one CUPS snapshot with every spoolie on this host\n"
+        "  --page-log PATH   CUPS page log for the usage view (default " PAGELOG_DEFAULT_PATH ")\n"
+        "  -h, --help        Show this help\n");
+}
+
+/* Name of the default destination from the printer list */
+static int default_printer(char *name, size_t len) {
+    printer_info_t *printers;
+    int count = get_printers(&printers);
+    int found = -1;
+
+    for (int i = 0; i < count; i++) {
+        if (printers[i].is_default) {
+            snprintf(name, len, "%s", printers[i].name);
+            found = 0;
+            break;
+        }
+    }
+
+    free_printers(printers);
+    return found;
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        { "watch",    no_argument,       NULL, 'w' },
+        { "ndjson",   no_argument,       NULL, 'n' },
+        { "interval", required_argument, NULL, 'i' },
+        { "submit",   no_argument,       NULL, 's' },
+        { "dest",     required_argument, NULL, 'd' },
+        { "balance",  no_argument,       NULL, 'b' },
+        { "lanes",    no_argument,       NULL, 'l' },
+        { "dry-run",  no_argument,       NULL, 'D' },
+        { "exporter", required_argument, NULL, 'e' },
+        { "broker",   no_argument,       NULL, 'B' },
+        { "page-log", required_argument, NULL, 'L' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int watch = 0;
+    int ndjson = 0;
+    int submit = 0;
+    int balance = 0;
+    int lanes = 0;
+    int dry_run = 0;
+    const char *exporter = NULL;
+    int broker = 0;
+    const char *page_log = NULL;
+    const char *dest = NULL;
+    double interval = 2;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hd:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                watch = 1;
+                break;
+            case 'n':
+                ndjson = 1;
+                break;
+            case 'i':
+                interval = atof(optarg);
+                if (interval <= 0) {
+                    fprintf(stderr, "spoolie: invalid interval '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 's':
+                submit = 1;
+                break;
+            case 'd':
+                dest = optarg;
+                break;
+            case 'b':
+                balance = 1;
+                break;
+            case 'l':
+                lanes = 1;
+                break;
+            case 'D':
+                dry_run = 1;
+                break;
+            case 'e':
+                exporter = optarg;
+                break;
+            case 'B':
+                broker = 1;
+                break;
+            case 'L':
+                page_log = optarg;
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return 2;
+        }
+    }
+
+    if (submit) {
+        if (optind >= argc) {
+            fprintf(stderr, "spoolie: --submit needs at least one file\n");
+            return 2;
+        }
+        char printer[256];
+        if (!dest) {
+            if (default_printer(printer, sizeof(printer)) != 0) {
+                fprintf(stderr, "spoolie: no default printer, use --dest\n");
+                return 2;
+            }
+            dest = printer;
+        }
+        return submit_run(dest, argv + optind, argc - optind);
+    }
+
+    if (broker) {
+        return broker_run((int)(interval * 1000));
+    }
+
+    if (exporter) {
+        return exporter_run(exporter, (int)(interval * 1000));
+    }
+
+    if (balance) {
+        return balance_run((int)(interval * 1000), dry_run);
+    }
+
+    if (lanes) {
+        return lanes_run((int)(interval * 1000), dry_run);
+    }
+
+    if (watch) {
+        /* NDJSON is the only headless format for now */
+        if (!ndjson) {
+            fprintf(stderr, "spoolie: --watch requires --ndjson\n");
+            return 2;
+        }
+        return watch_run((int)(interval * 1000));
+    }
 
-int main(void) {
     /* Enable UTF-8 */
     setlocale(LC_ALL, "");
 
     ui_state_t state;
-    ui_init(&state);
+    ui_init(&state, page_log);
 
     /* Use timeout so getch doesn't block - allows polling for async ops */
     timeout(100);
@@ -0,0 +1,619 @@
+#include "pagelog.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+static uint32_t hash_bytes(const char *s, size_t len) {
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int day_slot(int32_t day) {
+    return ((day % PAGELOG_DAYS) + PAGELOG_DAYS) % PAGELOG_DAYS;
+}
+
+/* Days since 1970-01-01 for a civil date */
+static int32_t days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/* Table */
+
+static void table_free(pagelog_table_t *t) {
+    free(t->items);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+static int table_rehash(pagelog_table_t *t, int slot_count) {
+    int *slots = malloc(slot_count * sizeof(int));
+    if (!slots) return -1;
+    for (int i = 0; i < slot_count; i++) {
+        slots[i] = -1;
+    }
+    uint32_t mask = (uint32_t)slot_count - 1;
+    for (int i = 0; i < t->count; i++) {
+        uint32_t h = hash_bytes(t->items[i].name, strlen(t->items[i].name)) & mask;
+        while (slots[h] >= 0) h = (h + 1) & mask;
+        slots[h] = i;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->slot_count = slot_count;
+    return 0;
+}
+
+/* Entry for the first len bytes of name, added if new */
+static pagelog_entry_t *table_get(pagelog_table_t *t, const char *name, size_t len) {
+    if (len >= sizeof(t->items[0].name)) len = sizeof(t->items[0].name) - 1;
+
+    if ((t->count + 1) * 4 > t->slot_count * 3 &&
+        table_rehash(t, t->slot_count ? t->slot_count * 2 : 64) != 0) {
+        return NULL;
+    }
+
+    uint32_t mask = (uint32_t)t->slot_count - 1;
+    uint32_t h = hash_bytes(name, len) & mask;
+    while (t->slots[h] >= 0) {
+        pagelog_entry_t *e = &t->items[t->slots[h]];
+        if (memcmp(e->name, name, len) == 0 && e->name[len] == '\0') return e;
+        h = (h + 1) & mask;
+    }
+
+    if (t->count >= t->capacity) {
+        int capacity = t->capacity ? t->capacity * 2 : 64;
+        pagelog_entry_t *grown = realloc(t->items, capacity * sizeof(pagelog_entry_t));
+        if (!grown) return NULL;
+        t->items = grown;
+        t->capacity = capacity;
+    }
+    pagelog_entry_t *e = &t->items[t->count];
+    memset(e, 0, sizeof(*e));
+    memcpy(e->name, name, len);
+    t->slots[h] = t->count++;
+    return e;
+}
+
+static void entry_add(pagelog_entry_t *e, int32_t day, uint32_t pages) {
+    int slot = day_slot(day);
+    e->total += pages;
+    if (e->day[slot] != day) {
+        /* Older than anything the ring still holds: only the total counts it */
+        if (e->day[slot] > day) return;
+        e->day[slot] = day;
+        e->pages[slot] = 0;
+    }
+    e->pages[slot] += pages;
+}
+
+/* Parsing */
+
+/* Next space separated field in [*p, end) */
+static int next_field(const char **p, const char *end, const char **field, size_t *len) {
+    const char *s = *p;
+    while (s < end && *s == ' ') s++;
+    const char *f = s;
+    while (s < end && *s != ' ') s++;
+    *field = f;
+    *len = (size_t)(s - f);
+    *p = s;
+    return *len > 0;
+}
+
+static int parse_uint(const char *s, size_t len, uint32_t *out) {
+    if (len == 0 || len > 9) return -1;
+    uint32_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return -1;
+        v = v * 10 + (uint32_t)(s[i] - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+/* Day number of "19/Oct/2026:10:15:01 +0200", as the date was logged */
+static int32_t parse_day(const char *s, const char *end) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    uint32_t d, y;
+    if (end - s < 11 || s[2] != '/' || s[6] != '/') return -1;
+    if (parse_uint(s, 2, &d) != 0 || parse_uint(s + 7, 4, &y) != 0) return -1;
+    for (int m = 0; m < 12; m++) {
+        if (memcmp(s + 3, months + m * 3, 3) == 0) return days_from_civil((int)y, m + 1, (int)d);
+    }
+    return -1;
+}
+
+/*
+ * One page_log line: "printer user job-id [date] page copies ...". Per page
+ * logging writes a line per page with its copy count; since CUPS 1.6 the
+ * page field is usually "total" with the job's page count in copies.
+ * Either way the copies field is the number of sheets the line accounts for.
+ */
+static int parse_line(pagelog_t *log, const char *p, const char *end) {
+    const char *printer, *user, *field;
+    size_t printer_len, user_len, len;
+
+    if (!next_field(&p, end, &printer, &printer_len) ||
+        !next_field(&p, end, &user, &user_len) ||
+        !next_field(&p, end, &field, &len)) {
+        return -1;
+    }
+
+    while (p < end && *p == ' ') p++;
+    if (p == end || *p != '[') return -1;
+    const char *close = memchr(p, ']', (size_t)(end - p));
+    if (!close) return -1;
+    int32_t day = parse_day(p + 1, close);
+    if (day < 0) return -1;
+    p = close + 1;
+
+    uint32_t page, pages;
+    if (!next_field(&p, end, &field, &len)) return -1;
+    if (!(len == 5 && memcmp(field, "total", 5) == 0) && parse_uint(field, len, &page) != 0) {
+        return -1;
+    }
+    if (!next_field(&p, end, &field, &len) || parse_uint(field, len, &pages) != 0) return -1;
+
+    pagelog_entry_t *e = table_get(&log->printers, printer, printer_len);
+    if (e) entry_add(e, day, pages);
+    e = table_get(&log->users, user, user_len);
+    if (e) entry_add(e, day, pages);
+    return 0;
+}
+
+/*
+ * Read and parse the next window of complete lines. Returns 1 if more of
+ * the file is waiting, 0 when at most a partial line is left, -1 on error.
+ * The window is copied with pread() rather than mapped: a log truncated
+ * in place (logrotate's copytruncate) would fault a mapping, while a
+ * short read just ends the window early and follow() starts over.
+ */
+static int parse_window(pagelog_t *log, off_t size) {
+    off_t offset = log->offset;
+    size_t span = size - offset > PAGELOG_WINDOW ? PAGELOG_WINDOW : (size_t)(size - offset);
+
+    char *buf = malloc(span);
+    if (!buf) return -1;
+    size_t got = 0;
+    while (got < span) {
+        ssize_t n = pread(log->fd, buf + got, span - got, offset + (off_t)got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    int more = got == span && offset + (off_t)span < size;
+
+    const char *start = buf;
+    const char *last = buf + got;
+    while (last > start && last[-1] != '\n') last--;
+
+    pthread_mutex_lock(&log->lock);
+    if (last == start) {
+        /* A line longer than a whole window is not a page_log line; skip it */
+        if (more) {
+            log->offset = offset + (off_t)span;
+            log->malformed++;
+        }
+    } else {
+        for (const char *p = start; p < last;) {
+            const char *nl = memchr(p, '\n', (size_t)(last - p));
+            if (nl > p && parse_line(log, p, nl) != 0) log->malformed++;
+            p = nl + 1;
+        }
+        log->offset = offset + (last - start);
+        log->generation++;
+    }
+    log->size = size;
+    pthread_mutex_unlock(&log->lock);
+
+    free(buf);
+    return more;
+}
+
+/* Following the file */
+
+static void set_error(pagelog_t *log, const char *what, const char *why) {
+    pthread_mutex_lock(&log->lock);
+    snprintf(log->error, sizeof(log->error), "%.128s: %s", what, why);
+    pthread_mutex_unlock(&log->lock);
+}
+
+static void set_offset(pagelog_t *log, off_t offset) {
+    pthread_mutex_lock(&log->lock);
+    log->offset = offset;
+    log->error[0] = '\0';
+    pthread_mutex_unlock(&log->lock);
+}
+
+static int open_log(pagelog_t *log, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (log->fd >= 0) close(log->fd);
+    log->fd = fd;
+    log->dev = st.st_dev;
+    log->ino = st.st_ino;
+    /* Different file, so the checkpoint is stale even at an equal offset */
+    log->saved_offset = -1;
+    return 0;
+}
+
+/* Hash of the leading bytes, which tell one log file from the next */
+static int fingerprint(int fd, off_t offset, uint32_t *hash) {
+    char buf[PAGELOG_FINGERPRINT];
+    size_t len = offset < (off_t)sizeof(buf) ? (size_t)offset : sizeof(buf);
+    if (pread(fd, buf, len, 0) != (ssize_t)len) return -1;
+    *hash = hash_bytes(buf, len);
+    return (int)len;
+}
+
+/* Read whatever was appended. Returns 1 if there is more to read right away */
+static int follow(pagelog_t *log) {
+    if (log->fd < 0) {
+        if (open_log(log, log->path) != 0) {
+            set_error(log, log->path, strerror(errno));
+            return 0;
+        }
+        set_offset(log, 0);
+    }
+
+    struct stat st;
+    if (fstat(log->fd, &st) != 0) return 0;
+    if (st.st_size < log->offset) {
+        /* Truncated in place; what was there has been counted */
+        set_offset(log, 0);
+    }
+    if (st.st_size > log->offset) {
+        int more = parse_window(log, st.st_size);
+        if (more < 0) set_error(log, "read", strerror(errno));
+        if (more != 0) return more > 0;
+    }
+
+    /* Caught up. If the path names another file now, the log was rotated */
+    struct stat current;
+    if (stat(log->path, &current) == 0 &&
+        (current.st_dev != log->dev || current.st_ino != log->ino) &&
+        open_log(log, log->path) == 0) {
+        set_offset(log, 0);
+        return 1;
+    }
+    return 0;
+}
+
+/* Checkpoint */
+
+static void write_table(FILE *fp, const char *kind, const pagelog_table_t *t) {
+    for (int i = 0; i < t->count; i++) {
+        const pagelog_entry_t *e = &t->items[i];
+        fprintf(fp, "%s %s %llu", kind, e->name, (unsigned long long)e->total);
+        for (int s = 0; s < PAGELOG_DAYS; s++) {
+            if (e->pages[s]) fprintf(fp, " %d:%u", (int)e->day[s], (unsigned)e->pages[s]);
+        }
+        fputc('\n', fp);
+    }
+}
+
+/* Only this thread changes the aggregates, so it can read them unlocked.
+ * Written under a unique name and renamed, since several instances may
+ * checkpoint at once */
+static void save_checkpoint(pagelog_t *log) {
+    char path[1024], tmp[1040];
+    uint32_t hash;
+    int hash_len;
+    if (log->fd < 0 || state_path(path, sizeof(path), PAGELOG_CHECKPOINT) != 0) return;
+    if ((hash_len = fingerprint(log->fd, log->offset, &hash)) < 0) return;
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) return;
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    fprintf(fp, "spoolie-pagelog 1\npath %s\nfile %lld %d %u\n", log->path,
+            (long long)log->offset, hash_len, (unsigned)hash);
+    write_table(fp, "printer", &log->printers);
+    write_table(fp, "user", &log->users);
+    fputs("end\n", fp);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+    log->saved_offset = log->offset;
+}
+
+static int load_checkpoint(pagelog_t *log, off_t *offset, uint32_t *hash, int *hash_len) {
+    char path[1024];
+    if (state_path(path, sizeof(path), PAGELOG_CHECKPOINT) != 0) return -1;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    char line[4096];
+    long long off = 0;
+    unsigned h = 0;
+    int ok = fgets(line, sizeof(line), fp) && strcmp(line, "spoolie-pagelog 1\n") == 0;
+    ok = ok && fgets(line, sizeof(line), fp) && strncmp(line, "path ", 5) == 0;
+    if (ok) {
+        line[strcspn(line, "\n")] = '\0';
+        /* Counts for some other log are no use */
+        ok = strcmp(line + 5, log->path) == 0;
+    }
+    ok = ok && fgets(line, sizeof(line), fp) &&
+         sscanf(line, "file %lld %d %u", &off, hash_len, &h) == 3;
+
+    /* Anything malformed, or a missing end line, discards the whole file */
+    int ended = 0;
+    pthread_mutex_lock(&log->lock);
+    while (ok && !ended && fgets(line, sizeof(line), fp)) {
+        if (strcmp(line, "end\n") == 0) {
+            ended = 1;
+            break;
+        }
+        char *save;
+        char *kind = strtok_r(line, " \n", &save);
+        char *name = strtok_r(NULL, " \n", &save);
+        char *total = strtok_r(NULL, " \n", &save);
+        pagelog_table_t *t = NULL;
+        if (kind && strcmp(kind, "printer") == 0) t = &log->printers;
+        if (kind && strcmp(kind, "user") == 0) t = &log->users;
+
+        char *rest = NULL;
+        unsigned long long sum = total ? strtoull(total, &rest, 10) : 0;
+        pagelog_entry_t *e = t && name && rest && rest != total && *rest == '\0'
+                           ? table_get(t, name, strlen(name)) : NULL;
+        if (!e) {
+            ok = 0;
+            break;
+        }
+        e->total = sum;
+        for (char *tok; ok && (tok = strtok_r(NULL, " \n", &save));) {
+            int day, used = 0;
+            unsigned pages;
+            if (sscanf(tok, "%d:%u%n", &day, &pages, &used) != 2 || tok[used] != '\0') {
+                ok = 0;
+                break;
+            }
+            e->day[day_slot(day)] = day;
+            e->pages[day_slot(day)] = pages;
+        }
+    }
+    ok = ok && ended;
+    if (!ok) {
+        table_free(&log->printers);
+        table_free(&log->users);
+    }
+    log->generation++;
+    pthread_mutex_unlock(&log->lock);
+    fclose(fp);
+
+    *offset = (off_t)off;
+    *hash = h;
+    return ok ? 0 : -1;
+}
+
+/* Pick up from the checkpoint, in the rotated file if the log moved on */
+static void resume(pagelog_t *log) {
+    static const char *suffixes[] = { "", ".O", ".1" };
+    off_t offset;
+    uint32_t hash, current = 0;
+    int hash_len;
+
+    if (load_checkpoint(log, &offset, &hash, &hash_len) == 0) {
+        for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+            char path[1100];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s%s", log->path, suffixes[i]);
+            if (open_log(log, path) != 0) continue;
+            if (fstat(log->fd, &st) == 0 && st.st_size >= offset &&
+                fingerprint(log->fd, offset, &current) == hash_len && current == hash) {
+                set_offset(log, offset);
+                log->saved_offset = offset;
+                return;
+            }
+        }
+        /* Rotated out of reach: start the current file from the top */
+    }
+
+    if (log->fd >= 0) {
+        close(log->fd);
+        log->fd = -1;
+    }
+}
+
+#ifdef __linux__
+/* Watch the directory, which also sees the log being renamed or recreated */
+static int watch_open(pagelog_t *log) {
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", log->path);
+    char *slash = strrchr(dir, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else if (slash == dir) dir[1] = '\0';
+    else *slash = '\0';
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return -1;
+    if (inotify_add_watch(fd, dir, IN_MODIFY | IN_CREATE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Events only say "look again"; other logs in the directory are harmless */
+static void watch_drain(int fd) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+}
+#else
+static int watch_open(pagelog_t *log) {
+    (void)log;
+    return -1;
+}
+
+static void watch_drain(int fd) {
+    (void)fd;
+}
+#endif
+
+static void *pagelog_thread_func(void *arg) {
+    pagelog_t *log = arg;
+    int notify = watch_open(log);
+    uint64_t saved = monotonic_ms();
+    int catching_up = 1;
+
+    resume(log);
+    for (;;) {
+        int more = follow(log);
+        pthread_mutex_lock(&log->lock);
+        log->catching_up = more;
+        pthread_mutex_unlock(&log->lock);
+
+        /* Save as soon as the backlog is done, otherwise at most every PAGELOG_SAVE_MS */
+        uint64_t now = monotonic_ms();
+        int dirty = log->offset != log->saved_offset;
+        if (dirty && ((catching_up && !more) || now - saved >= PAGELOG_SAVE_MS)) {
+            save_checkpoint(log);
+            saved = now;
+            dirty = 0;
+        }
+        catching_up = more;
+
+        int timeout = notify >= 0 ? PAGELOG_IDLE_MS : PAGELOG_POLL_MS;
+        if (more) {
+            timeout = 0;
+        } else if (dirty && saved + PAGELOG_SAVE_MS - now < (uint64_t)timeout) {
+            timeout = (int)(saved + PAGELOG_SAVE_MS - now);
+        }
+
+        struct pollfd pfds[2] = {
+            { .fd = log->wake[0], .events = POLLIN },
+            { .fd = notify, .events = POLLIN },
+        };
+        if (poll(pfds, notify >= 0 ? 2 : 1, timeout) < 0 && errno != EINTR) break;
+        if (pfds[0].revents) break;
+        if (notify >= 0 && pfds[1].revents) watch_drain(notify);
+    }
+
+    if (log->offset != log->saved_offset) save_checkpoint(log);
+    if (notify >= 0) close(notify);
+    return NULL;
+}
+
+void pagelog_init(pagelog_t *log, const char *path) {
+    memset(log, 0, sizeof(*log));
+    snprintf(log->path, sizeof(log->path), "%s", path ? path : PAGELOG_DEFAULT_PATH);
+    log->fd = -1;
+    log->wake[0] = log->wake[1] = -1;
+    log->saved_offset = -1;
+    pthread_mutex_init(&log->lock, NULL);
+}
+
+void pagelog_start(pagelog_t *log) {
+    if (log->started) return;
+    if (pipe(log->wake) != 0) {
+        set_error(log, "pipe", strerror(errno));
+        return;
+    }
+    fcntl(log->wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(log->wake[1], F_SETFD, FD_CLOEXEC);
+
+    log->catching_up = 1;
+    if (pthread_create(&log->thread, NULL, pagelog_thread_func, log) != 0) {
+        close(log->wake[0]);
+        close(log->wake[1]);
+        return;
+    }
+    log->started = 1;
+}
+
+void pagelog_shutdown(pagelog_t *log) {
+    if (log->started) {
+        ssize_t n = write(log->wake[1], "", 1);
+        (void)n;
+        pthread_join(log->thread, NULL);
+        close(log->wake[0]);
+        close(log->wake[1]);
+        log->started = 0;
+    }
+    if (log->fd >= 0) close(log->fd);
+    log->fd = -1;
+
+    table_free(&log->printers);
+    table_free(&log->users);
+    pthread_mutex_destroy(&log->lock);
+}
+
+static int cmp_rows(const void *a, const void *b) {
+    const pagelog_row_t *x = a, *y = b;
+    if (x->month != y->month) return x->month < y->month ? 1 : -1;
+    if (x->total != y->total) return x->total < y->total ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+int pagelog_rows(pagelog_t *log, pagelog_kind_t kind, pagelog_row_t **rows) {
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    int32_t today = days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+
+    pthread_mutex_lock(&log->lock);
+    pagelog_table_t *t = kind == PAGELOG_USERS ? &log->users : &log->printers;
+    int count = t->count;
+    *rows = malloc((count ? count : 1) * sizeof(pagelog_row_t));
+    if (!*rows) {
+        pthread_mutex_unlock(&log->lock);
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const pagelog_entry_t *e = &t->items[i];
+        pagelog_row_t *r = &(*rows)[i];
+        memcpy(r->name, e->name, sizeof(r->name));
+        r->total = e->total;
+        r->today = r->week = r->month = 0;
+        for (int s = 0; s < PAGELOG_DAYS; s++) {
+            int32_t age = today - e->day[s];
+            if (!e->pages[s] || age < 0) continue;
+            if (age == 0) r->today += e->pages[s];
+            if (age < 7) r->week += e->pages[s];
+            if (age < 30) r->month += e->pages[s];
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    qsort(*rows, count, sizeof(pagelog_row_t), cmp_rows);
+    return count;
+}
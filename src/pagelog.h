@@ -0,0 +1,91 @@
+#ifndef PAGELOG_H
+#define PAGELOG_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Page accounting from CUPS' page_log. The log is read in windows and
+ * parsed once, then tailed from the last offset as it grows (inotify on
+ * Linux, stat() polling elsewhere). The offset, the identity of the file
+ * it belongs to and the aggregates are checkpointed in the state
+ * directory, so a restart only reads what was appended since.
+ */
+#define PAGELOG_DEFAULT_PATH "/var/log/cups/page_log"
+#define PAGELOG_CHECKPOINT "pagelog.state"
+#define PAGELOG_DAYS 32             /* Daily buckets kept per printer and user */
+#define PAGELOG_WINDOW (16 << 20)   /* Bytes read and parsed per lock hold */
+#define PAGELOG_SAVE_MS 10000       /* Checkpoint at most this often */
+#define PAGELOG_POLL_MS 2000        /* Without inotify */
+#define PAGELOG_IDLE_MS 30000       /* With inotify, in case an event is missed */
+#define PAGELOG_FINGERPRINT 512     /* Leading bytes that identify a log file */
+
+typedef enum {
+    PAGELOG_PRINTERS,
+    PAGELOG_USERS
+} pagelog_kind_t;
+
+typedef struct {
+    char name[256];
+    uint64_t total;                 /* All time, since the first parse */
+    uint32_t pages[PAGELOG_DAYS];   /* Ring indexed by day number */
+    int32_t day[PAGELOG_DAYS];      /* Day each slot currently counts */
+} pagelog_entry_t;
+
+typedef struct {
+    pagelog_entry_t *items;
+    int count;
+    int capacity;
+    int *slots;                     /* Open addressing over items, -1 when empty */
+    int slot_count;
+} pagelog_table_t;
+
+/* Aggregates for one printer or user, relative to today */
+typedef struct {
+    char name[256];
+    uint64_t total;
+    uint32_t today;
+    uint32_t week;
+    uint32_t month;
+} pagelog_row_t;
+
+typedef struct {
+    char path[1024];
+    pthread_t thread;
+    int started;
+    int wake[2];                    /* Written to stop the thread */
+
+    /* Only touched by the thread */
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    off_t saved_offset;
+    ino_t saved_ino;
+
+    /* Shared, under lock */
+    pthread_mutex_t lock;
+    pagelog_table_t printers;
+    pagelog_table_t users;
+    off_t offset;                   /* End of the last complete line parsed */
+    off_t size;
+    int catching_up;
+    uint64_t malformed;
+    int generation;                 /* Bumped whenever the aggregates change */
+    char error[256];
+} pagelog_t;
+
+/* Set up without reading anything; path NULL means PAGELOG_DEFAULT_PATH */
+void pagelog_init(pagelog_t *log, const char *path);
+
+/* Start reading and following the log. Does nothing if already started */
+void pagelog_start(pagelog_t *log);
+
+/* Stop following, checkpoint and free everything */
+void pagelog_shutdown(pagelog_t *log);
+
+/* Aggregates for every printer or user, busiest over 30 days first.
+ * Returns the count; the caller frees *rows. */
+int pagelog_rows(pagelog_t *log, pagelog_kind_t kind, pagelog_row_t **rows);
+
+#endif
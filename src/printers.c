@@ -1,18 +1,102 @@
 #include "printers.h"
+#include "broker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void printer_list_init(printer_list_t *list) {
     list->items = NULL;
     list->count = 0;
+    list->view = NULL;
+    list->view_count = 0;
     list->selected = 0;
+    list->scroll = 0;
+    list->page = 0;
+    list->generation = 0;
+    list->filter[0] = '\0';
+    trigram_init(&list->index);
+}
+
+static void build_index(printer_list_t *list) {
+    char **texts = calloc(list->count ? list->count : 1, sizeof(char *));
+    if (!texts) return;
+
+    for (int i = 0; i < list->count; i++) {
+        printer_info_t *p = &list->items[i];
+        size_t len = strlen(p->name) + strlen(p->location) + strlen(p->make_model) + 3;
+        texts[i] = malloc(len);
+        if (texts[i]) snprintf(texts[i], len, "%s\n%s\n%s", p->name, p->location, p->make_model);
+    }
+    trigram_build(&list->index, (const char *const *)texts, list->count);
+
+    for (int i = 0; i < list->count; i++) {
+        free(texts[i]);
+    }
+    free(texts);
+}
+
+/* Keep the selection on the same printer when the view changes */
+static void reselect(printer_list_t *list, int item) {
+    list->selected = 0;
+    for (int i = 0; i < list->view_count; i++) {
+        if (list->view[i] == item) {
+            list->selected = i;
+            break;
+        }
+    }
+}
+
+static void apply_filter(printer_list_t *list, int narrow) {
+    printer_info_t *current = printer_list_current(list);
+    int item = current ? (int)(current - list->items) : -1;
+
+    if (narrow) {
+        list->view_count = trigram_query(&list->index, list->filter, list->view,
+                                         list->view_count, list->view);
+    } else {
+        list->view_count = trigram_query(&list->index, list->filter, NULL, 0, list->view);
+    }
+    reselect(list, item);
 }
 
 void printer_list_refresh(printer_list_t *list) {
+    printer_info_t *items;
+    /* A running broker saves every instance asking cupsd */
+    int count = broker_get_printers(&items);
+    if (count < 0) count = get_printers(&items);
+    printer_list_set(list, items, count);
+    list->generation++;
+}
+
+void printer_list_set(printer_list_t *list, printer_info_t *items, int count) {
+    /* Remember the selection by name, the items are about to be replaced */
+    char name[256] = "";
+    printer_info_t *current = printer_list_current(list);
+    if (current) snprintf(name, sizeof(name), "%s", current->name);
+
     if (list->items) {
         free_printers(list->items);
     }
-    list->count = get_printers(&list->items);
-    if (list->selected >= list->count) {
-        list->selected = list->count > 0 ? list->count - 1 : 0;
+    list->items = items;
+    list->count = count;
+
+    free(list->view);
+    list->view = malloc((list->count ? list->count : 1) * sizeof(int));
+    list->view_count = 0;
+    build_index(list);
+    if (list->view) {
+        list->view_count = trigram_query(&list->index, list->filter, NULL, 0, list->view);
+    }
+
+    int item = -1;
+    for (int i = 0; i < list->count; i++) {
+        if (strcmp(list->items[i].name, name) == 0) item = i;
+    }
+    int selected = list->selected;
+    reselect(list, item);
+    if (item < 0) {
+        list->selected = selected < list->view_count ? selected : list->view_count - 1;
+        if (list->selected < 0) list->selected = 0;
     }
 }
 
@@ -21,12 +105,41 @@ void printer_list_free(printer_list_t *list) {
         free_printers(list->items);
         list->items = NULL;
     }
+    free(list->view);
+    list->view = NULL;
+    list->view_count = 0;
+    trigram_free(&list->index);
     list->count = 0;
     list->selected = 0;
+    list->scroll = 0;
 }
 
 void printer_list_move(printer_list_t *list, int delta) {
     list->selected += delta;
+    if (list->selected >= list->view_count) list->selected = list->view_count - 1;
     if (list->selected < 0) list->selected = 0;
-    if (list->selected >= list->count) list->selected = list->count - 1;
+}
+
+void printer_list_filter(printer_list_t *list, const char *filter) {
+    if (!list->view) return;
+
+    /* Typing more of the same query can only remove matches */
+    size_t old_len = strlen(list->filter);
+    int narrow = old_len > 0 && strncmp(filter, list->filter, old_len) == 0;
+
+    snprintf(list->filter, sizeof(list->filter), "%s", filter);
+    apply_filter(list, narrow);
+}
+
+void printer_list_scroll(printer_list_t *list, int rows) {
+    list->page = rows;
+    if (list->selected < list->scroll) list->scroll = list->selected;
+    if (rows > 0 && list->selected >= list->scroll + rows) list->scroll = list->selected - rows + 1;
+    if (list->scroll > list->view_count - rows) list->scroll = list->view_count - rows;
+    if (list->scroll < 0) list->scroll = 0;
+}
+
+printer_info_t *printer_list_current(printer_list_t *list) {
+    if (list->selected < 0 || list->selected >= list->view_count) return NULL;
+    return &list->items[list->view[list->selected]];
 }
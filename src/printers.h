@@ -2,16 +2,30 @@
 #define PRINTERS_H
 
 #include "cups_api.h"
+#include "trigram.h"
 
 typedef struct {
     printer_info_t *items;
     int count;
-    int selected;
+    int *view;              /* Indices into items that match the filter */
+    int view_count;
+    int selected;           /* Position in view */
+    int scroll;             /* First visible position in view */
+    int page;               /* Rows shown at the last draw */
+    int generation;         /* Bumped by each refresh */
+    char filter[256];
+    trigram_index_t index;  /* Name, location and make/model of each item */
 } printer_list_t;
 
 void printer_list_init(printer_list_t *list);
 void printer_list_refresh(printer_list_t *list);
+/* Show items instead, e.g. from history; the list takes ownership. Doesn't
+ * bump the generation */
+void printer_list_set(printer_list_t *list, printer_info_t *items, int count);
 void printer_list_free(printer_list_t *list);
 void printer_list_move(printer_list_t *list, int delta);
+void printer_list_filter(printer_list_t *list, const char *filter);
+void printer_list_scroll(printer_list_t *list, int rows);
+printer_info_t *printer_list_current(printer_list_t *list);
 
 #endif
@@ -0,0 +1,393 @@
+#include "scan.h"
+#include "util.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SCAN_RESPONSE_MIN 4096          /* First response buffer, doubled as needed */
+#define SCAN_RESPONSE_MAX (256 * 1024)  /* Ample for the attributes asked for */
+#define SCAN_IPP_RESOURCE "/ipp/print"
+
+static const int scan_ports[] = { 631, 9100 };
+#define SCAN_PORTS (int)(sizeof(scan_ports) / sizeof(scan_ports[0]))
+
+typedef enum {
+    PROBE_FREE,
+    PROBE_CONNECTING,
+    PROBE_SENDING,          /* IPP request going out */
+    PROBE_RECEIVING         /* IPP response coming in */
+} probe_state_t;
+
+typedef struct {
+    probe_state_t state;
+    int fd;
+    uint32_t addr;
+    int port;
+    uint64_t deadline;
+    char *buf;              /* Request while sending, response while receiving */
+    size_t len;
+    size_t cap;             /* Of the response buffer */
+    size_t off;
+} probe_t;
+
+/* Memory source and sink for ippReadIO/ippWriteIO */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t off;
+} membuf_t;
+
+static ssize_t mem_write(void *ctx, ipp_uchar_t *buffer, size_t bytes) {
+    membuf_t *m = ctx;
+    if (m->len + bytes > m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 1024;
+        while (cap < m->len + bytes) cap *= 2;
+        char *data = realloc(m->data, cap);
+        if (!data) return -1;
+        m->data = data;
+        m->cap = cap;
+    }
+    memcpy(m->data + m->len, buffer, bytes);
+    m->len += bytes;
+    return (ssize_t)bytes;
+}
+
+static ssize_t mem_read(void *ctx, ipp_uchar_t *buffer, size_t bytes) {
+    membuf_t *m = ctx;
+    size_t n = m->len - m->off;
+    if (n > bytes) n = bytes;
+    memcpy(buffer, m->data + m->off, n);
+    m->off += n;
+    return (ssize_t)n;
+}
+
+int scan_parse_cidr(const char *cidr, uint32_t *first, uint32_t *count) {
+    char addr_str[64];
+    int prefix = 32;
+
+    const char *slash = strchr(cidr, '/');
+    size_t n = slash ? (size_t)(slash - cidr) : strlen(cidr);
+    if (n >= sizeof(addr_str)) return -1;
+    memcpy(addr_str, cidr, n);
+    addr_str[n] = '\0';
+
+    if (slash) {
+        char *end;
+        long p = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || p < SCAN_MIN_PREFIX || p > 32) return -1;
+        prefix = (int)p;
+    }
+
+    struct in_addr in;
+    if (inet_pton(AF_INET, addr_str, &in) != 1) return -1;
+
+    uint32_t mask = prefix == 0 ? 0 : 0xffffffffu << (32 - prefix);
+    uint32_t network = ntohl(in.s_addr) & mask;
+    uint32_t size = ~mask + 1;
+
+    /* Network and broadcast addresses only exist below /31 */
+    if (prefix <= 30) {
+        *first = network + 1;
+        *count = size - 2;
+    } else {
+        *first = network;
+        *count = size;
+    }
+    return 0;
+}
+
+static void addr_string(uint32_t addr, char *buf, size_t len) {
+    struct in_addr in = { .s_addr = htonl(addr) };
+    inet_ntop(AF_INET, &in, buf, len);
+}
+
+static void probe_close(probe_t *p) {
+    if (p->fd >= 0) close(p->fd);
+    free(p->buf);
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    p->state = PROBE_FREE;
+}
+
+static void report_raw(probe_t *p, const scan_sink_t *sink) {
+    discovered_t device;
+    memset(&device, 0, sizeof(device));
+    addr_string(p->addr, device.host, sizeof(device.host));
+    snprintf(device.uri, sizeof(device.uri), "socket://%s:%d", device.host, p->port);
+    snprintf(device.info, sizeof(device.info), "Raw socket on port %d", p->port);
+    sink->found(sink->ctx, &device);
+}
+
+/* Queue a Get-Printer-Attributes request over the connected socket */
+static int start_ipp(probe_t *p) {
+    char host[64], uri[256];
+    addr_string(p->addr, host, sizeof(host));
+    snprintf(uri, sizeof(uri), "ipp://%s:%d%s", host, p->port, SCAN_IPP_RESOURCE);
+
+    static const char *attrs[] = {
+        "printer-make-and-model", "printer-info", "printer-location"
+    };
+    ipp_t *request = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+    ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes",
+                  sizeof(attrs) / sizeof(attrs[0]), NULL, attrs);
+
+    membuf_t body = {0};
+    ipp_state_t state = ippWriteIO(&body, mem_write, 1, NULL, request);
+    ippDelete(request);
+    if (state != IPP_STATE_DATA) {
+        free(body.data);
+        return -1;
+    }
+
+    /* HTTP/1.0 keeps the response unchunked and ends it with a close */
+    char head[512];
+    int head_len = snprintf(head, sizeof(head),
+                            "POST %s HTTP/1.0\r\n"
+                            "Host: %s:%d\r\n"
+                            "Content-Type: application/ipp\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n\r\n",
+                            SCAN_IPP_RESOURCE, host, p->port, body.len);
+
+    p->buf = malloc(head_len + body.len);
+    if (!p->buf) {
+        free(body.data);
+        return -1;
+    }
+    memcpy(p->buf, head, head_len);
+    memcpy(p->buf + head_len, body.data, body.len);
+    p->len = head_len + body.len;
+    p->off = 0;
+    free(body.data);
+
+    p->state = PROBE_SENDING;
+    p->deadline = monotonic_ms() + SCAN_IPP_MS;
+    return 0;
+}
+
+static void copy_attr(ipp_t *response, const char *name, char *dst, size_t len) {
+    ipp_attribute_t *attr = ippFindAttribute(response, name, IPP_TAG_ZERO);
+    const char *value = attr ? ippGetString(attr, 0, NULL) : NULL;
+    if (value) snprintf(dst, len, "%s", value);
+}
+
+/* Start of the HTTP body in the response so far, or NULL */
+static char *response_body(const probe_t *p) {
+    for (size_t i = 0; i + 3 < p->len; i++) {
+        if (memcmp(p->buf + i, "\r\n\r\n", 4) == 0) return p->buf + i + 4;
+    }
+    return NULL;
+}
+
+/* Report the host if the response is a successful IPP reply */
+static void finish_ipp(probe_t *p, const scan_sink_t *sink) {
+    char *end = response_body(p);
+    if (!end || p->len < 12 || strncmp(p->buf, "HTTP/1.", 7) != 0 ||
+        strncmp(p->buf + 8, " 200", 4) != 0) {
+        return;
+    }
+
+    membuf_t body = { .data = end, .len = p->len - (size_t)(end - p->buf) };
+    ipp_t *response = ippNew();
+    ipp_state_t state;
+    while ((state = ippReadIO(&body, mem_read, 1, NULL, response)) != IPP_STATE_DATA) {
+        if (state == IPP_STATE_ERROR || body.off == body.len) break;
+    }
+
+    if (state == IPP_STATE_DATA && ippGetStatusCode(response) <= IPP_STATUS_OK_CONFLICTING) {
+        discovered_t device;
+        memset(&device, 0, sizeof(device));
+        addr_string(p->addr, device.host, sizeof(device.host));
+        snprintf(device.uri, sizeof(device.uri), "ipp://%s%s", device.host, SCAN_IPP_RESOURCE);
+        copy_attr(response, "printer-make-and-model", device.make_model, sizeof(device.make_model));
+        copy_attr(response, "printer-info", device.info, sizeof(device.info));
+        copy_attr(response, "printer-location", device.location, sizeof(device.location));
+        sink->found(sink->ctx, &device);
+    }
+    ippDelete(response);
+}
+
+/* A response is complete once Content-Length bytes follow the head */
+static int response_complete(const probe_t *p) {
+    const char *end = response_body(p);
+    if (!end) return 0;
+
+    const char *line = p->buf;
+    while (line < end) {
+        if (end - line > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+            size_t want = strtoul(line + 15, NULL, 10);
+            return p->len - (size_t)(end - p->buf) >= want;
+        }
+        const char *nl = memchr(line, '\n', end - line);
+        if (!nl) break;
+        line = nl + 1;
+    }
+    return 0;
+}
+
+/* Connected: raw ports are a hit right away, IPP needs a real answer */
+static void connected(probe_t *p, const scan_sink_t *sink) {
+    if (p->port == 631) {
+        if (start_ipp(p) == 0) return;
+    } else {
+        report_raw(p, sink);
+    }
+    probe_close(p);
+}
+
+static void probe_start(probe_t *p, uint32_t addr, int port, const scan_sink_t *sink) {
+    p->addr = addr;
+    p->port = port;
+    p->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (p->fd < 0) return;
+    fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) | O_NONBLOCK);
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((unsigned short)port);
+    sa.sin_addr.s_addr = htonl(addr);
+
+    p->state = PROBE_CONNECTING;
+    p->deadline = monotonic_ms() + SCAN_CONNECT_MS;
+    if (connect(p->fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+        connected(p, sink);
+    } else if (errno != EINPROGRESS) {
+        probe_close(p);
+    }
+}
+
+static void probe_io(probe_t *p, const scan_sink_t *sink) {
+    switch (p->state) {
+        case PROBE_CONNECTING: {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+                probe_close(p);
+            } else {
+                connected(p, sink);
+            }
+            break;
+        }
+        case PROBE_SENDING: {
+            ssize_t n = write(p->fd, p->buf + p->off, p->len - p->off);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) probe_close(p);
+                break;
+            }
+            p->off += n;
+            if (p->off == p->len) {
+                /* The request buffer is dropped; the response gets its own */
+                free(p->buf);
+                p->buf = NULL;
+                p->len = 0;
+                p->cap = 0;
+                p->state = PROBE_RECEIVING;
+            }
+            break;
+        }
+        case PROBE_RECEIVING: {
+            if (p->len == p->cap) {
+                size_t cap = p->cap ? p->cap * 2 : SCAN_RESPONSE_MIN;
+                char *grown = realloc(p->buf, cap);
+                if (!grown) {
+                    probe_close(p);
+                    break;
+                }
+                p->buf = grown;
+                p->cap = cap;
+            }
+            ssize_t n = read(p->fd, p->buf + p->len, p->cap - p->len);
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) break;
+            if (n > 0) p->len += n;
+            if (n <= 0 || p->len == SCAN_RESPONSE_MAX || response_complete(p)) {
+                if (n >= 0) finish_ipp(p, sink);
+                probe_close(p);
+            }
+            break;
+        }
+        case PROBE_FREE:
+            break;
+    }
+}
+
+void scan_range(uint32_t first, uint32_t count, const scan_sink_t *sink) {
+    /* Leave descriptors for the rest of the program */
+    int concurrency = SCAN_CONCURRENCY;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        (rlim_t)concurrency > rl.rlim_cur / 2) {
+        concurrency = (int)(rl.rlim_cur / 2);
+    }
+    if (concurrency < 1) concurrency = 1;
+
+    probe_t *probes = calloc(concurrency, sizeof(probe_t));
+    struct pollfd *pfds = calloc(concurrency, sizeof(struct pollfd));
+    int *slots = calloc(concurrency, sizeof(int));
+    if (!probes || !pfds || !slots) goto out;
+    for (int i = 0; i < concurrency; i++) probes[i].fd = -1;
+
+    int total = (int)count * SCAN_PORTS;
+    int next = 0;
+    int done = 0;
+    int active = 0;
+    for (;;) {
+        /* Refill free slots */
+        for (int i = 0; i < concurrency && next < total; i++) {
+            if (probes[i].state != PROBE_FREE) continue;
+            probe_start(&probes[i], first + (uint32_t)(next / SCAN_PORTS),
+                        scan_ports[next % SCAN_PORTS], sink);
+            next++;
+        }
+
+        int n = 0;
+        uint64_t now = monotonic_ms();
+        active = 0;
+        for (int i = 0; i < concurrency; i++) {
+            probe_t *p = &probes[i];
+            if (p->state == PROBE_FREE) continue;
+            if (now >= p->deadline) {
+                probe_close(p);
+                continue;
+            }
+            active++;
+            pfds[n].fd = p->fd;
+            pfds[n].events = p->state == PROBE_RECEIVING ? POLLIN : POLLOUT;
+            pfds[n].revents = 0;
+            slots[n] = i;
+            n++;
+        }
+
+        /* Probes that finished free a slot; count everything started but idle */
+        done = next - active;
+        if (sink->progress && sink->progress(sink->ctx, done, total)) break;
+        if (next >= total && active == 0) break;
+        if (n == 0) continue;
+
+        if (poll(pfds, n, 100) <= 0) continue;
+        for (int k = 0; k < n; k++) {
+            if (pfds[k].revents) probe_io(&probes[slots[k]], sink);
+        }
+    }
+
+out:
+    if (probes) {
+        for (int i = 0; i < concurrency; i++) {
+            if (probes[i].state != PROBE_FREE) probe_close(&probes[i]);
+        }
+    }
+    free(probes);
+    free(pfds);
+    free(slots);
+}
@@ -0,0 +1,36 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+#include "cups_api.h"
+
+/*
+ * Active subnet scan. Every host in an IPv4 range gets non-blocking
+ * connects to the IPP (631) and raw socket (9100) ports, at most
+ * SCAN_CONCURRENCY at a time. IPP listeners are only reported once they
+ * answer a Get-Printer-Attributes request.
+ */
+#define SCAN_CONCURRENCY 512
+#define SCAN_CONNECT_MS 800         /* Per probe connect timeout */
+#define SCAN_IPP_MS 3000            /* Per host Get-Printer-Attributes timeout */
+#define SCAN_MIN_PREFIX 16
+
+typedef struct {
+    /* Called for each printer found */
+    void (*found)(void *ctx, const discovered_t *device);
+    /* Called as probes finish; returning nonzero stops the scan */
+    int (*progress)(void *ctx, int done, int total);
+    void *ctx;
+} scan_sink_t;
+
+/*
+ * Parse "a.b.c.d/n" (or a single address). first and count cover the
+ * usable hosts, leaving out network and broadcast addresses. Returns 0 on
+ * success, -1 if malformed or wider than SCAN_MIN_PREFIX.
+ */
+int scan_parse_cidr(const char *cidr, uint32_t *first, uint32_t *count);
+
+/* Scan count hosts from first (host byte order). Blocks until done */
+void scan_range(uint32_t first, uint32_t count, const scan_sink_t *sink);
+
+#endif
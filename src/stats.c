@@ -0,0 +1,250 @@
+#include "stats.h"
+#include "broker.h"
+#include "util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bin 0 holds sub-second samples; bin i covers [2^((i-1)/4), 2^(i/4)) seconds */
+static int secs_to_bin(double secs) {
+    if (secs < 1) return 0;
+    int bin = 1 + (int)(4 * log2(secs));
+    return bin < STATS_BINS ? bin : STATS_BINS - 1;
+}
+
+/* Geometric middle of a bin */
+static int bin_to_secs(int bin) {
+    if (bin == 0) return 0;
+    return (int)(pow(2, (bin - 0.5) / 4) + 0.5);
+}
+
+static void hist_add(window_hist_t *h, time_t at, double secs) {
+    time_t start = at - at % STATS_SLOT_SECS;
+    int slot = (int)((at / STATS_SLOT_SECS) % STATS_SLOTS);
+
+    /* Slot is being reused for a newer interval */
+    if (h->slot_start[slot] != start) {
+        if (h->slot_start[slot] > start) return;  /* Sample too old to keep */
+        memset(h->counts[slot], 0, sizeof(h->counts[slot]));
+        h->slot_start[slot] = start;
+    }
+    h->counts[slot][secs_to_bin(secs)]++;
+}
+
+static void hist_quantiles(window_hist_t *h, time_t now, quantiles_t *q) {
+    uint32_t merged[STATS_BINS] = {0};
+    time_t oldest = now - (time_t)STATS_SLOTS * STATS_SLOT_SECS;
+    uint64_t total = 0;
+
+    for (int s = 0; s < STATS_SLOTS; s++) {
+        if (h->slot_start[s] <= oldest) continue;
+        for (int b = 0; b < STATS_BINS; b++) {
+            merged[b] += h->counts[s][b];
+            total += h->counts[s][b];
+        }
+    }
+
+    memset(q, 0, sizeof(*q));
+    q->samples = (int)total;
+    if (total == 0) return;
+
+    const double levels[] = { 0.50, 0.95, 0.99 };
+    int *out[] = { &q->p50, &q->p95, &q->p99 };
+    uint64_t seen = 0;
+    int level = 0;
+    for (int b = 0; b < STATS_BINS && level < 3; b++) {
+        seen += merged[b];
+        while (level < 3 && seen >= (uint64_t)ceil(levels[level] * total)) {
+            *out[level++] = bin_to_secs(b);
+        }
+    }
+}
+
+static printer_stats_t *find_printer(stats_t *stats, const char *printer, int create) {
+    for (int i = 0; i < stats->count; i++) {
+        if (strcmp(stats->items[i].printer, printer) == 0) return &stats->items[i];
+    }
+    if (!create) return NULL;
+
+    if (stats->count >= stats->capacity) {
+        int capacity = stats->capacity ? stats->capacity * 2 : 8;
+        printer_stats_t *grown = realloc(stats->items, capacity * sizeof(printer_stats_t));
+        if (!grown) return NULL;
+        stats->items = grown;
+        stats->capacity = capacity;
+    }
+    printer_stats_t *ps = &stats->items[stats->count++];
+    memset(ps, 0, sizeof(*ps));
+    strncpy(ps->printer, printer, sizeof(ps->printer) - 1);
+    return ps;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int has_id(const int *sorted, int count, int id) {
+    return count > 0 && bsearch(&id, sorted, count, sizeof(int), compare_ids) != NULL;
+}
+
+static int is_active(const job_info_t *active, int count, int id) {
+    for (int i = 0; i < count; i++) {
+        if (active[i].id == id) return 1;
+    }
+    return 0;
+}
+
+void stats_init(stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_init(&stats->lock, NULL);
+    pthread_cond_init(&stats->cond, NULL);
+}
+
+void stats_free(stats_t *stats) {
+    if (stats->started) {
+        pthread_mutex_lock(&stats->lock);
+        stats->running = 0;
+        pthread_cond_signal(&stats->cond);
+        pthread_mutex_unlock(&stats->lock);
+        pthread_join(stats->thread, NULL);
+    }
+    pthread_mutex_destroy(&stats->lock);
+    pthread_cond_destroy(&stats->cond);
+    free(stats->items);
+    free(stats->waiting);
+    memset(stats, 0, sizeof(*stats));
+}
+
+void stats_refresh(stats_t *stats, const job_info_t *active, int active_count) {
+    /* Reach below the watermark only for waiting jobs that have left the
+     * queue, so a job held for days doesn't drag every fetch back to it */
+    int first = stats->watermark;
+    for (int i = 0; i < stats->waiting_count; i++) {
+        int id = stats->waiting[i];
+        if (id < first && !is_active(active, active_count, id)) first = id;
+    }
+
+    job_info_t *jobs;
+    int count = get_finished_jobs(first, &jobs);
+    if (count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) {
+        free_jobs(jobs);
+        return;
+    }
+    int *seen = malloc((count ? count : 1) * sizeof(int));
+    int *waiting = malloc((active_count ? active_count : 1) * sizeof(int));
+    if (!seen || !waiting) {
+        free(seen);
+        free(waiting);
+        free_jobs(jobs);
+        return;
+    }
+
+    time_t oldest = time(NULL) - (time_t)STATS_SLOTS * STATS_SLOT_SECS;
+    int max_id = stats->watermark - 1;
+    pthread_mutex_lock(&stats->lock);
+    for (int i = 0; i < count; i++) {
+        job_info_t *j = &jobs[i];
+        seen[i] = j->id;
+        if (j->id > max_id) max_id = j->id;
+
+        /* Nothing at or above the watermark was returned before */
+        if (j->id < stats->watermark && !has_id(stats->waiting, stats->waiting_count, j->id))
+            continue;
+        if (j->completed <= oldest || j->processing == 0) continue;
+
+        printer_stats_t *ps = find_printer(stats, j->printer, 1);
+        if (!ps) continue;
+
+        if (j->processing >= j->created)
+            hist_add(&ps->wait, j->completed, difftime(j->processing, j->created));
+        if (strcmp(j->state, "completed") == 0 && j->completed >= j->processing)
+            hist_add(&ps->duration, j->completed, difftime(j->completed, j->processing));
+    }
+    pthread_mutex_unlock(&stats->lock);
+    free_jobs(jobs);
+
+    /* Active jobs the new watermark passes are counted once they finish */
+    qsort(seen, count, sizeof(int), compare_ids);
+    int watermark = max_id + 1;
+    int waiting_count = 0;
+    for (int i = 0; i < active_count; i++) {
+        int id = active[i].id;
+        if (id < watermark && !has_id(seen, count, id)) waiting[waiting_count++] = id;
+    }
+    qsort(waiting, waiting_count, sizeof(int), compare_ids);
+    free(seen);
+
+    free(stats->waiting);
+    stats->waiting = waiting;
+    stats->waiting_count = waiting_count;
+    stats->watermark = watermark;
+}
+
+static void *stats_thread_func(void *arg) {
+    stats_t *stats = arg;
+
+    pthread_mutex_lock(&stats->lock);
+    while (stats->running) {
+        stats->wake = 0;
+        pthread_mutex_unlock(&stats->lock);
+
+        job_info_t *active;
+        int count = broker_get_jobs(&active);
+        if (count < 0) {
+            count = get_jobs(&active);
+            if (count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) count = -1;
+        }
+        if (count >= 0) stats_refresh(stats, active, count);
+        free_jobs(active);
+
+        pthread_mutex_lock(&stats->lock);
+        if (!stats->running) break;
+        if (stats->wake) continue;
+        struct timespec until = abs_deadline(STATS_REFRESH_MS);
+        pthread_cond_timedwait(&stats->cond, &stats->lock, &until);
+    }
+    pthread_mutex_unlock(&stats->lock);
+    return NULL;
+}
+
+void stats_start(stats_t *stats) {
+    stats->running = 1;
+    stats->started = pthread_create(&stats->thread, NULL, stats_thread_func, stats) == 0;
+}
+
+void stats_wake(stats_t *stats) {
+    pthread_mutex_lock(&stats->lock);
+    stats->wake = 1;
+    pthread_cond_signal(&stats->cond);
+    pthread_mutex_unlock(&stats->lock);
+}
+
+int stats_quantiles(stats_t *stats, const char *printer, quantiles_t *wait,
+                    quantiles_t *duration) {
+    pthread_mutex_lock(&stats->lock);
+    printer_stats_t *ps = find_printer(stats, printer, 0);
+    if (!ps) {
+        pthread_mutex_unlock(&stats->lock);
+        memset(wait, 0, sizeof(*wait));
+        memset(duration, 0, sizeof(*duration));
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    hist_quantiles(&ps->wait, now, wait);
+    hist_quantiles(&ps->duration, now, duration);
+    pthread_mutex_unlock(&stats->lock);
+    return wait->samples > duration->samples ? wait->samples : duration->samples;
+}
+
+void stats_format_secs(char *buf, size_t len, int secs) {
+    if (secs < 60) {
+        snprintf(buf, len, "%ds", secs);
+    } else if (secs < 3600) {
+        snprintf(buf, len, "%dm", (secs + 30) / 60);
+    } else {
+        snprintf(buf, len, "%dh", (secs + 1800) / 3600);
+    }
+}
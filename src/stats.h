@@ -0,0 +1,82 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "cups_api.h"
+
+/*
+ * Per-printer latency histograms over a sliding window. Each window is
+ * STATS_SLOTS sub-intervals of log-spaced bins, so memory per printer is
+ * fixed no matter how many jobs pass through.
+ */
+#define STATS_BINS 64           /* Quarter-octave bins from 1s to ~18h */
+#define STATS_SLOTS 12
+#define STATS_SLOT_SECS 300     /* 12 x 5 minutes = one hour window */
+#define STATS_REFRESH_MS 60000  /* Background refresh interval, see stats_start() */
+
+typedef struct {
+    uint32_t counts[STATS_SLOTS][STATS_BINS];
+    time_t slot_start[STATS_SLOTS];
+} window_hist_t;
+
+typedef struct {
+    char printer[256];
+    window_hist_t wait;         /* Creation to processing */
+    window_hist_t duration;     /* Processing to completed */
+} printer_stats_t;
+
+typedef struct {
+    int samples;
+    int p50;                    /* Seconds */
+    int p95;
+    int p99;
+} quantiles_t;
+
+typedef struct {
+    pthread_mutex_t lock;       /* Guards the histograms */
+    printer_stats_t *items;
+    int count;
+    int capacity;
+
+    /* Every finished job below the watermark has been counted, except
+     * those still waiting: active when the watermark passed them. They
+     * are fetched again only once they leave the queue. */
+    int watermark;
+    int *waiting;               /* Ascending */
+    int waiting_count;
+
+    /* Background refresh */
+    pthread_t thread;
+    pthread_cond_t cond;
+    int started;
+    int running;
+    int wake;                   /* Refresh now instead of at the next interval */
+} stats_t;
+
+void stats_init(stats_t *stats);
+
+/* Stops the background refresh if it was started */
+void stats_free(stats_t *stats);
+
+/* Fetch jobs finished since the last call and fold them into the histograms.
+ * active is the current active job list, used to advance the watermark.
+ * Not to be mixed with stats_start(). */
+void stats_refresh(stats_t *stats, const job_info_t *active, int active_count);
+
+/* Refresh now and then every STATS_REFRESH_MS on a thread of its own,
+ * following the active jobs from the broker or cupsd */
+void stats_start(stats_t *stats);
+
+/* Have the background refresh run now */
+void stats_wake(stats_t *stats);
+
+/* Window quantiles for a printer. Returns the number of samples */
+int stats_quantiles(stats_t *stats, const char *printer, quantiles_t *wait,
+                    quantiles_t *duration);
+
+/* Compact duration such as "45s", "12m" or "3h" */
+void stats_format_secs(char *buf, size_t len, int secs);
+
+#endif
@@ -0,0 +1,262 @@
+#include "submit.h"
+#include "cups_api.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void set_error(submit_file_t *file, const char *what, const char *detail) {
+    snprintf(file->error, sizeof(file->error), "%s: %s", what, detail);
+    file->result = -1;
+}
+
+static http_t *connect_dest(cups_dest_t *dest) {
+    char resource[256];
+    return cupsConnectDest(dest, CUPS_DEST_FLAGS_NONE, 30000, NULL,
+                           resource, sizeof(resource), NULL, NULL);
+}
+
+/* Cancel a job whose document didn't make it, so nothing half sent
+ * prints or sits in the queue. The connection may be stuck midway
+ * through the document request, so it is replaced first */
+static void abandon_job(http_t **http, cups_dest_t *dest, int job_id) {
+    httpClose(*http);
+    *http = connect_dest(dest);
+    cupsCancelDestJob(*http ? *http : CUPS_HTTP_DEFAULT, dest, job_id);
+}
+
+/* Stream one file as a single-document job over *http, which is
+ * replaced if a failure leaves it unusable */
+static void submit_file(submit_batch_t *batch, http_t **http, cups_dest_t *dest,
+                        cups_dinfo_t *info, submit_file_t *file) {
+    if (!*http) {
+        set_error(file, batch->printer, "unable to connect");
+        return;
+    }
+
+    int fd = open(file->path, O_RDONLY);
+    if (fd < 0) {
+        set_error(file, "open", strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        set_error(file, "open", strerror(err));
+        close(fd);
+        return;
+    }
+    if (st.st_size == 0) {
+        set_error(file, "open", "empty file");
+        close(fd);
+        return;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        set_error(file, "mmap", strerror(errno));
+        return;
+    }
+    posix_madvise((void *)data, size, POSIX_MADV_SEQUENTIAL);
+
+    const char *title = strrchr(file->path, '/');
+    title = title ? title + 1 : file->path;
+
+    int job_id = 0;
+    if (cupsCreateDestJob(*http, dest, info, &job_id, title, 0, NULL) > IPP_STATUS_OK_CONFLICTING) {
+        set_error(file, "create job", cupsLastErrorString());
+        munmap((void *)data, size);
+        return;
+    }
+
+    if (cupsStartDestDocument(*http, dest, info, job_id, title, CUPS_FORMAT_AUTO,
+                              0, NULL, 1) != HTTP_STATUS_CONTINUE) {
+        set_error(file, "send", cupsLastErrorString());
+        abandon_job(http, dest, job_id);
+        munmap((void *)data, size);
+        return;
+    }
+
+    /* Write straight from the mapping - no staging buffer */
+    for (size_t off = 0; off < size; ) {
+        size_t n = size - off < SUBMIT_CHUNK ? size - off : SUBMIT_CHUNK;
+        if (cupsWriteRequestData(*http, data + off, n) != HTTP_STATUS_CONTINUE) {
+            /* Finishing would print the truncated document */
+            set_error(file, "send", cupsLastErrorString());
+            abandon_job(http, dest, job_id);
+            munmap((void *)data, size);
+            return;
+        }
+        off += n;
+
+        pthread_mutex_lock(&batch->lock);
+        batch->bytes_sent += n;
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    if (cupsFinishDestDocument(*http, dest, info) > IPP_STATUS_OK_CONFLICTING) {
+        set_error(file, "finish", cupsLastErrorString());
+        cupsCancelDestJob(*http, dest, job_id);
+    } else {
+        file->job_id = job_id;
+    }
+
+    munmap((void *)data, size);
+}
+
+static void *submit_thread_func(void *arg) {
+    submit_batch_t *batch = (submit_batch_t *)arg;
+
+    cups_dest_t *dest = cupsGetNamedDest(CUPS_HTTP_DEFAULT, batch->printer, NULL);
+    http_t *http = NULL;
+    cups_dinfo_t *info = NULL;
+
+    if (dest) {
+        http = connect_dest(dest);
+    }
+    if (http) {
+        info = cupsCopyDestInfo(http, dest);
+    }
+    const char *setup_error = !dest ? "no such printer" : !http ? "unable to connect"
+                            : !info ? cupsLastErrorString() : NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        if (batch->next >= batch->count) {
+            pthread_mutex_unlock(&batch->lock);
+            break;
+        }
+        submit_file_t *file = &batch->files[batch->next++];
+        pthread_mutex_unlock(&batch->lock);
+
+        if (setup_error) {
+            set_error(file, batch->printer, setup_error);
+        } else {
+            submit_file(batch, &http, dest, info, file);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        file->done = 1;
+        batch->finished++;
+        if (file->result != 0) batch->failed++;
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    if (info) cupsFreeDestInfo(info);
+    if (http) httpClose(http);
+    if (dest) cupsFreeDests(1, dest);
+    return NULL;
+}
+
+int submit_batch_start(submit_batch_t *batch, const char *printer,
+                       char * const *paths, int count) {
+    memset(batch, 0, sizeof(*batch));
+    strncpy(batch->printer, printer, sizeof(batch->printer) - 1);
+
+    batch->files = calloc(count, sizeof(submit_file_t));
+    if (!batch->files) return -1;
+    batch->count = count;
+
+    for (int i = 0; i < count; i++) {
+        batch->files[i].path = strdup(paths[i]);
+        struct stat st;
+        if (stat(paths[i], &st) == 0) {
+            batch->files[i].size = st.st_size;
+            batch->bytes_total += st.st_size;
+        }
+    }
+
+    pthread_mutex_init(&batch->lock, NULL);
+    batch->started_ms = monotonic_ms();
+
+    int threads = count < SUBMIT_CONNECTIONS ? count : SUBMIT_CONNECTIONS;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&batch->threads[i], NULL, submit_thread_func, batch) != 0) break;
+        batch->thread_count++;
+    }
+    return batch->thread_count > 0 ? 0 : -1;
+}
+
+void submit_batch_progress(submit_batch_t *batch, submit_progress_t *progress) {
+    pthread_mutex_lock(&batch->lock);
+    progress->files = batch->count;
+    progress->finished = batch->finished;
+    progress->failed = batch->failed;
+    progress->bytes_total = batch->bytes_total;
+    progress->bytes_sent = batch->bytes_sent;
+    pthread_mutex_unlock(&batch->lock);
+
+    uint64_t elapsed = monotonic_ms() - batch->started_ms;
+    progress->rate = elapsed > 0 ? progress->bytes_sent * 1000.0 / elapsed : 0;
+}
+
+int submit_batch_done(submit_batch_t *batch) {
+    pthread_mutex_lock(&batch->lock);
+    int done = batch->finished == batch->count;
+    pthread_mutex_unlock(&batch->lock);
+    return done;
+}
+
+void submit_batch_free(submit_batch_t *batch) {
+    for (int i = 0; i < batch->thread_count; i++) {
+        pthread_join(batch->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&batch->lock);
+
+    for (int i = 0; i < batch->count; i++) {
+        free(batch->files[i].path);
+    }
+    free(batch->files);
+    batch->files = NULL;
+    batch->count = 0;
+}
+
+static void print_progress(submit_progress_t *p) {
+    fprintf(stderr, "\r%d/%d files  %.1f/%.1f MB  %.1f MB/s", p->finished, p->files,
+            p->bytes_sent / 1e6, p->bytes_total / 1e6, p->rate / 1e6);
+    if (p->failed) fprintf(stderr, "  %d failed", p->failed);
+    fflush(stderr);
+}
+
+int submit_run(const char *printer, char * const *paths, int count) {
+    submit_batch_t batch;
+    if (submit_batch_start(&batch, printer, paths, count) != 0) {
+        fprintf(stderr, "spoolie: unable to start submission\n");
+        return 1;
+    }
+
+    int tty = isatty(STDERR_FILENO);
+    submit_progress_t progress;
+    while (!submit_batch_done(&batch)) {
+        if (tty) {
+            submit_batch_progress(&batch, &progress);
+            print_progress(&progress);
+        }
+        usleep(250 * 1000);
+    }
+    submit_batch_progress(&batch, &progress);
+    print_progress(&progress);
+    fputc('\n', stderr);
+
+    /* Request ids on stdout, like lp */
+    for (int i = 0; i < batch.count; i++) {
+        submit_file_t *file = &batch.files[i];
+        if (file->result == 0) {
+            printf("%s-%d\t%s\n", printer, file->job_id, file->path);
+        } else {
+            fprintf(stderr, "spoolie: %s: %s\n", file->path, file->error);
+        }
+    }
+
+    int failed = progress.failed;
+    submit_batch_free(&batch);
+    return failed ? 1 : 0;
+}
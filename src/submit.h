@@ -0,0 +1,62 @@
+#ifndef SUBMIT_H
+#define SUBMIT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define SUBMIT_CONNECTIONS 4            /* Jobs in flight, one connection each */
+#define SUBMIT_CHUNK (1024 * 1024)      /* Bytes per cupsWriteRequestData() call */
+
+typedef struct {
+    char *path;
+    uint64_t size;
+    int job_id;                 /* Set once the job is created */
+    int done;
+    int result;                 /* 0 on success */
+    char error[256];
+} submit_file_t;
+
+typedef struct {
+    int files;
+    int finished;
+    int failed;
+    uint64_t bytes_total;
+    uint64_t bytes_sent;
+    double rate;                /* Bytes per second so far */
+} submit_progress_t;
+
+/*
+ * Prints a batch of files to one destination. Each worker keeps its own
+ * connection and streams files from a read-only mapping straight into
+ * the request, SUBMIT_CHUNK at a time.
+ */
+typedef struct {
+    char printer[256];
+    submit_file_t *files;
+    int count;
+
+    pthread_mutex_t lock;
+    pthread_t threads[SUBMIT_CONNECTIONS];
+    int thread_count;
+    int next;                   /* Next file for a worker to take */
+    int finished;
+    int failed;
+    uint64_t bytes_total;
+    uint64_t bytes_sent;
+    uint64_t started_ms;
+} submit_batch_t;
+
+/* Start printing paths to printer. Returns 0 if the workers started */
+int submit_batch_start(submit_batch_t *batch, const char *printer,
+                       char * const *paths, int count);
+
+void submit_batch_progress(submit_batch_t *batch, submit_progress_t *progress);
+int submit_batch_done(submit_batch_t *batch);
+
+/* Wait for the workers and release the batch */
+void submit_batch_free(submit_batch_t *batch);
+
+/* --submit: print files with progress on stderr. Returns exit status */
+int submit_run(const char *printer, char * const *paths, int count);
+
+#endif
@@ -0,0 +1,180 @@
+#include "trigram.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t key;
+    int doc;
+} posting_t;
+
+static uint32_t trigram_key(const char *s) {
+    return ((uint32_t)(unsigned char)s[0] << 16) |
+           ((uint32_t)(unsigned char)s[1] << 8) |
+           (uint32_t)(unsigned char)s[2];
+}
+
+static int cmp_posting(const void *a, const void *b) {
+    const posting_t *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->doc > y->doc) - (x->doc < y->doc);
+}
+
+void trigram_init(trigram_index_t *index) {
+    memset(index, 0, sizeof(*index));
+}
+
+void trigram_free(trigram_index_t *index) {
+    for (int i = 0; i < index->doc_count; i++) {
+        free(index->text[i]);
+    }
+    free(index->text);
+    free(index->keys);
+    free(index->offsets);
+    free(index->docs);
+    trigram_init(index);
+}
+
+int trigram_build(trigram_index_t *index, const char *const *texts, int count) {
+    trigram_free(index);
+    if (count <= 0) return 0;
+
+    index->text = calloc(count, sizeof(char *));
+    if (!index->text) return -1;
+    index->doc_count = count;
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        char *t = strdup(texts[i] ? texts[i] : "");
+        if (!t) goto fail;
+        for (char *c = t; *c; c++) *c = (char)tolower((unsigned char)*c);
+        index->text[i] = t;
+
+        size_t len = strlen(t);
+        if (len > 2) total += len - 2;
+    }
+
+    posting_t *pairs = malloc((total ? total : 1) * sizeof(posting_t));
+    if (!pairs) goto fail;
+    size_t n = 0;
+    for (int i = 0; i < count; i++) {
+        const char *t = index->text[i];
+        for (size_t j = 0; t[j] && t[j + 1] && t[j + 2]; j++) {
+            /* Fields are newline separated; trigrams spanning them never match */
+            if (t[j] == '\n' || t[j + 1] == '\n' || t[j + 2] == '\n') continue;
+            pairs[n].key = trigram_key(t + j);
+            pairs[n].doc = i;
+            n++;
+        }
+    }
+    qsort(pairs, n, sizeof(posting_t), cmp_posting);
+
+    index->keys = malloc((n ? n : 1) * sizeof(uint32_t));
+    index->offsets = malloc((n + 1) * sizeof(int));
+    index->docs = malloc((n ? n : 1) * sizeof(int));
+    if (!index->keys || !index->offsets || !index->docs) {
+        free(pairs);
+        goto fail;
+    }
+
+    int docs = 0;
+    for (size_t i = 0; i < n; i++) {
+        int new_key = i == 0 || pairs[i].key != pairs[i - 1].key;
+        if (!new_key && pairs[i].doc == pairs[i - 1].doc) continue;
+        if (new_key) {
+            index->keys[index->key_count] = pairs[i].key;
+            index->offsets[index->key_count] = docs;
+            index->key_count++;
+        }
+        index->docs[docs++] = pairs[i].doc;
+    }
+    index->offsets[index->key_count] = docs;
+    free(pairs);
+    return 0;
+
+fail:
+    trigram_free(index);
+    return -1;
+}
+
+/* Posting list for one trigram, or 0 if no document contains it */
+static int lookup(const trigram_index_t *index, uint32_t key, const int **docs, int *count) {
+    int lo = 0, hi = index->key_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->keys[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == index->key_count || index->keys[lo] != key) return 0;
+    *docs = index->docs + index->offsets[lo];
+    *count = index->offsets[lo + 1] - index->offsets[lo];
+    return 1;
+}
+
+/*
+ * Keep the candidates containing term. Writes never overtake reads, so
+ * out may alias cand.
+ */
+static int filter_term(const trigram_index_t *index, const char *term,
+                       const int *cand, int cand_count, int *out) {
+    const int *post = NULL;
+    int post_count = 0;
+    for (size_t i = 0; term[i] && term[i + 1] && term[i + 2]; i++) {
+        const int *docs;
+        int n;
+        if (!lookup(index, trigram_key(term + i), &docs, &n)) return 0;
+        if (!post || n < post_count) {
+            post = docs;
+            post_count = n;
+        }
+    }
+
+    int count = 0;
+    if (post && post_count < cand_count) {
+        /* Walk the rarest posting list, keeping ids that are candidates */
+        int c = 0;
+        for (int i = 0; i < post_count; i++) {
+            int doc = post[i];
+            if (cand) {
+                while (c < cand_count && cand[c] < doc) c++;
+                if (c == cand_count) break;
+                if (cand[c] != doc) continue;
+            }
+            if (strstr(index->text[doc], term)) out[count++] = doc;
+        }
+    } else {
+        /* Short terms and small candidate sets: just verify each one */
+        for (int i = 0; i < cand_count; i++) {
+            int doc = cand ? cand[i] : i;
+            if (strstr(index->text[doc], term)) out[count++] = doc;
+        }
+    }
+    return count;
+}
+
+int trigram_query(const trigram_index_t *index, const char *query,
+                  const int *within, int within_count, int *out) {
+    char q[256];
+    snprintf(q, sizeof(q), "%s", query ? query : "");
+    for (char *c = q; *c; c++) *c = (char)tolower((unsigned char)*c);
+
+    const int *cand = within;
+    int count = within ? within_count : index->doc_count;
+    int filtered = 0;
+
+    char *save;
+    for (char *term = strtok_r(q, " \t", &save); term; term = strtok_r(NULL, " \t", &save)) {
+        count = filter_term(index, term, cand, count, out);
+        cand = out;
+        filtered = 1;
+        if (count == 0) break;
+    }
+
+    if (!filtered) {
+        for (int i = 0; i < count; i++) {
+            out[i] = within ? within[i] : i;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,36 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdint.h>
+
+/*
+ * In-memory substring index. Documents are lowercased once at build time
+ * and every three-byte window is recorded in a posting list, so a query
+ * only has to verify the documents on its rarest trigram instead of
+ * scanning all of them.
+ */
+typedef struct {
+    char **text;                /* Lowercased document text */
+    int doc_count;
+    uint32_t *keys;             /* Distinct trigrams, sorted */
+    int *offsets;               /* Postings for keys[i] are docs[offsets[i]..offsets[i+1]] */
+    int *docs;                  /* Document ids, ascending within each key */
+    int key_count;
+} trigram_index_t;
+
+void trigram_init(trigram_index_t *index);
+void trigram_free(trigram_index_t *index);
+
+/* Replace the index contents with the given documents (ids are positions) */
+int trigram_build(trigram_index_t *index, const char *const *texts, int count);
+
+/*
+ * Find documents containing every whitespace separated term of query,
+ * case-insensitively. Only ids in within (ascending) are considered, or
+ * all documents if within is NULL. Ids are written to out in ascending
+ * order; out must hold the candidate count. Returns the match count.
+ */
+int trigram_query(const trigram_index_t *index, const char *query,
+                  const int *within, int within_count, int *out);
+
+#endif
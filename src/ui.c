@@ -1,50 +1,374 @@
 #include "ui.h"
 #include "cups_api.h"
+#include "broker.h"
+#include "scan.h"
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <glob.h>
 
 #define HEADER_HEIGHT 1
 #define FOOTER_HEIGHT 2
+#define DETAIL_MIN_WIDTH 80  /* Narrower screens don't get a job detail pane */
+#define STATS_COL_WIDTH 40   /* Printer latency percentiles, when there's room */
+#define HEALTH_COL_WIDTH 8    /* Device round trip, "down" or "-" */
+#define HISTORY_STEP 60      /* Seconds per [ or ], ten times that for { or } */
+#define SEARCH_MAX_RESULTS 500  /* Newest matches shown */
+
+static int op_pending(ui_state_t *state, op_kind_t kind, const char *name, int job_id) {
+    for (int i = 0; i < state->inflight_count; i++) {
+        inflight_t *f = &state->inflight[i];
+        if (f->kind != kind) continue;
+        if (name && strcmp(f->name, name) != 0) continue;
+        if (job_id && f->job_id != job_id) continue;
+        return 1;
+    }
+    return 0;
+}
+
+static int count_pending(ui_state_t *state, op_kind_t kind) {
+    int count = 0;
+    for (int i = 0; i < state->inflight_count; i++) {
+        if (state->inflight[i].kind == kind) count++;
+    }
+    return count;
+}
+
+/* Hand a mutation to the executor. Returns 0 if it was queued */
+static int submit_op(ui_state_t *state, op_kind_t kind, const char *name,
+                     const char *uri, int job_id) {
+    if (op_pending(state, kind, name, job_id)) {
+        ui_set_status(state, "Already in progress");
+        return -1;
+    }
+    if (state->inflight_count >= UI_MAX_OPS) {
+        ui_set_status(state, "Too many operations in progress");
+        return -1;
+    }
+
+    op_t *op = calloc(1, sizeof(op_t));
+    if (!op) return -1;
+    op->kind = kind;
+    op->job_id = job_id;
+    if (name) strncpy(op->name, name, sizeof(op->name) - 1);
+    if (uri) strncpy(op->uri, uri, sizeof(op->uri) - 1);
+
+    inflight_t *f = &state->inflight[state->inflight_count++];
+    f->kind = kind;
+    f->job_id = job_id;
+    memcpy(f->name, op->name, sizeof(f->name));
+    f->id = executor_submit(&state->executor, op);
+    return 0;
+}
 
-/* Args passed to discovery thread */
-typedef struct {
-    ui_state_t *state;
-    int generation;
-} discover_args_t;
-
-/* Thread function for async printer discovery */
-static void *discover_thread_func(void *arg) {
-    discover_args_t *args = (discover_args_t *)arg;
-    ui_state_t *state = args->state;
-    int generation = args->generation;
-    free(args);
-
-    char **uris = NULL;
-    char **names = NULL;
-    int count = discover_printers(&uris, &names);
-
-    /* Only update state if this discovery is still current */
-    if (state->discover_generation == generation) {
-        /* Free any previous results */
-        if (state->discover_uris) {
-            free_discovered(state->discover_uris, state->discover_names,
-                            state->discover_count);
+static int job_marked(ui_state_t *state, int job_id) {
+    for (int i = 0; i < state->marked_count; i++) {
+        if (state->marked_jobs[i] == job_id) return 1;
+    }
+    return 0;
+}
+
+static void toggle_job_mark(ui_state_t *state, int job_id) {
+    for (int i = 0; i < state->marked_count; i++) {
+        if (state->marked_jobs[i] == job_id) {
+            state->marked_jobs[i] = state->marked_jobs[--state->marked_count];
+            return;
         }
-        state->discover_uris = uris;
-        state->discover_names = names;
-        state->discover_count = count;
-    } else {
-        /* Stale discovery - free results */
-        if (uris) {
-            free_discovered(uris, names, count);
+    }
+    if (state->marked_count < UI_MAX_MARKS) state->marked_jobs[state->marked_count++] = job_id;
+}
+
+/* Drop marks on jobs that have left the queue, so they can't linger in
+ * the title or keep a batch from falling back to the highlighted job */
+static void prune_job_marks(ui_state_t *state) {
+    int kept = 0;
+    for (int i = 0; i < state->marked_count; i++) {
+        int id = state->marked_jobs[i];
+        for (int k = 0; k < state->jobs.count; k++) {
+            if (state->jobs.items[k].id == id) {
+                state->marked_jobs[kept++] = id;
+                break;
+            }
         }
     }
+    state->marked_count = kept;
+}
+
+/* What a pending batch update is doing to a job ("holding", ...), or NULL */
+static const char *updating_job(ui_state_t *state, int job_id) {
+    for (int i = 0; i < state->inflight_count; i++) {
+        inflight_t *f = &state->inflight[i];
+        if (f->kind == OP_UPDATE_JOBS && f->job_id == job_id) return f->name;
+    }
+    return NULL;
+}
+
+/* Queue job updates as one batch; each job shows label until it lands.
+ * Takes ownership of updates. Returns 0 if it was queued */
+static int submit_updates(ui_state_t *state, job_update_t *updates, int count,
+                          const char *label) {
+    if (state->inflight_count + count > UI_MAX_OPS) {
+        ui_set_status(state, "Too many operations in progress");
+        free(updates);
+        return -1;
+    }
+
+    op_t *op = calloc(1, sizeof(op_t));
+    if (!op) {
+        free(updates);
+        return -1;
+    }
+    op->kind = OP_UPDATE_JOBS;
+    op->updates = updates;
+    op->update_count = count;
+    strncpy(op->name, label, sizeof(op->name) - 1);
+
+    int first = state->inflight_count;
+    for (int i = 0; i < count; i++) {
+        inflight_t *f = &state->inflight[state->inflight_count++];
+        f->kind = OP_UPDATE_JOBS;
+        f->job_id = updates[i].job_id;
+        memcpy(f->name, op->name, sizeof(f->name));
+    }
+    int id = executor_submit(&state->executor, op);
+    for (int i = first; i < state->inflight_count; i++) {
+        state->inflight[i].id = id;
+    }
+    return 0;
+}
 
+/* Printer that will be the default once pending changes land, or NULL */
+static const char *pending_default(ui_state_t *state) {
+    for (int i = state->inflight_count - 1; i >= 0; i--) {
+        if (state->inflight[i].kind == OP_SET_DEFAULT) return state->inflight[i].name;
+    }
     return NULL;
 }
 
+/* Record a batch add result on its discover row. The printer list is
+ * refreshed once, when the last add of the batch is done. */
+static void finish_add(ui_state_t *state, op_t *op) {
+    discover_list_t *list = &state->discover;
+
+    pthread_mutex_lock(&list->lock);
+    discover_item_t *item = discover_list_find(list, op->uri);
+    if (item) {
+        item->status = op->result == 0 ? ADD_DONE : ADD_FAILED;
+        snprintf(item->error, sizeof(item->error), "%s",
+                 op->error[0] ? op->error : "lpadmin failed");
+        if (op->result == 0) item->marked = 0;
+    }
+    pthread_mutex_unlock(&list->lock);
+
+    if (op->result != 0) state->batch_failed++;
+    if (op_pending(state, OP_ADD_PRINTER, NULL, 0)) {
+        int done = state->batch_total - count_pending(state, OP_ADD_PRINTER);
+        ui_set_status(state, "Adding printers %d/%d...", done, state->batch_total);
+        return;
+    }
+
+    printer_list_refresh(&state->printers);
+    if (state->batch_total == 1) {
+        if (op->result == 0) ui_set_status(state, "Added %s", op->name);
+        else ui_set_status(state, "Failed to add %s", op->name);
+    } else {
+        ui_set_status(state, "Added %d of %d printers", state->batch_total - state->batch_failed,
+                      state->batch_total);
+    }
+    state->batch_total = 0;
+    state->batch_failed = 0;
+}
+
+/* Record a rebalancing move in the preview and the audit log */
+static void finish_move(ui_state_t *state, op_t *op) {
+    for (int i = 0; i < state->balance_count; i++) {
+        if (state->balance_moves[i].job_id != op->job_id) continue;
+        state->balance_results[i] = op->result == 0 ? 1 : -1;
+        balance_audit(&state->balance_moves[i], op->result);
+    }
+
+    if (op->result != 0) {
+        ui_set_status(state, "Failed to move job %d", op->job_id);
+    }
+    if (!op_pending(state, OP_MOVE_JOB, NULL, 0)) {
+        job_list_refresh(&state->jobs);
+        if (op->result == 0) ui_set_status(state, "Moves applied");
+    }
+}
+
+/* Confirm or roll back the optimistic change for a finished op */
+static void finish_op(ui_state_t *state, op_t *op) {
+    /* Keep submission order - the latest set-default wins. A batch update
+     * has one entry per job, all with the same id. */
+    int kept = 0;
+    for (int i = 0; i < state->inflight_count; i++) {
+        if (state->inflight[i].id != op->id) state->inflight[kept++] = state->inflight[i];
+    }
+    state->inflight_count = kept;
+
+    /* On failure the overlay simply goes away, restoring the old row */
+    switch (op->kind) {
+        case OP_SET_DEFAULT:
+            if (op->result == 0) {
+                ui_set_status(state, "Set %s as default", op->name);
+                printer_list_refresh(&state->printers);
+            } else {
+                ui_set_status(state, "Failed to set default");
+            }
+            break;
+        case OP_CANCEL_JOB:
+            if (op->result == 0) {
+                ui_set_status(state, "Cancelled job %d", op->job_id);
+                job_list_refresh(&state->jobs);
+            } else {
+                ui_set_status(state, "Failed to cancel job %d", op->job_id);
+            }
+            break;
+        case OP_DELETE_PRINTER:
+            if (op->result == 0) {
+                ui_set_status(state, "Deleted %s", op->name);
+                printer_list_refresh(&state->printers);
+            } else {
+                ui_set_status(state, "Failed to delete %s", op->name);
+            }
+            break;
+        case OP_ADD_PRINTER:
+            finish_add(state, op);
+            break;
+        case OP_MOVE_JOB:
+            finish_move(state, op);
+            break;
+        case OP_UPDATE_JOBS:
+            if (op->result == 0) {
+                const char *done = op->updates[0].action == JOB_HOLD ? "Held" :
+                                   op->updates[0].action == JOB_RELEASE ? "Released" :
+                                   "Reprioritized";
+                ui_set_status(state, "%s %d jobs", done, op->update_count);
+            } else {
+                ui_set_status(state, "%d of %d job updates failed", op->result, op->update_count);
+            }
+            job_list_refresh(&state->jobs);
+            break;
+    }
+}
+
+/* Back from a rewound view to the current queue */
+static void go_live(ui_state_t *state) {
+    state->history_time = 0;
+    printer_list_refresh(&state->printers);
+    job_list_refresh(&state->jobs);
+    ui_set_status(state, "Live");
+}
+
+/* Rewind the main panels to when; at or past the newest snapshot they go
+ * back to live */
+static void show_history(ui_state_t *state, time_t when) {
+    time_t first, last;
+    if (history_range(&state->history, &first, &last) != 0) {
+        ui_set_status(state, "No history recorded yet");
+        return;
+    }
+    if (when >= last) {
+        if (state->history_time) go_live(state);
+        return;
+    }
+    if (when < first) when = first;
+
+    printer_info_t *printers;
+    job_info_t *jobs;
+    int printer_count, job_count;
+    time_t shown = history_at(&state->history, when, &printers, &printer_count,
+                              &jobs, &job_count);
+    if (shown == 0) {
+        ui_set_status(state, "History unavailable");
+        return;
+    }
+    state->history_time = shown;
+    printer_list_set(&state->printers, printers, printer_count);
+    job_list_set(&state->jobs, jobs, job_count);
+    state->status_msg[0] = '\0';
+}
+
+static void scrub_history(ui_state_t *state, int seconds) {
+    time_t from = state->history_time ? state->history_time : time(NULL);
+    show_history(state, from + seconds);
+}
+
+/* Changes act on the live queue, so they're refused while rewound */
+static int rewound(ui_state_t *state) {
+    if (!state->history_time) return 0;
+    ui_set_status(state, "Viewing history, Esc for live");
+    return 1;
+}
+
+/* Expand space separated globs and start printing the matches */
+static void start_submit(ui_state_t *state, const char *printer, const char *patterns) {
+    if (state->submit) {
+        ui_set_status(state, "Still printing previous files");
+        return;
+    }
+
+    int flags = GLOB_NOCHECK;
+#ifdef GLOB_TILDE
+    flags |= GLOB_TILDE;
+#endif
+    glob_t g;
+    memset(&g, 0, sizeof(g));
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", patterns);
+    for (char *tok = strtok(buf, " "); tok; tok = strtok(NULL, " ")) {
+        glob(tok, flags, NULL, &g);
+        flags |= GLOB_APPEND;
+    }
+
+    if (g.gl_pathc == 0) {
+        globfree(&g);
+        return;
+    }
+
+    submit_batch_t *batch = malloc(sizeof(submit_batch_t));
+    if (batch && submit_batch_start(batch, printer, g.gl_pathv, (int)g.gl_pathc) == 0) {
+        state->submit = batch;
+        ui_set_status(state, "Printing %d files to %s...", (int)g.gl_pathc, printer);
+    } else {
+        free(batch);
+        ui_set_status(state, "Failed to start printing");
+    }
+    globfree(&g);
+}
+
+/* Report submission progress, and clean up once every file is done */
+static void poll_submit(ui_state_t *state) {
+    submit_batch_t *batch = state->submit;
+    if (!batch) return;
+
+    submit_progress_t p;
+    submit_batch_progress(batch, &p);
+
+    if (!submit_batch_done(batch)) {
+        ui_set_status(state, "Printing %d/%d files, %.1f MB/s", p.finished, p.files,
+                      p.rate / 1e6);
+        return;
+    }
+
+    if (p.failed == 0) {
+        ui_set_status(state, "Printed %d files to %s", p.files, batch->printer);
+    } else if (p.files == 1) {
+        ui_set_status(state, "Print failed: %s", batch->files[0].error);
+    } else {
+        ui_set_status(state, "Printed %d files to %s, %d failed", p.files - p.failed,
+                      batch->printer, p.failed);
+    }
+
+    submit_batch_free(batch);
+    free(batch);
+    state->submit = NULL;
+    job_list_refresh(&state->jobs);
+}
+
 static void draw_header(ui_state_t *state) {
     werase(state->header);
     wbkgd(state->header, COLOR_PAIR(4));
@@ -58,6 +382,27 @@ static void draw_header(ui_state_t *state) {
     const char *tabs = "[Q]uit";
     mvwprintw(state->header, 0, width - strlen(tabs) - 1, "%s", tabs);
 
+    if (state->inflight_count > 0) {
+        char busy[32];
+        snprintf(busy, sizeof(busy), "%d in progress", state->inflight_count);
+        mvwprintw(state->header, 0, width - strlen(tabs) - strlen(busy) - 4, "%s", busy);
+    }
+
+    if (state->broker_generation != 0) {
+        mvwprintw(state->header, 0, 9, "(shared)");
+    }
+
+    if (state->history_time) {
+        char when[16];
+        struct tm tm;
+        localtime_r(&state->history_time, &tm);
+        strftime(when, sizeof(when), "%H:%M:%S", &tm);
+        long ago = (long)(time(NULL) - state->history_time);
+        wattron(state->header, A_BOLD);
+        mvwprintw(state->header, 0, 18, "history %s (-%ldm%02lds)", when, ago / 60, ago % 60);
+        wattroff(state->header, A_BOLD);
+    }
+
     wrefresh(state->header);
 }
 
@@ -71,15 +416,57 @@ static void draw_footer(ui_state_t *state) {
     switch (state->current_view) {
         case VIEW_MAIN:
             if (state->active_panel == PANEL_PRINTERS) {
-                help = "Tab:switch  j/k:nav  Enter:default  d:delete  a:add  r:refresh  q:quit";
+                help = "Tab:switch  j/k:nav  /:filter  Enter:default  s:print  d:delete  a:add  b:balance  u:usage  [/]:history  r:refresh  q:quit";
             } else {
-                help = "Tab:switch  j/k:nav  c:cancel  r:refresh  q:quit";
+                help = "Tab:switch  j/k:nav  /:search  Space:mark  h/l:hold/release  +/-:priority  c:cancel  b:balance  u:usage  [/]:history  r:refresh  q:quit";
             }
             break;
         case VIEW_DISCOVER:
-            help = "j/k:navigate  Enter:add printer  q:cancel";
+            help = "j/k:navigate  Space:select  Enter:add  s:scan subnet  t:name template  q:cancel";
+            break;
+        case VIEW_BALANCE:
+            help = "j/k:navigate  Enter:apply moves  r:replan  q:back";
+            break;
+        case VIEW_USAGE:
+            help = "Tab:printers/users  j/k:navigate  r:recount  q:back";
+            break;
+        case VIEW_SEARCH:
+            help = "/:edit search  j/k:navigate  Enter:go to job  q:back";
             break;
     }
+
+    if (state->prompt != PROMPT_NONE) {
+        /* Text input replaces the help line */
+        const char *label = "";
+        switch (state->prompt) {
+            case PROMPT_NAME_TEMPLATE:
+                label = "Name template ({host} {location} {model} {info}): ";
+                break;
+            case PROMPT_SUBMIT:
+                label = "Print files to ";
+                break;
+            case PROMPT_FILTER:
+                label = "/";
+                break;
+            case PROMPT_SCAN:
+                label = "Scan range (CIDR): ";
+                break;
+            case PROMPT_SEARCH:
+                label = "Search jobs: ";
+                break;
+            case PROMPT_NONE:
+                break;
+        }
+        mvwprintw(state->footer, 1, 1, "%s", label);
+        if (state->prompt == PROMPT_SUBMIT) wprintw(state->footer, "%s: ", state->prompt_target);
+        wprintw(state->footer, "%s", state->prompt_buf);
+        wattron(state->footer, A_REVERSE);
+        waddch(state->footer, ' ');
+        wattroff(state->footer, A_REVERSE);
+        wrefresh(state->footer);
+        return;
+    }
+
     wattron(state->footer, COLOR_PAIR(1));
     mvwprintw(state->footer, 1, 1, "%s", help);
     wattroff(state->footer, COLOR_PAIR(1));
@@ -119,6 +506,124 @@ static void draw_panel_box(WINDOW *win, int y, int height, int width,
     wattroff(win, COLOR_PAIR(color));
 }
 
+static void format_time(char *buf, size_t len, time_t t) {
+    if (t <= 0) {
+        snprintf(buf, len, "-");
+        return;
+    }
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+/* Detail pane for the selected job, between columns x and width */
+static void draw_job_detail(ui_state_t *state, int top, int height, int x, int width) {
+    WINDOW *win = state->main;
+    int bottom = top + height - 1;
+
+    wattron(win, COLOR_PAIR(2));
+    mvwaddch(win, top, x - 1, ACS_TTEE);
+    mvwvline(win, top + 1, x - 1, ACS_VLINE, height - 2);
+    mvwaddch(win, bottom, x - 1, ACS_BTEE);
+    wattroff(win, COLOR_PAIR(2));
+
+    int text_width = width - x - 2;
+    if (text_width <= 0) return;
+
+    job_info_t *j = &state->jobs.items[state->jobs.selected];
+    job_detail_t d;
+    int found = detail_lookup(&state->detail, j, &d);
+
+    int y = top + 1;
+    wattron(win, A_BOLD);
+    mvwprintw(win, y++, x + 1, "Job %d  %.*s", j->id, text_width - 12, j->state);
+    wattroff(win, A_BOLD);
+
+    if (state->history_time) {
+        /* Only the list is recorded */
+        mvwprintw(win, y, x + 1, "No details for past queues");
+        return;
+    }
+    if (found == 0) {
+        mvwprintw(win, y, x + 1, "Loading...");
+        return;
+    } else if (found < 0) {
+        mvwprintw(win, y, x + 1, "Details unavailable");
+        return;
+    }
+
+    char created[32], started[32], completed[32];
+    format_time(created, sizeof(created), d.created);
+    format_time(started, sizeof(started), d.processing);
+    format_time(completed, sizeof(completed), d.completed);
+
+    struct {
+        const char *label;
+        const char *value;
+    } rows[] = {
+        { "Reasons", d.state_reasons[0] ? d.state_reasons : "-" },
+        { "Message", d.printer_state_message[0] ? d.printer_state_message : "-" },
+        { "Pages", NULL },
+        { "Created", created },
+        { "Started", started },
+        { "Completed", completed },
+        { "Host", d.originating_host[0] ? d.originating_host : "-" },
+    };
+
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]) && y < bottom; i++, y++) {
+        mvwprintw(win, y, x + 1, "%-10s", rows[i].label);
+        if (rows[i].value) {
+            wprintw(win, "%.*s", text_width - 10, rows[i].value);
+        } else {
+            wprintw(win, "%d", d.pages_completed);
+        }
+    }
+}
+
+/* "wait p50/p95/p99  print p50/p95/p99" for the last hour */
+static void draw_printer_stats(ui_state_t *state, printer_info_t *p, int y, int x) {
+    quantiles_t wait, duration;
+    if (stats_quantiles(&state->stats, p->name, &wait, &duration) == 0) return;
+
+    quantiles_t *qs[] = { &wait, &duration };
+    const char *labels[] = { "wait", "print" };
+    for (int i = 0; i < 2; i++) {
+        if (qs[i]->samples == 0) continue;
+        char p50[8], p95[8], p99[8];
+        stats_format_secs(p50, sizeof(p50), qs[i]->p50);
+        stats_format_secs(p95, sizeof(p95), qs[i]->p95);
+        stats_format_secs(p99, sizeof(p99), qs[i]->p99);
+        mvwprintw(state->main, y, x + i * (STATS_COL_WIDTH / 2), "%s %s/%s/%s",
+                  labels[i], p50, p95, p99);
+    }
+}
+
+/* Round trip to the device itself, or why there isn't one */
+static void draw_printer_health(ui_state_t *state, const health_status_t *health, int y, int x) {
+    char text[16];
+    switch (health->state) {
+        case HEALTH_UP:
+            if (health->rtt_ms < 0) snprintf(text, sizeof(text), "lossy");
+            else snprintf(text, sizeof(text), "%dms", health->rtt_ms);
+            break;
+        case HEALTH_DOWN:
+            snprintf(text, sizeof(text), "down");
+            break;
+        case HEALTH_UNPROBED:
+            snprintf(text, sizeof(text), "-");
+            break;
+        case HEALTH_UNKNOWN:
+        default:
+            snprintf(text, sizeof(text), "...");
+            break;
+    }
+
+    int warn = health->state == HEALTH_DOWN || (health->state == HEALTH_UP && health->loss > 0);
+    if (warn) wattron(state->main, COLOR_PAIR(5));
+    mvwprintw(state->main, y, x, "%-*.*s", HEALTH_COL_WIDTH - 1, HEALTH_COL_WIDTH - 1, text);
+    if (warn) wattroff(state->main, COLOR_PAIR(5));
+}
+
 static void draw_main_panels(ui_state_t *state) {
     werase(state->main);
 
@@ -130,42 +635,83 @@ static void draw_main_panels(ui_state_t *state) {
 
     /* Draw printers panel */
     int printers_active = (state->active_panel == PANEL_PRINTERS);
-    draw_panel_box(state->main, 0, printers_height, width, "Printers", printers_active);
+    printer_list_t *list = &state->printers;
+    int max_items = printers_height - 2;
+    printer_list_scroll(list, max_items);
+
+    char title[320];
+    if (list->filter[0]) {
+        snprintf(title, sizeof(title), "Printers /%s (%d of %d)", list->filter,
+                 list->view_count, list->count);
+    } else if (list->count > max_items) {
+        snprintf(title, sizeof(title), "Printers (%d-%d of %d)", list->scroll + 1,
+                 list->scroll + (list->view_count < max_items ? list->view_count : max_items),
+                 list->count);
+    } else {
+        snprintf(title, sizeof(title), "Printers");
+    }
+    draw_panel_box(state->main, 0, printers_height, width, title, printers_active);
 
     if (state->printers.count == 0) {
         mvwprintw(state->main, 2, 2, "No printers configured");
+    } else if (list->view_count == 0) {
+        mvwprintw(state->main, 2, 2, "No printers match");
     } else {
-        int max_items = printers_height - 2;
         int inner_width = width - 2;  /* Space inside the box */
-        for (int i = 0; i < state->printers.count && i < max_items; i++) {
-            printer_info_t *p = &state->printers.items[i];
-            int y = i + 1;
+        const char *new_default = pending_default(state);
+        /* Only the visible window of the view is drawn */
+        for (int i = list->scroll; i < list->view_count && i - list->scroll < max_items; i++) {
+            printer_info_t *p = &list->items[list->view[i]];
+            int y = i - list->scroll + 1;
+            int deleting = op_pending(state, OP_DELETE_PRINTER, p->name, 0);
 
             if (i == state->printers.selected && printers_active) {
                 wattron(state->main, A_REVERSE);
                 /* Fill the entire row */
                 mvwhline(state->main, y, 1, ' ', inner_width);
             }
+            if (deleting) wattron(state->main, A_DIM);
+
+            health_status_t health;
+            int down = health_get(&state->health, p->name, &health) == 0 &&
+                       health.state == HEALTH_DOWN;
+
+            mvwprintw(state->main, y, 2, "%c",
+                      (i == state->printers.selected && printers_active) ? '>' : ' ');
+            if (down) {
+                /* cupsd may still call it idle; the device isn't answering */
+                wattron(state->main, COLOR_PAIR(5) | A_BOLD);
+                waddch(state->main, '!');
+                wattroff(state->main, COLOR_PAIR(5) | A_BOLD);
+            } else {
+                waddch(state->main, ' ');
+            }
+            wprintw(state->main, "%-20.20s", p->name);
 
-            mvwprintw(state->main, y, 2, "%c %-20.20s",
-                      (i == state->printers.selected && printers_active) ? '>' : ' ',
-                      p->name);
-
-            if (p->is_default) {
+            if (new_default ? strcmp(new_default, p->name) == 0 : p->is_default) {
                 wprintw(state->main, " (default)");
             }
 
             int state_col = width / 2;
-            mvwprintw(state->main, y, state_col, "%-10.10s", p->state);
+            mvwprintw(state->main, y, state_col, "%-10.10s",
+                      deleting ? "deleting" : p->state);
+
+            draw_printer_health(state, &health, y, state_col + 11);
+
+            int model_col = state_col + 11 + HEALTH_COL_WIDTH;
+            if (width - model_col >= STATS_COL_WIDTH + 4) {
+                draw_printer_stats(state, p, y, model_col);
+                model_col += STATS_COL_WIDTH;
+            }
 
             if (p->make_model[0]) {
-                int model_col = state_col + 12;
                 int model_max = width - model_col - 2;
                 if (model_max > 0) {
                     mvwprintw(state->main, y, model_col, "%.*s", model_max, p->make_model);
                 }
             }
 
+            if (deleting) wattroff(state->main, A_DIM);
             if (i == state->printers.selected && printers_active) {
                 wattroff(state->main, A_REVERSE);
             }
@@ -174,32 +720,57 @@ static void draw_main_panels(ui_state_t *state) {
 
     /* Draw jobs panel */
     int jobs_active = (state->active_panel == PANEL_JOBS);
-    draw_panel_box(state->main, printers_height, jobs_height, width, "Jobs", jobs_active);
+    char jobs_title[64] = "Jobs";
+    if (state->marked_count > 0) {
+        snprintf(jobs_title, sizeof(jobs_title), "Jobs (%d marked)", state->marked_count);
+    }
+    draw_panel_box(state->main, printers_height, jobs_height, width, jobs_title, jobs_active);
 
     if (state->jobs.count == 0) {
         mvwprintw(state->main, printers_height + 2, 2, "No active print jobs");
     } else {
+        /* Split off a detail pane on the right for the selected job */
+        int list_width = width;
+        if (jobs_active && width >= DETAIL_MIN_WIDTH) {
+            list_width = width - width * 2 / 5;
+            draw_job_detail(state, printers_height, jobs_height, list_width, width);
+        }
+
         int max_items = jobs_height - 2;
-        int inner_width = width - 2;
-        for (int i = 0; i < state->jobs.count && i < max_items; i++) {
+        int inner_width = list_width - 2;
+        /* Keep the selection in view */
+        int first = state->jobs.selected >= max_items ? state->jobs.selected - max_items + 1 : 0;
+        for (int i = first; i < state->jobs.count && i - first < max_items; i++) {
             job_info_t *j = &state->jobs.items[i];
-            int y = printers_height + 1 + i;
+            int y = printers_height + 1 + i - first;
+            int cancelling = op_pending(state, OP_CANCEL_JOB, NULL, j->id);
+            int moving = op_pending(state, OP_MOVE_JOB, NULL, j->id);
+            const char *updating = updating_job(state, j->id);
 
             if (i == state->jobs.selected && jobs_active) {
                 wattron(state->main, A_REVERSE);
                 mvwhline(state->main, y, 1, ' ', inner_width);
             }
+            if (cancelling || moving || updating) wattron(state->main, A_DIM);
 
             /* Calculate column widths based on available space */
             int avail = inner_width - 4;  /* minus selector and padding */
-            mvwprintw(state->main, y, 2, "%c %-6d %-15.15s %.*s",
+            mvwprintw(state->main, y, 2, "%c%c%-6d %-15.15s %.*s",
                       (i == state->jobs.selected && jobs_active) ? '>' : ' ',
+                      job_marked(state, j->id) ? '*' : ' ',
                       j->id, j->printer,
-                      avail - 25 > 0 ? avail - 25 : 10, j->title);
+                      avail - 29 > 0 ? avail - 29 : 10, j->title);
 
-            /* State on the right */
-            mvwprintw(state->main, y, width - 12, "%-10.10s", j->state);
+            /* Priority and state on the right; a timed hold shows when it ends */
+            const char *label = j->state;
+            if (strcmp(j->state, "held") == 0 && j->hold_until[0] &&
+                strcmp(j->hold_until, "indefinite") != 0 && strcmp(j->hold_until, "no-hold") != 0) {
+                label = j->hold_until;
+            }
+            mvwprintw(state->main, y, list_width - 16, "%3d %-10.10s", j->priority,
+                      cancelling ? "cancelling" : moving ? "moving" : updating ? updating : label);
 
+            if (cancelling || moving || updating) wattroff(state->main, A_DIM);
             if (i == state->jobs.selected && jobs_active) {
                 wattroff(state->main, A_REVERSE);
             }
@@ -210,33 +781,124 @@ static void draw_main_panels(ui_state_t *state) {
 }
 
 static void draw_discover(ui_state_t *state) {
+    discover_list_t *list = &state->discover;
     werase(state->main);
 
     int width = getmaxx(state->main);
+    int height = getmaxy(state->main);
+
+    pthread_mutex_lock(&list->lock);
 
     wattron(state->main, A_BOLD);
     mvwprintw(state->main, 0, 1, "DISCOVER PRINTERS");
     wattroff(state->main, A_BOLD);
+    wprintw(state->main, "  name: %s", list->name_template);
+    if (list->scanning) {
+        int percent = list->scan_total ? list->scan_done * 100 / list->scan_total : 0;
+        wprintw(state->main, "  scanning %s %d%%", list->scan_range, percent);
+    }
     mvwhline(state->main, 1, 0, ACS_HLINE, width);
 
-    if (state->discover_count < 0) {
+    if (list->count < 0) {
         mvwprintw(state->main, 3, 2, "Discovering printers...");
-    } else if (state->discover_count == 0) {
+    } else if (list->count == 0 && list->scanning) {
+        mvwprintw(state->main, 3, 2, "Scanning %s...", list->scan_range);
+    } else if (list->count == 0) {
         mvwprintw(state->main, 3, 2, "No network printers found");
     } else {
-        for (int i = 0; i < state->discover_count; i++) {
-            int y = i + 2;
+        /* Keep the selection on screen */
+        int rows = height - 2;
+        int first = list->selected >= rows ? list->selected - rows + 1 : 0;
+        int uri_width = width / 2 - 8;
+        int name_col = width / 2;
+
+        for (int i = first; i < list->count && i - first < rows; i++) {
+            discover_item_t *item = &list->items[i];
+            int y = i - first + 2;
+
+            if (i == list->selected) {
+                wattron(state->main, A_REVERSE);
+            }
+
+            mvwhline(state->main, y, 0, ' ', width);
+            mvwprintw(state->main, y, 1, "%c [%c] %-*.*s",
+                      i == list->selected ? '>' : ' ',
+                      item->marked ? 'x' : ' ',
+                      uri_width, uri_width, item->device.uri);
+
+            char name[128];
+            discover_expand_name(list->name_template, &item->device, name, sizeof(name));
+            mvwprintw(state->main, y, name_col, "%-24.24s ", name);
+
+            switch (item->status) {
+                case ADD_NONE:
+                    wprintw(state->main, "%.*s", width - name_col - 26, item->device.make_model);
+                    break;
+                case ADD_PENDING:
+                    wprintw(state->main, "adding...");
+                    break;
+                case ADD_DONE:
+                    wprintw(state->main, "added");
+                    break;
+                case ADD_FAILED:
+                    wprintw(state->main, "failed: %.*s", width - name_col - 34, item->error);
+                    break;
+            }
+
+            if (i == list->selected) {
+                wattroff(state->main, A_REVERSE);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&list->lock);
+
+    wrefresh(state->main);
+}
+
+static void draw_balance(ui_state_t *state) {
+    werase(state->main);
+
+    int width = getmaxx(state->main);
+    int height = getmaxy(state->main);
+
+    wattron(state->main, A_BOLD);
+    mvwprintw(state->main, 0, 1, "REBALANCE");
+    wattroff(state->main, A_BOLD);
+    wprintw(state->main, "  policy: %s",
+            state->balance.policy == POLICY_BALANCE ? "balance" : "failover");
+    if (state->balance.policy == POLICY_BALANCE) {
+        wprintw(state->main, "  threshold: %d", state->balance.threshold);
+    }
+    wprintw(state->main, "  dry run - Enter applies");
+    mvwhline(state->main, 1, 0, ACS_HLINE, width);
+
+    if (state->balance_count == 0) {
+        mvwprintw(state->main, 3, 2, "Nothing to move");
+    } else {
+        int rows = height - 2;
+        int first = state->balance_selected >= rows ? state->balance_selected - rows + 1 : 0;
+
+        for (int i = first; i < state->balance_count && i - first < rows; i++) {
+            balance_move_t *m = &state->balance_moves[i];
+            int y = i - first + 2;
 
-            if (i == state->discover_selected) {
+            if (i == state->balance_selected) {
                 wattron(state->main, A_REVERSE);
             }
 
+            const char *result = "";
+            if (op_pending(state, OP_MOVE_JOB, NULL, m->job_id)) result = "moving...";
+            else if (state->balance_results[i] > 0) result = "moved";
+            else if (state->balance_results[i] < 0) result = "failed";
+
             mvwhline(state->main, y, 0, ' ', width);
-            mvwprintw(state->main, y, 1, "%c %s",
-                      i == state->discover_selected ? '>' : ' ',
-                      state->discover_uris[i]);
+            mvwprintw(state->main, y, 1, "%c %-6d %-15.15s -> %-15.15s %-13.13s %-10.10s %.*s",
+                      i == state->balance_selected ? '>' : ' ',
+                      m->job_id, m->from, m->to, m->reason, result,
+                      width - 72 > 0 ? width - 72 : 0, m->title);
 
-            if (i == state->discover_selected) {
+            if (i == state->balance_selected) {
                 wattroff(state->main, A_REVERSE);
             }
         }
@@ -245,7 +907,179 @@ static void draw_discover(ui_state_t *state) {
     wrefresh(state->main);
 }
 
-void ui_init(ui_state_t *state) {
+static void draw_usage(ui_state_t *state) {
+    werase(state->main);
+
+    int width = getmaxx(state->main);
+    int height = getmaxy(state->main);
+    pagelog_t *log = &state->pagelog;
+
+    pthread_mutex_lock(&log->lock);
+    int generation = log->generation;
+    int catching_up = log->catching_up;
+    off_t offset = log->offset;
+    off_t size = log->size;
+    char error[256];
+    memcpy(error, log->error, sizeof(error));
+    pthread_mutex_unlock(&log->lock);
+
+    /* Rows are rebuilt only when the aggregates moved */
+    if (generation != state->usage_generation) {
+        free(state->usage_rows);
+        state->usage_count = pagelog_rows(log, state->usage_kind, &state->usage_rows);
+        state->usage_generation = generation;
+        if (state->usage_selected >= state->usage_count) {
+            state->usage_selected = state->usage_count > 0 ? state->usage_count - 1 : 0;
+        }
+    }
+
+    wattron(state->main, A_BOLD);
+    mvwprintw(state->main, 0, 1, "PAGE USAGE");
+    wattroff(state->main, A_BOLD);
+    wprintw(state->main, "  by %s  %s",
+            state->usage_kind == PAGELOG_USERS ? "user" : "printer", log->path);
+    if (catching_up && size > 0) {
+        wprintw(state->main, "  reading %d%%", (int)(offset * 100 / size));
+    }
+    if (error[0]) {
+        wattron(state->main, COLOR_PAIR(5));
+        wprintw(state->main, "  %s", error);
+        wattroff(state->main, COLOR_PAIR(5));
+    }
+    mvwhline(state->main, 1, 0, ACS_HLINE, width);
+
+    if (state->usage_count == 0) {
+        mvwprintw(state->main, 3, 2, "%s", catching_up ? "Reading..." : "No pages logged");
+        wrefresh(state->main);
+        return;
+    }
+
+    int name_width = width - 42 > 10 ? width - 42 : 10;
+    wattron(state->main, A_BOLD);
+    mvwprintw(state->main, 2, 3, "%-*s %8s %8s %8s %10s", name_width,
+              state->usage_kind == PAGELOG_USERS ? "USER" : "PRINTER",
+              "TODAY", "7 DAYS", "30 DAYS", "TOTAL");
+    wattroff(state->main, A_BOLD);
+
+    int rows = height - 3;
+    int first = state->usage_selected >= rows ? state->usage_selected - rows + 1 : 0;
+    for (int i = first; i < state->usage_count && i - first < rows; i++) {
+        pagelog_row_t *r = &state->usage_rows[i];
+        int y = i - first + 3;
+
+        if (i == state->usage_selected) {
+            wattron(state->main, A_REVERSE);
+        }
+        mvwhline(state->main, y, 0, ' ', width);
+        mvwprintw(state->main, y, 1, "%c %-*.*s %8u %8u %8u %10llu",
+                  i == state->usage_selected ? '>' : ' ',
+                  name_width, name_width, r->name, r->today, r->week, r->month,
+                  (unsigned long long)r->total);
+        if (i == state->usage_selected) {
+            wattroff(state->main, A_REVERSE);
+        }
+    }
+
+    wrefresh(state->main);
+}
+
+static void draw_search(ui_state_t *state) {
+    werase(state->main);
+
+    int width = getmaxx(state->main);
+    int height = getmaxy(state->main);
+    jobindex_t *index = &state->jobindex;
+
+    pthread_mutex_lock(&index->lock);
+    int generation = index->generation;
+    int loaded = index->loaded;
+    int jobs_seen = index->data.doc_count;
+    pthread_mutex_unlock(&index->lock);
+
+    /* Searched again when the query changes or new jobs were indexed */
+    if (generation != state->search_generation) {
+        if (!state->search_results) {
+            state->search_results = malloc(SEARCH_MAX_RESULTS * sizeof(job_info_t));
+        }
+        state->search_count = state->search_results
+            ? jobindex_search(index, state->search_query, state->search_results, SEARCH_MAX_RESULTS)
+            : 0;
+        state->search_generation = generation;
+        if (state->search_selected >= state->search_count) {
+            state->search_selected = state->search_count > 0 ? state->search_count - 1 : 0;
+        }
+    }
+
+    wattron(state->main, A_BOLD);
+    mvwprintw(state->main, 0, 1, "JOB SEARCH");
+    wattroff(state->main, A_BOLD);
+    if (state->search_query[0]) wprintw(state->main, "  '%s'", state->search_query);
+    wprintw(state->main, "  %d%s of %d jobs", state->search_count,
+            state->search_count == SEARCH_MAX_RESULTS ? "+" : "", jobs_seen);
+    if (!loaded) wprintw(state->main, "  loading index...");
+    mvwhline(state->main, 1, 0, ACS_HLINE, width);
+
+    if (state->search_count == 0) {
+        mvwprintw(state->main, 3, 2, "%s", loaded ? "No matching jobs" : "Loading...");
+        wrefresh(state->main);
+        return;
+    }
+
+    wattron(state->main, A_BOLD);
+    mvwprintw(state->main, 2, 3, "%-7s %-15s %-12s %-10s %-19s  %s",
+              "ID", "PRINTER", "USER", "STATE", "FINISHED", "TITLE");
+    wattroff(state->main, A_BOLD);
+
+    int rows = height - 3;
+    int first = state->search_selected >= rows ? state->search_selected - rows + 1 : 0;
+    int title_width = width - 74 > 10 ? width - 74 : 10;
+    for (int i = first; i < state->search_count && i - first < rows; i++) {
+        job_info_t *j = &state->search_results[i];
+        int y = i - first + 3;
+        char finished[32];
+        format_time(finished, sizeof(finished), j->completed);
+
+        if (i == state->search_selected) {
+            wattron(state->main, A_REVERSE);
+        }
+        mvwhline(state->main, y, 0, ' ', width);
+        mvwprintw(state->main, y, 1, "%c %-7d %-15.15s %-12.12s %-10.10s %-19s  %.*s",
+                  i == state->search_selected ? '>' : ' ', j->id, j->printer, j->user,
+                  j->state, finished, title_width, j->title);
+        if (i == state->search_selected) {
+            wattroff(state->main, A_REVERSE);
+        }
+    }
+
+    wrefresh(state->main);
+}
+
+/* Refresh the lists and work out a fresh set of moves to preview */
+static void plan_balance(ui_state_t *state) {
+    if (op_pending(state, OP_MOVE_JOB, NULL, 0)) {
+        ui_set_status(state, "Moves still in progress");
+        return;
+    }
+
+    char err[1024];
+    balance_free_config(&state->balance);
+    if (balance_load_config(&state->balance, err, sizeof(err)) != 0) {
+        ui_set_status(state, "%s", err);
+    }
+
+    printer_list_refresh(&state->printers);
+    job_list_refresh(&state->jobs);
+
+    free(state->balance_moves);
+    free(state->balance_results);
+    state->balance_count = balance_plan(&state->balance, state->printers.items,
+                                        state->printers.count, state->jobs.items,
+                                        state->jobs.count, &state->balance_moves);
+    state->balance_results = calloc(state->balance_count ? state->balance_count : 1, sizeof(int));
+    state->balance_selected = 0;
+}
+
+void ui_init(ui_state_t *state, const char *page_log) {
     initscr();
     cbreak();
     noecho();
@@ -259,6 +1093,7 @@ void ui_init(ui_state_t *state) {
     init_pair(2, COLOR_GREEN, -1);   /* Green for active panel border */
     init_pair(3, COLOR_WHITE, -1);   /* Dim white for inactive panel border */
     init_pair(4, COLOR_WHITE, COLOR_BLUE);  /* Header: white on blue */
+    init_pair(5, COLOR_RED, -1);     /* Red for unreachable printers */
 
     refresh();  /* Must refresh stdscr before subwindows will display */
 
@@ -276,37 +1111,87 @@ void ui_init(ui_state_t *state) {
     state->status_msg[0] = '\0';
     state->running = 1;
 
-    state->discover_uris = NULL;
-    state->discover_names = NULL;
-    state->discover_count = 0;
-    state->discover_selected = 0;
-    state->discover_generation = 0;
+    discover_list_init(&state->discover);
+    state->batch_total = 0;
+    state->batch_failed = 0;
+
+    memset(&state->balance, 0, sizeof(state->balance));
+    state->balance_moves = NULL;
+    state->balance_results = NULL;
+    state->balance_count = 0;
+    state->balance_selected = 0;
+    state->broker_generation = 0;
+
+    pagelog_init(&state->pagelog, page_log);
+    state->usage_kind = PAGELOG_PRINTERS;
+    state->usage_rows = NULL;
+    state->usage_count = 0;
+    state->usage_generation = -1;
+    state->usage_selected = 0;
+
+    jobindex_init(&state->jobindex);
+    state->search_query[0] = '\0';
+    state->search_results = NULL;
+    state->search_count = 0;
+    state->search_generation = -1;
+    state->search_selected = 0;
+
+    state->prompt = PROMPT_NONE;
+    state->prompt_buf[0] = '\0';
+    state->prompt_target[0] = '\0';
+    state->submit = NULL;
 
     state->modal = MODAL_NONE;
     state->modal_msg[0] = '\0';
 
+    executor_init(&state->executor);
+    state->inflight_count = 0;
+    state->marked_count = 0;
+
     printer_list_init(&state->printers);
     job_list_init(&state->jobs);
 
     printer_list_refresh(&state->printers);
     job_list_refresh(&state->jobs);
+
+    stats_init(&state->stats);
+    health_init(&state->health);
+    state->health_generation = -1;
+    history_init(&state->history);
+    state->history_time = 0;
+    stats_start(&state->stats);
+
+    detail_init(&state->detail);
 }
 
 void ui_cleanup(ui_state_t *state) {
-    /* Invalidate any running discovery threads */
-    state->discover_generation = -1;
-
     delwin(state->header);
     delwin(state->main);
     delwin(state->footer);
 
+    /* Let already confirmed operations and submissions finish */
+    executor_shutdown(&state->executor);
+    if (state->submit) {
+        submit_batch_free(state->submit);
+        free(state->submit);
+    }
+    detail_shutdown(&state->detail);
+    stats_free(&state->stats);
+    health_shutdown(&state->health);
+    history_shutdown(&state->history);
+
     printer_list_free(&state->printers);
     job_list_free(&state->jobs);
 
-    if (state->discover_uris) {
-        free_discovered(state->discover_uris, state->discover_names,
-                        state->discover_count);
-    }
+    discover_list_free(&state->discover);
+    balance_free_config(&state->balance);
+    free(state->balance_moves);
+    free(state->balance_results);
+    pagelog_shutdown(&state->pagelog);
+    free(state->usage_rows);
+    jobindex_shutdown(&state->jobindex);
+    free(state->search_results);
+    broker_detach();
 
     endwin();
 }
@@ -314,9 +1199,54 @@ void ui_cleanup(ui_state_t *state) {
 void ui_poll(ui_state_t *state) {
     /* Check if discovery finished with no results */
     if (state->current_view == VIEW_DISCOVER &&
-        state->discover_count == 0 && state->status_msg[0] == '\0') {
+        state->discover.count == 0 && !state->discover.scanning &&
+        state->status_msg[0] == '\0') {
         ui_set_status(state, "No network printers found");
     }
+
+    int submitting = state->submit != NULL;
+    poll_submit(state);
+    int refreshed = submitting && !state->submit;
+
+    /* Probe whatever printers are configured now */
+    if (state->printers.generation != state->health_generation && !state->history_time) {
+        state->health_generation = state->printers.generation;
+        health_update(&state->health, state->printers.items, state->printers.count);
+    }
+
+    /* Snapshots published by a broker are picked up as they appear */
+    uint64_t generation = broker_generation();
+    if (generation != state->broker_generation) {
+        state->broker_generation = generation;
+        if (generation != 0 && !state->history_time) {
+            printer_list_refresh(&state->printers);
+            job_list_refresh(&state->jobs);
+        }
+    }
+
+    op_t *op;
+    while ((op = executor_poll(&state->executor))) {
+        finish_op(state, op);
+        free(op->updates);
+        free(op);
+        refreshed = 1;
+    }
+
+    /* Finished work refreshes the lists; a rewound view stays put */
+    if (refreshed && state->history_time) {
+        show_history(state, state->history_time);
+    }
+    if (state->marked_count > 0 && !state->history_time) {
+        prune_job_marks(state);
+    }
+
+    /* Details are only fetched once the job selection settles */
+    if (state->current_view == VIEW_MAIN && state->active_panel == PANEL_JOBS &&
+        state->jobs.count > 0 && !state->history_time) {
+        detail_select(&state->detail, &state->jobs.items[state->jobs.selected]);
+    } else {
+        detail_select(&state->detail, NULL);
+    }
 }
 
 void ui_resize(ui_state_t *state) {
@@ -380,6 +1310,15 @@ void ui_draw(ui_state_t *state) {
         case VIEW_DISCOVER:
             draw_discover(state);
             break;
+        case VIEW_BALANCE:
+            draw_balance(state);
+            break;
+        case VIEW_USAGE:
+            draw_usage(state);
+            break;
+        case VIEW_SEARCH:
+            draw_search(state);
+            break;
     }
 
     draw_footer(state);
@@ -400,29 +1339,98 @@ static void handle_printers_input(ui_state_t *state, int ch) {
         case KEY_UP:
             printer_list_move(&state->printers, -1);
             break;
+        case KEY_NPAGE:
+            printer_list_move(&state->printers, state->printers.page);
+            break;
+        case KEY_PPAGE:
+            printer_list_move(&state->printers, -state->printers.page);
+            break;
+        case 'g':
+        case KEY_HOME:
+            printer_list_move(&state->printers, -state->printers.view_count);
+            break;
+        case 'G':
+        case KEY_END:
+            printer_list_move(&state->printers, state->printers.view_count);
+            break;
+        case '/':
+            snprintf(state->prompt_buf, sizeof(state->prompt_buf), "%s", state->printers.filter);
+            state->prompt = PROMPT_FILTER;
+            break;
         case '\n':
         case KEY_ENTER:
-            if (state->printers.count > 0) {
-                printer_info_t *p = &state->printers.items[state->printers.selected];
-                if (set_default_printer(p->name) == 0) {
-                    ui_set_status(state, "Set %s as default", p->name);
-                    printer_list_refresh(&state->printers);
-                } else {
-                    ui_set_status(state, "Failed to set default");
+            if (rewound(state)) break;
+            if (printer_list_current(&state->printers)) {
+                printer_info_t *p = printer_list_current(&state->printers);
+                if (submit_op(state, OP_SET_DEFAULT, p->name, NULL, 0) == 0) {
+                    ui_set_status(state, "Setting %s as default...", p->name);
                 }
             }
             break;
+        case 's':
+            if (rewound(state)) break;
+            if (printer_list_current(&state->printers)) {
+                printer_info_t *p = printer_list_current(&state->printers);
+                snprintf(state->prompt_target, sizeof(state->prompt_target), "%s", p->name);
+                state->prompt_buf[0] = '\0';
+                state->prompt = PROMPT_SUBMIT;
+            }
+            break;
         case 'd':
-            if (state->printers.count > 0) {
-                printer_info_t *p = &state->printers.items[state->printers.selected];
+            if (rewound(state)) break;
+            if (printer_list_current(&state->printers)) {
+                printer_info_t *p = printer_list_current(&state->printers);
                 snprintf(state->modal_msg, sizeof(state->modal_msg),
                          "Delete printer '%s'?", p->name);
+                snprintf(state->modal_printer, sizeof(state->modal_printer), "%s", p->name);
                 state->modal = MODAL_CONFIRM_DELETE;
             }
             break;
     }
 }
 
+/* Hold, release or reprioritize the marked jobs, or the selected one.
+ * Jobs the action can't apply to are left out of the batch. */
+static void update_selected_jobs(ui_state_t *state, job_action_t action, int delta) {
+    static const char *labels[] = { "holding", "releasing", "priority" };
+    if (rewound(state)) return;
+    job_update_t *updates = calloc(state->jobs.count ? state->jobs.count : 1, sizeof(job_update_t));
+    if (!updates) return;
+
+    int count = 0;
+    for (int i = 0; i < state->jobs.count; i++) {
+        job_info_t *j = &state->jobs.items[i];
+        int chosen = state->marked_count ? job_marked(state, j->id) : i == state->jobs.selected;
+        if (!chosen || updating_job(state, j->id)) continue;
+
+        int pending = strcmp(j->state, "pending") == 0;
+        int held = strcmp(j->state, "held") == 0;
+        job_update_t *u = &updates[count];
+        u->job_id = j->id;
+        u->action = action;
+        if (action == JOB_HOLD && !pending) continue;
+        if (action == JOB_RELEASE && !held) continue;
+        if (action == JOB_SET_PRIORITY) {
+            if (!pending && !held) continue;
+            u->priority = j->priority + delta;
+            if (u->priority > 100) u->priority = 100;
+            if (u->priority < 1) u->priority = 1;
+            if (u->priority == j->priority) continue;
+        }
+        count++;
+    }
+
+    if (count == 0) {
+        ui_set_status(state, "No %s jobs selected", action == JOB_RELEASE ? "held" : "queued");
+        free(updates);
+        return;
+    }
+    if (submit_updates(state, updates, count, labels[action]) == 0) {
+        state->marked_count = 0;
+        ui_set_status(state, "Updating %d jobs...", count);
+    }
+}
+
 static void handle_jobs_input(ui_state_t *state, int ch) {
     switch (ch) {
         case 'j':
@@ -434,13 +1442,71 @@ static void handle_jobs_input(ui_state_t *state, int ch) {
             job_list_move(&state->jobs, -1);
             break;
         case 'c':
+            if (rewound(state)) break;
             if (state->jobs.count > 0) {
                 job_info_t *j = &state->jobs.items[state->jobs.selected];
                 snprintf(state->modal_msg, sizeof(state->modal_msg),
                          "Cancel job %d '%s'?", j->id, j->title);
+                state->modal_job_id = j->id;
                 state->modal = MODAL_CONFIRM_CANCEL_JOB;
             }
             break;
+        case ' ':
+            if (state->jobs.count > 0) {
+                toggle_job_mark(state, state->jobs.items[state->jobs.selected].id);
+                job_list_move(&state->jobs, 1);
+            }
+            break;
+        case 'h':
+            update_selected_jobs(state, JOB_HOLD, 0);
+            break;
+        case 'l':
+            update_selected_jobs(state, JOB_RELEASE, 0);
+            break;
+        case '+':
+        case '=':
+            update_selected_jobs(state, JOB_SET_PRIORITY, 10);
+            break;
+        case '-':
+            update_selected_jobs(state, JOB_SET_PRIORITY, -10);
+            break;
+        case '/':
+            state->current_view = VIEW_SEARCH;
+            snprintf(state->prompt_buf, sizeof(state->prompt_buf), "%s", state->search_query);
+            state->prompt = PROMPT_SEARCH;
+            break;
+    }
+}
+
+/* Queue adds for the marked devices, or the selected one if none are marked */
+static void add_discovered(ui_state_t *state) {
+    discover_list_t *list = &state->discover;
+    int queued = 0;
+
+    pthread_mutex_lock(&list->lock);
+    int marked = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i].marked) marked++;
+    }
+
+    for (int i = 0; i < list->count; i++) {
+        discover_item_t *item = &list->items[i];
+        if (marked ? !item->marked : i != list->selected) continue;
+        if (item->status == ADD_PENDING || item->status == ADD_DONE) continue;
+
+        char name[128];
+        discover_expand_name(list->name_template, &item->device, name, sizeof(name));
+        if (submit_op(state, OP_ADD_PRINTER, name, item->device.uri, 0) == 0) {
+            item->status = ADD_PENDING;
+            item->error[0] = '\0';
+            queued++;
+        }
+    }
+    pthread_mutex_unlock(&list->lock);
+
+    if (queued > 0) {
+        state->batch_total += queued;
+        ui_set_status(state, "Adding printers 0/%d...", state->batch_total);
     }
 }
 
@@ -448,38 +1514,225 @@ static void handle_discover_input(ui_state_t *state, int ch) {
     switch (ch) {
         case 'j':
         case KEY_DOWN:
-            if (state->discover_selected < state->discover_count - 1)
-                state->discover_selected++;
+            discover_list_move(&state->discover, 1);
             break;
         case 'k':
         case KEY_UP:
-            if (state->discover_selected > 0)
-                state->discover_selected--;
+            discover_list_move(&state->discover, -1);
+            break;
+        case ' ':
+            discover_list_toggle(&state->discover);
+            discover_list_move(&state->discover, 1);
             break;
         case '\n':
         case KEY_ENTER:
-            if (state->discover_count > 0) {
-                char *uri = state->discover_uris[state->discover_selected];
-                char *name = state->discover_names[state->discover_selected];
-                if (add_printer(name, uri) == 0) {
-                    ui_set_status(state, "Added %s", name);
-                    printer_list_refresh(&state->printers);
+            if (state->discover.count > 0) {
+                add_discovered(state);
+            }
+            break;
+        case 't':
+            pthread_mutex_lock(&state->discover.lock);
+            snprintf(state->prompt_buf, sizeof(state->prompt_buf), "%s",
+                     state->discover.name_template);
+            pthread_mutex_unlock(&state->discover.lock);
+            state->prompt = PROMPT_NAME_TEMPLATE;
+            break;
+        case 's':
+            pthread_mutex_lock(&state->discover.lock);
+            snprintf(state->prompt_buf, sizeof(state->prompt_buf), "%s",
+                     state->discover.scan_range);
+            pthread_mutex_unlock(&state->discover.lock);
+            state->prompt = PROMPT_SCAN;
+            break;
+        case 27: /* Escape */
+            state->current_view = VIEW_MAIN;
+            discover_list_cancel(&state->discover);
+            break;
+    }
+}
+
+static void submit_prompt(ui_state_t *state) {
+    switch (state->prompt) {
+        case PROMPT_NAME_TEMPLATE:
+            pthread_mutex_lock(&state->discover.lock);
+            snprintf(state->discover.name_template, sizeof(state->discover.name_template),
+                     "%s", state->prompt_buf[0] ? state->prompt_buf : DISCOVER_DEFAULT_TEMPLATE);
+            pthread_mutex_unlock(&state->discover.lock);
+            break;
+        case PROMPT_SUBMIT:
+            start_submit(state, state->prompt_target, state->prompt_buf);
+            break;
+        case PROMPT_FILTER:
+        case PROMPT_SEARCH:
+            /* Already applied as it was typed */
+            break;
+        case PROMPT_SCAN:
+            if (discover_list_scan(&state->discover, state->prompt_buf) != 0) {
+                if (state->discover.scanning) {
+                    ui_set_status(state, "A scan is already running");
                 } else {
-                    ui_set_status(state, "Failed to add printer");
+                    ui_set_status(state, "Bad range '%s', expected e.g. 192.168.1.0/24 (/%d at most)",
+                                  state->prompt_buf, SCAN_MIN_PREFIX);
+                }
+            }
+            break;
+        case PROMPT_NONE:
+            break;
+    }
+}
+
+static void handle_prompt_input(ui_state_t *state, int ch) {
+    size_t len = strlen(state->prompt_buf);
+
+    switch (ch) {
+        case '\n':
+        case KEY_ENTER:
+            submit_prompt(state);
+            state->prompt = PROMPT_NONE;
+            break;
+        case 27: /* Escape */
+            if (state->prompt == PROMPT_FILTER) printer_list_filter(&state->printers, "");
+            state->prompt = PROMPT_NONE;
+            return;
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            if (len > 0) state->prompt_buf[len - 1] = '\0';
+            break;
+        default:
+            if (ch >= 32 && ch < 127 && len < sizeof(state->prompt_buf) - 1) {
+                state->prompt_buf[len] = (char)ch;
+                state->prompt_buf[len + 1] = '\0';
+            }
+            break;
+    }
+
+    /* The printer filter narrows as it is typed, and searches run per key */
+    if (state->prompt == PROMPT_FILTER) {
+        printer_list_filter(&state->printers, state->prompt_buf);
+    } else if (state->prompt == PROMPT_SEARCH) {
+        snprintf(state->search_query, sizeof(state->search_query), "%s", state->prompt_buf);
+        state->search_generation = -1;
+        state->search_selected = 0;
+    }
+}
+
+static void handle_balance_input(ui_state_t *state, int ch) {
+    switch (ch) {
+        case 'j':
+        case KEY_DOWN:
+            if (state->balance_selected < state->balance_count - 1)
+                state->balance_selected++;
+            break;
+        case 'k':
+        case KEY_UP:
+            if (state->balance_selected > 0)
+                state->balance_selected--;
+            break;
+        case '\n':
+        case KEY_ENTER: {
+            int queued = 0;
+            for (int i = 0; i < state->balance_count; i++) {
+                balance_move_t *m = &state->balance_moves[i];
+                if (state->balance_results[i] > 0) continue;
+                if (submit_op(state, OP_MOVE_JOB, m->to, NULL, m->job_id) == 0) {
+                    state->balance_results[i] = 0;
+                    queued++;
                 }
-                /* Return to main view and clean up */
-                state->current_view = VIEW_MAIN;
-                state->discover_generation++;
-                free_discovered(state->discover_uris, state->discover_names,
-                                state->discover_count);
-                state->discover_uris = NULL;
-                state->discover_names = NULL;
-                state->discover_count = 0;
             }
+            if (queued > 0) ui_set_status(state, "Moving %d jobs...", queued);
+            break;
+        }
+        case 27: /* Escape */
+            state->current_view = VIEW_MAIN;
+            break;
+    }
+}
+
+static void handle_usage_input(ui_state_t *state, int ch) {
+    switch (ch) {
+        case 'j':
+        case KEY_DOWN:
+            if (state->usage_selected < state->usage_count - 1)
+                state->usage_selected++;
+            break;
+        case 'k':
+        case KEY_UP:
+            if (state->usage_selected > 0)
+                state->usage_selected--;
+            break;
+        case 27: /* Escape */
+            state->current_view = VIEW_MAIN;
+            break;
+    }
+}
+
+static int find_job_row(ui_state_t *state, int job_id) {
+    for (int i = 0; i < state->jobs.count; i++) {
+        if (state->jobs.items[i].id == job_id) return i;
+    }
+    return -1;
+}
+
+static int has_printer(ui_state_t *state, const char *name) {
+    for (int i = 0; i < state->printers.count; i++) {
+        if (strcmp(state->printers.items[i].name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Show the selected result in the jobs panel: live while it is queued,
+ * else rewound to just before it finished if history reaches back */
+static void jump_to_job(ui_state_t *state) {
+    if (state->search_count == 0) return;
+    job_info_t job = state->search_results[state->search_selected];
+
+    if (state->history_time) go_live(state);
+    else job_list_refresh(&state->jobs);
+    int row = find_job_row(state, job.id);
+
+    time_t first, last;
+    if (row < 0 && job.completed > 0 &&
+        history_range(&state->history, &first, &last) == 0 && job.completed - 1 >= first) {
+        show_history(state, job.completed - 1);
+        row = find_job_row(state, job.id);
+        if (row < 0 && state->history_time) go_live(state);
+    }
+
+    if (row < 0) {
+        char when[32];
+        format_time(when, sizeof(when), job.completed);
+        ui_set_status(state, "Job %d is %s (%s), no longer in the queue", job.id, job.state, when);
+        return;
+    }
+    state->current_view = VIEW_MAIN;
+    state->active_panel = PANEL_JOBS;
+    state->jobs.selected = row;
+    ui_set_status(state, "Job %d", job.id);
+}
+
+static void handle_search_input(ui_state_t *state, int ch) {
+    switch (ch) {
+        case 'j':
+        case KEY_DOWN:
+            if (state->search_selected < state->search_count - 1)
+                state->search_selected++;
+            break;
+        case 'k':
+        case KEY_UP:
+            if (state->search_selected > 0)
+                state->search_selected--;
+            break;
+        case '/':
+            snprintf(state->prompt_buf, sizeof(state->prompt_buf), "%s", state->search_query);
+            state->prompt = PROMPT_SEARCH;
+            break;
+        case '\n':
+        case KEY_ENTER:
+            jump_to_job(state);
             break;
         case 27: /* Escape */
             state->current_view = VIEW_MAIN;
-            state->discover_generation++;
             break;
     }
 }
@@ -488,21 +1741,20 @@ static void handle_modal_input(ui_state_t *state, int ch) {
     switch (ch) {
         case 'y':
         case 'Y':
+            /* Act on what was confirmed, not on what is selected now */
             if (state->modal == MODAL_CONFIRM_DELETE) {
-                printer_info_t *p = &state->printers.items[state->printers.selected];
-                if (delete_printer(p->name) == 0) {
-                    ui_set_status(state, "Deleted %s", p->name);
-                    printer_list_refresh(&state->printers);
-                } else {
-                    ui_set_status(state, "Failed to delete printer");
+                const char *name = state->modal_printer;
+                if (!has_printer(state, name)) {
+                    ui_set_status(state, "Printer %s is gone", name);
+                } else if (submit_op(state, OP_DELETE_PRINTER, name, NULL, 0) == 0) {
+                    ui_set_status(state, "Deleting %s...", name);
                 }
             } else if (state->modal == MODAL_CONFIRM_CANCEL_JOB) {
-                job_info_t *j = &state->jobs.items[state->jobs.selected];
-                if (cancel_job(j->id) == 0) {
-                    ui_set_status(state, "Cancelled job %d", j->id);
-                    job_list_refresh(&state->jobs);
-                } else {
-                    ui_set_status(state, "Failed to cancel job");
+                int id = state->modal_job_id;
+                if (find_job_row(state, id) < 0) {
+                    ui_set_status(state, "Job %d is no longer queued", id);
+                } else if (submit_op(state, OP_CANCEL_JOB, NULL, NULL, id) == 0) {
+                    ui_set_status(state, "Cancelling job %d...", id);
                 }
             }
             state->modal = MODAL_NONE;
@@ -522,6 +1774,10 @@ void ui_handle_input(ui_state_t *state, int ch) {
         handle_modal_input(state, ch);
         return;
     }
+    if (state->prompt != PROMPT_NONE) {
+        handle_prompt_input(state, ch);
+        return;
+    }
 
     /* Global keys */
     switch (ch) {
@@ -530,7 +1786,11 @@ void ui_handle_input(ui_state_t *state, int ch) {
             if (state->current_view == VIEW_DISCOVER) {
                 state->current_view = VIEW_MAIN;
                 /* Invalidate any running discovery so its results are discarded */
-                state->discover_generation++;
+                discover_list_cancel(&state->discover);
+            } else if (state->current_view == VIEW_BALANCE ||
+                       state->current_view == VIEW_USAGE ||
+                       state->current_view == VIEW_SEARCH) {
+                state->current_view = VIEW_MAIN;
             } else {
                 state->running = 0;
             }
@@ -539,35 +1799,72 @@ void ui_handle_input(ui_state_t *state, int ch) {
             if (state->current_view == VIEW_MAIN) {
                 state->active_panel = (state->active_panel == PANEL_PRINTERS)
                     ? PANEL_JOBS : PANEL_PRINTERS;
+            } else if (state->current_view == VIEW_USAGE) {
+                state->usage_kind = state->usage_kind == PAGELOG_PRINTERS
+                    ? PAGELOG_USERS : PAGELOG_PRINTERS;
+                state->usage_generation = -1;
+                state->usage_selected = 0;
             }
             return;
         case 'a':
         case 'A':
-            if (state->current_view != VIEW_DISCOVER) {
+            if (state->current_view == VIEW_MAIN) {
                 state->current_view = VIEW_DISCOVER;
-                state->discover_count = -1;  /* Show loading state */
-                state->discover_selected = 0;
-                state->discover_generation++;
                 state->status_msg[0] = '\0';
-
-                /* Start discovery in detached thread */
-                discover_args_t *args = malloc(sizeof(discover_args_t));
-                args->state = state;
-                args->generation = state->discover_generation;
-
-                pthread_t thread;
-                pthread_create(&thread, NULL, discover_thread_func, args);
-                pthread_detach(thread);
+                discover_list_start(&state->discover);
             }
             return;
         case 'r':
         case 'R':
             if (state->current_view == VIEW_MAIN) {
+                state->history_time = 0;
                 printer_list_refresh(&state->printers);
                 job_list_refresh(&state->jobs);
+                stats_wake(&state->stats);
                 ui_set_status(state, "Refreshed");
+            } else if (state->current_view == VIEW_BALANCE) {
+                plan_balance(state);
+            } else if (state->current_view == VIEW_USAGE) {
+                /* Day buckets are relative to today */
+                state->usage_generation = -1;
+            }
+            return;
+        case 'b':
+        case 'B':
+            if (state->current_view == VIEW_MAIN) {
+                /* Moves are planned from the live queue */
+                state->history_time = 0;
+                state->current_view = VIEW_BALANCE;
+                plan_balance(state);
             }
             return;
+        case 'u':
+        case 'U':
+            if (state->current_view == VIEW_MAIN) {
+                state->current_view = VIEW_USAGE;
+                pagelog_start(&state->pagelog);
+            }
+            return;
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+            if (state->current_view == VIEW_MAIN) {
+                int step = ch == '{' || ch == '}' ? HISTORY_STEP * 10 : HISTORY_STEP;
+                scrub_history(state, ch == '[' || ch == '{' ? -step : step);
+            }
+            return;
+        case 27: /* Escape */
+            if (state->current_view == VIEW_MAIN && state->history_time) {
+                go_live(state);
+                return;
+            }
+            if (state->current_view == VIEW_MAIN && state->marked_count > 0) {
+                state->marked_count = 0;
+                ui_set_status(state, "Marks cleared");
+                return;
+            }
+            break;
     }
 
     /* View-specific keys */
@@ -582,6 +1879,15 @@ void ui_handle_input(ui_state_t *state, int ch) {
         case VIEW_DISCOVER:
             handle_discover_input(state, ch);
             break;
+        case VIEW_BALANCE:
+            handle_balance_input(state, ch);
+            break;
+        case VIEW_USAGE:
+            handle_usage_input(state, ch);
+            break;
+        case VIEW_SEARCH:
+            handle_search_input(state, ch);
+            break;
     }
 }
 
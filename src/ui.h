@@ -5,6 +5,16 @@
 #include <pthread.h>
 #include "printers.h"
 #include "jobs.h"
+#include "detail.h"
+#include "stats.h"
+#include "health.h"
+#include "history.h"
+#include "executor.h"
+#include "discover.h"
+#include "submit.h"
+#include "balance.h"
+#include "pagelog.h"
+#include "jobindex.h"
 
 typedef enum {
     PANEL_PRINTERS,
@@ -13,7 +23,10 @@ typedef enum {
 
 typedef enum {
     VIEW_MAIN,
-    VIEW_DISCOVER
+    VIEW_DISCOVER,
+    VIEW_BALANCE,
+    VIEW_USAGE,
+    VIEW_SEARCH
 } view_t;
 
 typedef enum {
@@ -22,6 +35,27 @@ typedef enum {
     MODAL_CONFIRM_CANCEL_JOB
 } modal_t;
 
+typedef enum {
+    PROMPT_NONE,
+    PROMPT_NAME_TEMPLATE,
+    PROMPT_SUBMIT,
+    PROMPT_FILTER,
+    PROMPT_SCAN,
+    PROMPT_SEARCH
+} prompt_t;
+
+#define UI_MAX_OPS 256
+#define UI_MAX_MARKS 256
+
+/* An operation handed to the executor whose result hasn't come back yet.
+ * The panels draw its expected outcome until then. */
+typedef struct {
+    int id;
+    op_kind_t kind;
+    char name[256];
+    int job_id;
+} inflight_t;
+
 typedef struct {
     WINDOW *header;
     WINDOW *main;
@@ -32,23 +66,71 @@ typedef struct {
     panel_t active_panel;
     printer_list_t printers;
     job_list_t jobs;
+    int marked_jobs[UI_MAX_MARKS];  /* Ids the next hold/release/priority applies to */
+    int marked_count;
+    detail_cache_t detail;    /* Lazily fetched details for the selected job */
+    stats_t stats;            /* Per-printer queue wait / print time percentiles */
+    health_t health;          /* Direct reachability of each printer's device */
+    int health_generation;    /* Printer list generation the probes were set up for */
+    history_t history;        /* Recent queue snapshots the main panels can rewind to */
+    time_t history_time;      /* Moment the main panels show, 0 when live */
 
     /* Discovery mode */
-    char **discover_uris;
-    char **discover_names;
-    int discover_count;
-    int discover_selected;
-    int discover_generation;  /* Incremented each discovery, used to ignore stale results */
+    discover_list_t discover;
+    int batch_total;          /* Printers in the current batch add */
+    int batch_failed;
+
+    /* Rebalancing preview: planned moves and their outcome */
+    balance_config_t balance;
+    balance_move_t *balance_moves;
+    int *balance_results;     /* Per move: 0 not applied, 1 moved, -1 failed */
+    int balance_count;
+    int balance_selected;
+
+    /* Page counts from page_log, read once the view is first opened */
+    pagelog_t pagelog;
+    pagelog_kind_t usage_kind;
+    pagelog_row_t *usage_rows;
+    int usage_count;
+    int usage_generation;     /* pagelog generation the rows were built from */
+    int usage_selected;
+
+    /* Search over every job seen, finished ones included */
+    jobindex_t jobindex;
+    char search_query[256];
+    job_info_t *search_results;
+    int search_count;
+    int search_generation;    /* jobindex generation the results were found in, -1 to redo */
+    int search_selected;
+
+    /* Last broker snapshot shown, 0 when reading CUPS directly */
+    uint64_t broker_generation;
+
+    /* Single line text input in the footer */
+    prompt_t prompt;
+    char prompt_buf[256];
+    char prompt_target[256];  /* Printer the prompt applies to */
+
+    /* Files being printed, NULL when idle */
+    submit_batch_t *submit;
+
+    /* Mutations running in the background */
+    executor_t executor;
+    inflight_t inflight[UI_MAX_OPS];
+    int inflight_count;
 
     /* Modal state */
     modal_t modal;
     char modal_msg[256];
+    char modal_printer[256];  /* Target fixed when the modal opened; the */
+    int modal_job_id;         /* lists may refresh while it is shown */
 
     char status_msg[256];
     int running;
 } ui_state_t;
 
-void ui_init(ui_state_t *state);
+/* page_log is the CUPS page log to read, NULL for the default */
+void ui_init(ui_state_t *state, const char *page_log);
 void ui_cleanup(ui_state_t *state);
 void ui_resize(ui_state_t *state);
 void ui_draw(ui_state_t *state);
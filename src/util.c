@@ -0,0 +1,115 @@
+#include "util.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct timespec abs_deadline(uint64_t ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    return until;
+}
+
+/* Directory for spoolie under an XDG base directory */
+static int xdg_dir(char *buf, size_t len, const char *env, const char *fallback) {
+    const char *base = getenv(env);
+    int n;
+    if (base && base[0] == '/') {
+        n = snprintf(buf, len, "%s/spoolie", base);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) return -1;
+        n = snprintf(buf, len, "%s/%s/spoolie", home, fallback);
+    }
+    return n > 0 && (size_t)n < len ? 0 : -1;
+}
+
+/* mkdir -p */
+static int make_dirs(char *path) {
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        int failed = mkdir(path, 0700) < 0 && errno != EEXIST;
+        *p = '/';
+        if (failed) return -1;
+    }
+    return mkdir(path, 0700) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+int config_path(char *buf, size_t len, const char *name) {
+    if (xdg_dir(buf, len, "XDG_CONFIG_HOME", ".config") != 0) return -1;
+    size_t used = strlen(buf);
+    int n = snprintf(buf + used, len - used, "/%s", name);
+    return n > 0 && (size_t)n < len - used ? 0 : -1;
+}
+
+int state_path(char *buf, size_t len, const char *name) {
+    if (xdg_dir(buf, len, "XDG_STATE_HOME", ".local/state") != 0) return -1;
+    if (make_dirs(buf) != 0) return -1;
+    size_t used = strlen(buf);
+    int n = snprintf(buf + used, len - used, "/%s", name);
+    return n > 0 && (size_t)n < len - used ? 0 : -1;
+}
+
+void put_bytes(buffer_t *buf, const void *bytes, size_t len) {
+    if (buf->failed) return;
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 256;
+        while (cap < buf->len + len) cap *= 2;
+        uint8_t *grown = realloc(buf->data, cap);
+        if (!grown) {
+            buf->failed = 1;
+            return;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, bytes, len);
+    buf->len += len;
+}
+
+void put_varint(buffer_t *buf, uint64_t value) {
+    uint8_t bytes[10];
+    size_t n = 0;
+    while (value >= 0x80) {
+        bytes[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[n++] = (uint8_t)value;
+    put_bytes(buf, bytes, n);
+}
+
+void put_int(buffer_t *buf, int64_t value) {
+    put_varint(buf, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        *value |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+int get_int(const uint8_t **p, const uint8_t *end, int64_t *value) {
+    uint64_t v;
+    if (get_varint(p, end, &v) != 0) return -1;
+    *value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Milliseconds from a monotonic clock, for timeouts and debouncing */
+uint64_t monotonic_ms(void);
+
+/* Wall clock time ms from now, as pthread_cond_timedwait() wants it */
+struct timespec abs_deadline(uint64_t ms);
+
+/* $XDG_CONFIG_HOME/spoolie/<name>, defaulting to ~/.config. Returns 0 on success */
+int config_path(char *buf, size_t len, const char *name);
+
+/* $XDG_STATE_HOME/spoolie/<name>, defaulting to ~/.local/state. Creates the
+ * directory. Returns 0 on success */
+int state_path(char *buf, size_t len, const char *name);
+
+/* Growable byte buffer for the saved formats. Once an allocation fails,
+ * failed is set and further writes are dropped */
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} buffer_t;
+
+void put_bytes(buffer_t *buf, const void *bytes, size_t len);
+void put_varint(buffer_t *buf, uint64_t value);
+/* Zigzag, so small negative numbers stay short too */
+void put_int(buffer_t *buf, int64_t value);
+
+/* Return 0 and advance *p past one value, -1 if it runs past end */
+int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value);
+int get_int(const uint8_t **p, const uint8_t *end, int64_t *value);
+
+#endif
@@ -0,0 +1,379 @@
+#include "watch.h"
+#include "cups_api.h"
+#include "stats.h"
+#include "util.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Stop polling CUPS while this much output is still waiting for stdout */
+#define WATCH_HIGH_WATER (256 * 1024)
+
+/* How often per-printer latency percentiles are reported */
+#define WATCH_STATS_MS 60000
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t off;       /* Bytes already written */
+} outbuf_t;
+
+static volatile sig_atomic_t watch_stop;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+static void out_append(outbuf_t *out, const char *s, size_t n) {
+    if (out->len + n > out->cap) {
+        size_t cap = out->cap ? out->cap : 64 * 1024;
+        while (cap < out->len + n) cap *= 2;
+        char *data = realloc(out->data, cap);
+        if (!data) return;
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, s, n);
+    out->len += n;
+}
+
+static void out_printf(outbuf_t *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void out_printf(outbuf_t *out, const char *fmt, ...) {
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n > 0) out_append(out, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+static size_t out_pending(outbuf_t *out) {
+    return out->len - out->off;
+}
+
+/*
+ * Write whatever stdout will take without blocking. Writes are capped at
+ * PIPE_BUF so a POLLOUT-ready pipe never blocks us. Returns -1 if stdout
+ * has gone away.
+ */
+static int out_flush(outbuf_t *out) {
+    while (out_pending(out) > 0) {
+        struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+        if (poll(&pfd, 1, 0) <= 0) break;
+        if (pfd.revents & (POLLERR | POLLHUP)) return -1;
+
+        size_t n = out_pending(out);
+        if (n > PIPE_BUF) n = PIPE_BUF;
+        ssize_t w = write(STDOUT_FILENO, out->data + out->off, n);
+        if (w < 0) {
+            if (errno == EINTR || errno == EAGAIN) break;
+            return -1;
+        }
+        out->off += w;
+    }
+
+    if (out->off == out->len) {
+        out->off = out->len = 0;
+    } else if (out->off > out->cap / 2) {
+        memmove(out->data, out->data + out->off, out->len - out->off);
+        out->len -= out->off;
+        out->off = 0;
+    }
+    return 0;
+}
+
+static void emit_begin(outbuf_t *out, const char *event) {
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    out_printf(out, "{\"time\":\"%s\",\"mono_ms\":%llu,\"event\":\"%s\"",
+               stamp, (unsigned long long)monotonic_ms(), event);
+}
+
+static void emit_str(outbuf_t *out, const char *key, const char *val) {
+    out_printf(out, ",\"%s\":\"", key);
+    for (const unsigned char *p = (const unsigned char *)val; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            char esc[2] = { '\\', (char)*p };
+            out_append(out, esc, 2);
+        } else if (*p < 0x20) {
+            out_printf(out, "\\u%04x", *p);
+        } else {
+            out_append(out, (const char *)p, 1);
+        }
+    }
+    out_append(out, "\"", 1);
+}
+
+static void emit_int(outbuf_t *out, const char *key, long long val) {
+    out_printf(out, ",\"%s\":%lld", key, val);
+}
+
+static void emit_bool(outbuf_t *out, const char *key, int val) {
+    out_printf(out, ",\"%s\":%s", key, val ? "true" : "false");
+}
+
+static void emit_end(outbuf_t *out) {
+    out_append(out, "}\n", 2);
+}
+
+static void emit_printer(outbuf_t *out, const char *event, const printer_info_t *p,
+                         const printer_info_t *prev, int initial) {
+    emit_begin(out, event);
+    emit_str(out, "printer", p->name);
+    emit_str(out, "state", p->state);
+    emit_bool(out, "accepting", p->accepting);
+    if (prev) {
+        emit_str(out, "prev_state", prev->state);
+        emit_bool(out, "prev_accepting", prev->accepting);
+    }
+    if (initial) emit_bool(out, "initial", 1);
+    emit_end(out);
+}
+
+static void emit_job(outbuf_t *out, const char *event, const job_info_t *j,
+                     const char *prev_state, int initial) {
+    emit_begin(out, event);
+    emit_int(out, "job_id", j->id);
+    emit_str(out, "printer", j->printer);
+    emit_str(out, "user", j->user);
+    emit_str(out, "title", j->title);
+    emit_str(out, "state", j->state);
+    if (prev_state) emit_str(out, "prev_state", prev_state);
+    emit_int(out, "size", j->size);
+    if (initial) emit_bool(out, "initial", 1);
+    emit_end(out);
+}
+
+/* A job left the active list; ask CUPS how it ended */
+static void emit_job_finished(outbuf_t *out, const job_info_t *j) {
+    job_detail_t detail;
+    const char *event = "job_finished";
+    const char *state = "unknown";
+
+    if (get_job_detail(j->id, &detail) == 0 && detail.state[0]) {
+        state = detail.state;
+        if (strcmp(state, "completed") == 0) event = "job_completed";
+        else if (strcmp(state, "canceled") == 0) event = "job_cancelled";
+        else if (strcmp(state, "aborted") == 0) event = "job_aborted";
+    }
+
+    emit_begin(out, event);
+    emit_int(out, "job_id", j->id);
+    emit_str(out, "printer", j->printer);
+    emit_str(out, "user", j->user);
+    emit_str(out, "title", j->title);
+    emit_str(out, "state", state);
+    emit_str(out, "prev_state", j->state);
+    emit_end(out);
+}
+
+static void emit_quantiles(outbuf_t *out, const char *prefix, const quantiles_t *q) {
+    char key[32];
+    snprintf(key, sizeof(key), "%s_samples", prefix);
+    emit_int(out, key, q->samples);
+    if (q->samples == 0) return;
+    snprintf(key, sizeof(key), "%s_p50", prefix);
+    emit_int(out, key, q->p50);
+    snprintf(key, sizeof(key), "%s_p95", prefix);
+    emit_int(out, key, q->p95);
+    snprintf(key, sizeof(key), "%s_p99", prefix);
+    emit_int(out, key, q->p99);
+}
+
+static void emit_stats(outbuf_t *out, stats_t *stats, printer_info_t *printers, int count) {
+    for (int i = 0; i < count; i++) {
+        quantiles_t wait, duration;
+        if (stats_quantiles(stats, printers[i].name, &wait, &duration) == 0) continue;
+
+        emit_begin(out, "printer_stats");
+        emit_str(out, "printer", printers[i].name);
+        emit_int(out, "window_secs", STATS_SLOTS * STATS_SLOT_SECS);
+        emit_quantiles(out, "wait", &wait);
+        emit_quantiles(out, "print", &duration);
+        emit_end(out);
+    }
+}
+
+static int cmp_printer(const void *a, const void *b) {
+    return strcmp(((const printer_info_t *)a)->name, ((const printer_info_t *)b)->name);
+}
+
+static int cmp_job(const void *a, const void *b) {
+    int x = ((const job_info_t *)a)->id, y = ((const job_info_t *)b)->id;
+    return (x > y) - (x < y);
+}
+
+/* Merge-walk two name-sorted printer snapshots */
+static void diff_printers(outbuf_t *out, printer_info_t *old, int old_count,
+                          printer_info_t *cur, int cur_count, int initial) {
+    int i = 0, k = 0;
+    while (i < old_count || k < cur_count) {
+        int c = i >= old_count ? 1 : k >= cur_count ? -1
+              : strcmp(old[i].name, cur[k].name);
+        if (c < 0) {
+            emit_printer(out, "printer_removed", &old[i++], NULL, 0);
+        } else if (c > 0) {
+            emit_printer(out, "printer_added", &cur[k++], NULL, initial);
+        } else {
+            if (strcmp(old[i].state, cur[k].state) != 0 ||
+                old[i].accepting != cur[k].accepting) {
+                emit_printer(out, "printer_state_changed", &cur[k], &old[i], 0);
+            }
+            i++;
+            k++;
+        }
+    }
+}
+
+/* Merge-walk two id-sorted job snapshots */
+static void diff_jobs(outbuf_t *out, job_info_t *old, int old_count,
+                      job_info_t *cur, int cur_count, int initial) {
+    int i = 0, k = 0;
+    while (i < old_count || k < cur_count) {
+        int c = i >= old_count ? 1 : k >= cur_count ? -1
+              : cmp_job(&old[i], &cur[k]);
+        if (c < 0) {
+            emit_job_finished(out, &old[i++]);
+        } else if (c > 0) {
+            emit_job(out, "job_created", &cur[k++], NULL, initial);
+        } else {
+            if (strcmp(old[i].state, cur[k].state) != 0) {
+                emit_job(out, "job_state_changed", &cur[k], old[i].state, 0);
+            }
+            i++;
+            k++;
+        }
+    }
+}
+
+int watch_run(int interval_ms) {
+    outbuf_t out = {0};
+    printer_info_t *printers = NULL;
+    job_info_t *jobs = NULL;
+    int printer_count = 0, job_count = 0;
+    int initial = 1, jobs_initial = 1, failing = 0, skipped = 0;
+    stats_t stats;
+    stats_init(&stats);
+
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t next_poll = monotonic_ms();
+    uint64_t next_stats = next_poll + WATCH_STATS_MS;
+
+    while (!watch_stop) {
+        if (out_flush(&out) < 0) break;
+
+        uint64_t now = monotonic_ms();
+        if (now >= next_poll) {
+            next_poll = now + interval_ms;
+
+            /* Backpressure: let stdout catch up instead of queueing more.
+             * Skipped polls lose nothing - the next diff spans them. */
+            if (out_pending(&out) > WATCH_HIGH_WATER) {
+                skipped++;
+                goto wait;
+            }
+            if (skipped) {
+                emit_begin(&out, "backpressure");
+                emit_int(&out, "skipped_polls", skipped);
+                emit_end(&out);
+                skipped = 0;
+            }
+
+            printer_info_t *new_printers;
+            int new_printer_count = get_printers(&new_printers);
+            if (new_printer_count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) {
+                /* Don't report every printer as removed while cupsd is down */
+                if (!failing) {
+                    emit_begin(&out, "error");
+                    emit_str(&out, "message", cupsLastErrorString());
+                    emit_end(&out);
+                    failing = 1;
+                }
+                goto wait;
+            }
+
+            job_info_t *new_jobs;
+            int new_job_count = get_jobs(&new_jobs);
+            int jobs_failed = 0;
+            if (new_job_count == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING) {
+                /* Likewise for jobs: keep the old list and diff it next time */
+                if (!failing) {
+                    emit_begin(&out, "error");
+                    emit_str(&out, "message", cupsLastErrorString());
+                    emit_end(&out);
+                    failing = 1;
+                }
+                jobs_failed = 1;
+            } else {
+                failing = 0;
+            }
+
+            qsort(new_printers, new_printer_count, sizeof(printer_info_t), cmp_printer);
+            diff_printers(&out, printers, printer_count, new_printers, new_printer_count, initial);
+            free_printers(printers);
+            printers = new_printers;
+            printer_count = new_printer_count;
+            initial = 0;
+            if (jobs_failed) {
+                /* An empty queue is NULL too, so only a failure skips the diff */
+                free_jobs(new_jobs);
+                goto wait;
+            }
+
+            qsort(new_jobs, new_job_count, sizeof(job_info_t), cmp_job);
+            diff_jobs(&out, jobs, job_count, new_jobs, new_job_count, jobs_initial);
+            jobs_initial = 0;
+
+            if (now >= next_stats) {
+                next_stats = now + WATCH_STATS_MS;
+                stats_refresh(&stats, new_jobs, new_job_count);
+                emit_stats(&out, &stats, printers, printer_count);
+            }
+
+            free_jobs(jobs);
+            jobs = new_jobs;
+            job_count = new_job_count;
+            continue;
+        }
+
+wait:
+        now = monotonic_ms();
+        struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+        int timeout = next_poll > now ? (int)(next_poll - now) : 0;
+        poll(&pfd, out_pending(&out) > 0 ? 1 : 0, timeout);
+    }
+
+    /* Drain what's left, blocking this time */
+    while (out_pending(&out) > 0) {
+        ssize_t w = write(STDOUT_FILENO, out.data + out.off, out_pending(&out));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        out.off += w;
+    }
+
+    free_printers(printers);
+    free_jobs(jobs);
+    stats_free(&stats);
+    free(out.data);
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ * Headless mode: poll CUPS every interval_ms and write one JSON object per
+ * printer/job transition to stdout until interrupted. Returns exit status.
+ */
+int watch_run(int interval_ms);
+
+#endif